@@ -4,10 +4,56 @@
 #define DEBUG
 //#define DIFF_TEST
 
-#if _SHARE
-// do not enable these features while building a reference design
+/* Count the executions of every guest eip, block and control-transfer edge.
+ * The report is printed when the guest program ends. */
+//#define PROFILE
+
+/* Trace `call' and `ret' to count the instructions of every function and
+ * call stack. Load symbols with `--elf' to see the names of functions. */
+//#define FTRACE
+
+/* Sample the call stacks of the guest every few instructions, and write
+ * them folded. Enable it with `--sample'. */
+//#define SAMPLE
+
+/* Fast-forward between the samples of a sampled simulation with
+ * `--sampling', and write basic block vectors for SimPoint with `--bbv'. */
+//#define SIMPOINT
+
+/* Simulate L1 instruction/data caches and a unified L2 cache.
+ * Configure them with `--cache'. */
+//#define CACHE
+
+/* Model branch predictors, a BTB and a return address stack in the
+ * control-flow helpers. Select the predictor with `--bpred'. */
+//#define BPRED
+
+/* Take in-memory checkpoints periodically for `rsi' and `rc'.
+ * Configure them with `--checkpoint'. */
+//#define REVERSE
+
+/* Run several vCPUs in round-robin for the multi-processor extension of
+ * AM. Set their number with `--ncpu'. */
+//#define MULTI_CPU
+
+/* The build variants of the Makefile override the features above. */
+#ifdef NEMU_DIFFTEST
+#define DIFF_TEST
+#endif
+
+#if defined(NEMU_FAST) || _SHARE
+// do not enable these features while building a reference design, or
+// the fastest NEMU
 #undef DIFF_TEST
 #undef DEBUG
+#undef PROFILE
+#undef FTRACE
+#undef SAMPLE
+#undef SIMPOINT
+#undef CACHE
+#undef BPRED
+#undef REVERSE
+#undef MULTI_CPU
 #endif
 
 /* You will define this macro in PA2 */
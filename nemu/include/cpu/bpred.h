@@ -0,0 +1,18 @@
+#ifndef __BPRED_H__
+#define __BPRED_H__
+
+#include "common.h"
+
+enum { BPRED_BIMODAL, BPRED_GSHARE, BPRED_TAGE };
+
+/* extra cycles of a mispredicted branch */
+#define BPRED_MISS_PENALTY 15
+
+void init_bpred(char *predictor);
+void bpred_cond(vaddr_t pc, bool taken);
+void bpred_indirect(vaddr_t pc, vaddr_t target);
+void bpred_call(vaddr_t pc, vaddr_t target, vaddr_t ret_addr, bool is_indirect);
+void bpred_ret(vaddr_t pc, vaddr_t target);
+void bpred_report();
+
+#endif
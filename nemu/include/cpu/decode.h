@@ -6,6 +6,7 @@
 #include "rtl.h"
 
 enum { OP_TYPE_REG, OP_TYPE_MEM, OP_TYPE_IMM };
+enum { REP_NONE, REP_E, REP_NE };
 
 #define OP_STR_SIZE 40
 
@@ -26,14 +27,18 @@ typedef struct {
   uint32_t opcode;
   vaddr_t seq_eip;  // sequential eip
   bool is_operand_size_16;
+  int rep;  // the rep/repe (0xf3) or repne (0xf2) prefix
   uint8_t ext_opcode;
   bool is_jmp;
   vaddr_t jmp_eip;
+  bool is_restart;  // a string instruction has run a chunk and restarts itself
   Operand src, dest, src2;
 #ifdef DEBUG
   char assembly[80];
   char asm_buf[128];
   char *p;
+  uint8_t instr[16];  // the bytes of the instruction
+  int instr_len;
 #endif
 } DecodeInfo;
 
@@ -101,6 +106,9 @@ make_DHelper(gp2_1_E);
 make_DHelper(gp2_cl2E);
 make_DHelper(gp2_Ib2E);
 
+make_DHelper(Ib_G2E);
+make_DHelper(cl_G2E);
+
 make_DHelper(O2a);
 make_DHelper(a2O);
 
@@ -8,6 +8,16 @@ typedef void (*EHelper) (vaddr_t *);
 
 #include "cpu/decode.h"
 
+typedef struct {
+  DHelper decode;
+  EHelper execute;
+  int width;
+} opcode_entry;
+
+/* one-byte opcodes, then two-byte opcodes (0x0f xx) at 0x100 */
+extern opcode_entry opcode_table[512];
+opcode_entry *get_opcode_entry(uint32_t opcode, int ext_opcode);
+
 static inline uint32_t instr_fetch(vaddr_t *eip, int len) {
   uint32_t instr = vaddr_read(*eip, len);
 #ifdef DEBUG
@@ -15,6 +25,7 @@ static inline uint32_t instr_fetch(vaddr_t *eip, int len) {
   int i;
   for (i = 0; i < len; i ++) {
     decoding.p += sprintf(decoding.p, "%02x ", p_instr[i]);
+    if (decoding.instr_len < sizeof(decoding.instr)) { decoding.instr[decoding.instr_len ++] = p_instr[i]; }
   }
 #endif
   (*eip) += len;
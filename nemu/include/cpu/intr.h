@@ -0,0 +1,11 @@
+#ifndef __INTR_H__
+#define __INTR_H__
+
+#include "common.h"
+
+#define IRQ_TIMER 32
+
+void raise_intr(uint8_t NO, vaddr_t ret_addr);
+void return_intr();
+
+#endif
@@ -2,6 +2,7 @@
 #define __REG_H__
 
 #include "common.h"
+#include "memory/mmu.h"
 
 enum { R_EAX, R_ECX, R_EDX, R_EBX, R_ESP, R_EBP, R_ESI, R_EDI };
 enum { R_AX, R_CX, R_DX, R_BX, R_SP, R_BP, R_SI, R_DI };
@@ -35,6 +36,32 @@ typedef struct {
 
   vaddr_t eip;
 
+  union {
+    struct {
+      uint32_t CF :1;
+      uint32_t    :5;
+      uint32_t ZF :1;
+      uint32_t SF :1;
+      uint32_t    :1;
+      uint32_t IF :1;
+      uint32_t DF :1;
+      uint32_t OF :1;
+      uint32_t    :20;
+    };
+    uint32_t val;
+  } eflags;
+  rtlreg_t cs;
+
+  struct {
+    uint16_t limit;
+    vaddr_t base;
+  } idtr;
+
+  CR0 cr0;
+  CR3 cr3;
+
+  bool INTR;
+
 } CPU_state;
 
 extern CPU_state cpu;
@@ -78,10 +78,20 @@ static inline void interpret_rtl_idiv64_r(rtlreg_t* dest,
 }
 
 static inline void interpret_rtl_lm(rtlreg_t *dest, const rtlreg_t* addr, int len) {
+#ifdef CACHE
+  extern bool is_detailed;
+  void cache_daccess(vaddr_t, int, bool);
+  if (is_detailed) { cache_daccess(*addr, len, false); }
+#endif
   *dest = vaddr_read(*addr, len);
 }
 
 static inline void interpret_rtl_sm(const rtlreg_t* addr, const rtlreg_t* src1, int len) {
+#ifdef CACHE
+  extern bool is_detailed;
+  void cache_daccess(vaddr_t, int, bool);
+  if (is_detailed) { cache_daccess(*addr, len, true); }
+#endif
   vaddr_write(*addr, *src1, len);
 }
 
@@ -161,13 +171,17 @@ static inline void rtl_sext(rtlreg_t* dest, const rtlreg_t* src1, int width) {
 static inline void rtl_push(const rtlreg_t* src1) {
   // esp <- esp - 4
   // M[esp] <- src1
-  TODO();
+  rtl_subi(&at, &cpu.esp, 4);
+  rtl_sm(&at, src1, 4);
+  rtl_mv(&cpu.esp, &at);
 }
 
 static inline void rtl_pop(rtlreg_t* dest) {
   // dest <- M[esp]
   // esp <- esp + 4
-  TODO();
+  rtl_lm(&at, &cpu.esp, 4);
+  cpu.esp += 4;
+  rtl_mv(dest, &at);
 }
 
 static inline void rtl_setrelopi(uint32_t relop, rtlreg_t *dest,
@@ -178,15 +192,16 @@ static inline void rtl_setrelopi(uint32_t relop, rtlreg_t *dest,
 
 static inline void rtl_msb(rtlreg_t* dest, const rtlreg_t* src1, int width) {
   // dest <- src1[width * 8 - 1]
-  TODO();
+  rtl_shri(dest, src1, width * 8 - 1);
+  rtl_andi(dest, dest, 0x1);
 }
 
 #define make_rtl_setget_eflags(f) \
   static inline void concat(rtl_set_, f) (const rtlreg_t* src) { \
-    TODO(); \
+    cpu.eflags.f = *src; \
   } \
   static inline void concat(rtl_get_, f) (rtlreg_t* dest) { \
-    TODO(); \
+    *dest = cpu.eflags.f; \
   }
 
 make_rtl_setget_eflags(CF)
@@ -196,12 +211,12 @@ make_rtl_setget_eflags(SF)
 
 static inline void rtl_update_ZF(const rtlreg_t* result, int width) {
   // eflags.ZF <- is_zero(result[width * 8 - 1 .. 0])
-  TODO();
+  cpu.eflags.ZF = ((*result & (~0u >> ((4 - width) << 3))) == 0);
 }
 
 static inline void rtl_update_SF(const rtlreg_t* result, int width) {
   // eflags.SF <- is_sign(result[width * 8 - 1 .. 0])
-  TODO();
+  cpu.eflags.SF = ((*result >> (width * 8 - 1)) & 0x1);
 }
 
 static inline void rtl_update_ZFSF(const rtlreg_t* result, int width) {
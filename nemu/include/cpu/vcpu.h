@@ -0,0 +1,21 @@
+#ifndef __VCPU_H__
+#define __VCPU_H__
+
+#include "common.h"
+#include "monitor/snapshot.h"
+
+#define MAX_CPU 8
+
+/* instructions a vCPU runs before the next one takes its turn */
+#define VCPU_QUANTUM 1000
+
+extern int nr_cpu, cur_cpu;
+extern uint64_t vcpu_countdown;
+
+void init_vcpu(char *spec);
+void vcpu_switch();
+void vcpu_start(int id, vaddr_t eip, vaddr_t esp);
+void vcpu_raise_intr();
+void vcpu_snapshot(Snapshot *s);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include "common.h"
+
+/* Record and replay of the non-deterministic inputs of devices. Every
+ * input is logged with the number of guest instructions executed when
+ * it is consumed. When replaying, the devices take their inputs from
+ * the log instead of the host, and SDL is not used at all.
+ */
+
+enum { REPLAY_OFF, REPLAY_RECORD, REPLAY_PLAY };
+extern int replay_state;
+
+void init_replay(char *record_file, char *replay_file);
+uint32_t replay_rtc(uint32_t value);
+void replay_key(uint32_t am_scancode);
+void replay_intr(void);
+void replay_update(void);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "common.h"
+
+enum { CACHE_LRU, CACHE_PLRU, CACHE_RANDOM };
+
+/* extra cycles of an access which misses in L1 or L2 */
+#define CACHE_L2_LATENCY 10
+#define CACHE_MEM_LATENCY 100
+
+void init_cache();
+void cache_config(char *spec);
+void cache_ifetch(vaddr_t eip, vaddr_t seq_eip);
+void cache_daccess(vaddr_t addr, int len, bool is_write);
+void cache_report();
+
+#endif
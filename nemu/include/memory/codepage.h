@@ -0,0 +1,32 @@
+#ifndef __CODEPAGE_H__
+#define __CODEPAGE_H__
+
+#include "common.h"
+#include "memory/mmu.h"
+
+/* The code-page tracker, for everything in NEMU which caches the contents
+ * of guest pages, such as decoded code. See src/memory/codepage.c. */
+
+#define NR_CODEPAGE_CALLBACK 8
+
+extern uint8_t *code_page;
+extern uint32_t nr_code_page;
+
+void init_codepage(uint32_t size);
+void codepage_mark(paddr_t addr);
+uint32_t codepage_gen(paddr_t addr);
+void codepage_add_callback(void (*callback)(paddr_t page));
+void codepage_invalidate(paddr_t page);
+void codepage_invalidate_all();
+
+/* called before `len' bytes at `addr' are written; only the pages with
+ * cached contents take the slow path */
+static inline void codepage_write(paddr_t addr, uint32_t len) {
+  uint32_t page = addr / PAGE_SIZE, last = (addr + len - 1) / PAGE_SIZE;
+  if (len == 0 || last >= nr_code_page || last < page) return;
+  for (; page <= last; page ++) {
+    if (code_page[page]) { codepage_invalidate(page * PAGE_SIZE); }
+  }
+}
+
+#endif
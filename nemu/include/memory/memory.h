@@ -3,7 +3,13 @@
 
 #include "common.h"
 
-extern uint8_t pmem[];
+/* The default size of the physical memory. It can be changed by `--pmem',
+ * up to PMEM_MAX_SIZE, which is below the MMIO space. */
+#define PMEM_DEFAULT_SIZE (128 * 1024 * 1024)
+#define PMEM_MAX_SIZE (2048u * 1024 * 1024)
+
+extern uint8_t *pmem;
+extern uint32_t pmem_size;
 
 /* convert the guest physical address in the guest program to host virtual address in NEMU */
 #define guest_to_host(p) ((void *)(pmem + (unsigned)p))
@@ -14,5 +20,21 @@ uint32_t vaddr_read(vaddr_t, int);
 uint32_t paddr_read(paddr_t, int);
 void vaddr_write(vaddr_t, uint32_t, int);
 void paddr_write(paddr_t, uint32_t, int);
+void* vaddr_host_range(vaddr_t, uint32_t, bool);
+void init_pmem(uint32_t);
+void pmem_zero(paddr_t, uint32_t);
+uint8_t *dma_write_begin(paddr_t, uint32_t);
+void dma_write_end(paddr_t, uint32_t);
+void dma_write(paddr_t, const void *, uint32_t);
+
+/* Whether the memory can be accessed through vaddr_host_range() in bulk.
+ * Otherwise the cache model has to see every access. */
+static inline bool mem_can_bulk() {
+#ifdef CACHE
+  extern bool is_detailed;
+  if (is_detailed) { return false; }
+#endif
+  return true;
+}
 
 #endif
@@ -1,9 +1,15 @@
 #ifndef __MONITOR_H__
 #define __MONITOR_H__
 
+#include "common.h"
+
 enum { NEMU_STOP, NEMU_RUNNING, NEMU_END, NEMU_ABORT };
 extern int nemu_state;
 
+/* Set while DiffTest executes instructions again to find the first one
+ * which goes wrong. They are not traced, profiled or interrupted again. */
+extern bool is_reexec;
+
 #define ENTRY_START 0x100000
 
 #endif
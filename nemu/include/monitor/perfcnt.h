@@ -0,0 +1,33 @@
+#ifndef __PERFCNT_H__
+#define __PERFCNT_H__
+
+#include "common.h"
+
+/* Performance counters visible to the guest through the perfcnt device.
+ * The indices are the same as _DEVREG_PERFCNT_* in nexus-am/am/amdev.h.
+ * Counters of the models which are not enabled stay zero.
+ */
+enum {
+  PERFCNT_INSTR = 1,    // retired instructions
+  PERFCNT_CYCLE,        // virtual cycles
+  PERFCNT_TLB_ACCESS,
+  PERFCNT_TLB_MISS,
+  PERFCNT_ICACHE_ACCESS,
+  PERFCNT_ICACHE_MISS,
+  PERFCNT_DCACHE_ACCESS,
+  PERFCNT_DCACHE_MISS,
+  PERFCNT_L2_ACCESS,
+  PERFCNT_L2_MISS,
+  PERFCNT_BRANCH,
+  PERFCNT_BRANCH_MISS,
+  NR_PERFCNT
+};
+
+/* Every instruction takes one cycle, and the timing models add their
+ * penalties to perfcnt[PERFCNT_CYCLE]. perfcnt[PERFCNT_INSTR] is not used,
+ * use perfcnt_read() to read the counters. */
+extern uint64_t perfcnt[NR_PERFCNT];
+
+uint64_t perfcnt_read(int idx);
+
+#endif
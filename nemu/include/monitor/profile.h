@@ -0,0 +1,43 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "common.h"
+
+/* number of entries shown in each table of the profile report */
+#define PROFILE_TOP_N 20
+
+void init_profile(char *out_file);
+void profile_step(vaddr_t eip, vaddr_t seq_eip, vaddr_t next_eip);
+void profile_report();
+
+void init_ftrace(char *out_file);
+void ftrace_step(vaddr_t eip, vaddr_t seq_eip, vaddr_t next_eip);
+void ftrace_report();
+void ftrace_dump(int n);
+
+/* default number of guest instructions between two samples */
+#define SAMPLE_PERIOD 10000
+
+extern uint64_t sample_countdown;
+void init_sample(char *out_file, uint64_t period);
+void sample_take();
+void sample_report();
+
+/* Sampled simulation: the models and the profiler only run when
+ * `is_detailed' is set. */
+extern bool is_detailed;
+extern uint64_t ff_countdown;
+void init_fastfwd(char *spec);
+void fastfwd_switch();
+void fastfwd_report();
+
+/* default interval of basic block vectors and number of simpoints */
+#define BBV_INTERVAL 10000000
+#define BBV_MAX_K 10
+
+extern bool is_bbv;
+void init_bbv(char *spec);
+void bbv_step(vaddr_t eip, vaddr_t seq_eip, vaddr_t next_eip);
+void bbv_report();
+
+#endif
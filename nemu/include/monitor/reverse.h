@@ -0,0 +1,19 @@
+#ifndef __REVERSE_H__
+#define __REVERSE_H__
+
+#include "common.h"
+
+/* default interval and memory budget of the checkpoints */
+#define CHECKPOINT_INTERVAL 100000
+#define CHECKPOINT_BUDGET_MB 256
+
+extern uint64_t checkpoint_countdown;
+
+void init_reverse(char *spec);
+void checkpoint_take();
+void checkpoint_mem_write(paddr_t addr, int len);
+void reverse_step(uint64_t n);
+void reverse_continue();
+void reverse_reset();
+
+#endif
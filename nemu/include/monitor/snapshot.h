@@ -0,0 +1,38 @@
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include "common.h"
+
+/* A snapshot file is a sequence of sections, each starting with a tag.
+ * Devices read or write their state with snapshot_rw() and
+ * snapshot_rw_mem(), which do the same thing in both directions, so a
+ * device only needs one function to be saved and loaded.
+ */
+
+typedef struct {
+  FILE *fp;
+  bool is_save;
+  bool ok;
+} Snapshot;
+
+void snapshot_rw(Snapshot *s, void *buf, size_t len);
+void snapshot_rw_mem(Snapshot *s, void *buf, size_t len);
+
+void init_snapshot(char *load_file, char *save_spec, bool fork_server);
+bool snapshot_save(const char *file);
+bool snapshot_load(const char *file);
+int snapshot_fork(void);
+bool snapshot_is_child(void);
+void snapshot_child_exit(int status);
+void snapshot_batch_start(void);
+void snapshot_batch_end(void);
+bool snapshot_is_fork_server(void);
+
+/* state of devices */
+void pio_snapshot(Snapshot *s);
+void pio_snapshot_maps(Snapshot *s);
+void mmio_snapshot(Snapshot *s);
+void i8042_snapshot(Snapshot *s);
+void replay_snapshot(Snapshot *s);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include "common.h"
+
+#define SYM_STR_SIZE 64
+
+void load_symbols(char *arg);
+void load_image_symbols(const void *buf, size_t size, const char *file);
+const char* symbol_find(vaddr_t addr, vaddr_t *start);
+bool symbol_addr(const char *name, vaddr_t *addr);
+char* symbol_str(vaddr_t addr, char *buf);
+const char* symbol_name(vaddr_t addr, char *buf);
+
+#endif
@@ -21,5 +21,7 @@ void free_wp(int);
 void setup_wp(WP* wp, char* str);
 bool check_wp();
 void get_wp_info();
+int wp_values(uint32_t *vals);
+void wp_refresh();
 
 #endif
@@ -0,0 +1,85 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include "common.h"
+
+/* 64-bit hash of a memory block, following the algorithm of xxHash64.
+ * Blocks are read 8 bytes at a time with 4 independent lanes, so hashing
+ * a page is bounded by the memory bandwidth rather than the multiplier.
+ */
+
+#define XXH_PRIME64_1 0x9e3779b185ebca87ull
+#define XXH_PRIME64_2 0xc2b2ae3d27d4eb4full
+#define XXH_PRIME64_3 0x165667b19e3779f9ull
+#define XXH_PRIME64_4 0x85ebca77c2b2ae63ull
+#define XXH_PRIME64_5 0x27d4eb2f165667c5ull
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t in) {
+  return xxh_rotl(acc + in * XXH_PRIME64_2, 31) * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+  return (acc ^ xxh_round(0, val)) * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static inline uint64_t hash64(const void *buf, size_t len, uint64_t seed) {
+  const uint8_t *p = buf, *end = p + len;
+  uint64_t h, x;
+  uint32_t y;
+
+  if (len >= 32) {
+    uint64_t v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    uint64_t v2 = seed + XXH_PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - XXH_PRIME64_1;
+    for (; p + 32 <= end; p += 32) {
+      memcpy(&x, p +  0, 8); v1 = xxh_round(v1, x);
+      memcpy(&x, p +  8, 8); v2 = xxh_round(v2, x);
+      memcpy(&x, p + 16, 8); v3 = xxh_round(v3, x);
+      memcpy(&x, p + 24, 8); v4 = xxh_round(v4, x);
+    }
+    h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+    h = xxh_merge(h, v1);
+    h = xxh_merge(h, v2);
+    h = xxh_merge(h, v3);
+    h = xxh_merge(h, v4);
+  }
+  else {
+    h = seed + XXH_PRIME64_5;
+  }
+
+  h += len;
+  for (; p + 8 <= end; p += 8) {
+    memcpy(&x, p, 8);
+    h = xxh_rotl(h ^ xxh_round(0, x), 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+  }
+  if (p + 4 <= end) {
+    memcpy(&y, p, 4);
+    h = xxh_rotl(h ^ (y * XXH_PRIME64_1), 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+    p += 4;
+  }
+  for (; p < end; p ++) {
+    h = xxh_rotl(h ^ (*p * XXH_PRIME64_5), 11) * XXH_PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+/* hash of the pages at `pages' in the guest memory, mixing their addresses */
+static inline uint64_t hash_pages(uint8_t *base, const uint32_t *pages, int nr, int page_size) {
+  uint64_t h = 0;
+  int i;
+  for (i = 0; i < nr; i ++) {
+    h = hash64(base + pages[i], page_size, h ^ pages[i]);
+  }
+  return h;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef __HTABLE_H__
+#define __HTABLE_H__
+
+#include "common.h"
+
+/* A hash table mapping 64-bit keys to 32-bit values. It is used to
+ * index the records kept by the profilers, which usually live in an
+ * array owned by the user of the table.
+ */
+
+#define HTABLE_EMPTY 0xffffffffu
+
+typedef struct {
+  uint64_t *key;
+  uint32_t *val;
+  uint32_t size;
+  uint32_t used;
+} HTable;
+
+void htable_init(HTable *t, uint32_t size);
+void htable_free(HTable *t);
+uint32_t htable_find(HTable *t, uint64_t key);
+uint32_t* htable_get(HTable *t, uint64_t key);
+
+#endif
@@ -0,0 +1,212 @@
+#!/bin/bash
+
+# Run the regression tests as independent NEMU processes on all host cores,
+# and write the results with timing to a JSON file. With a baseline written
+# by an earlier run, tests which fail now, or run slower than the baseline by
+# more than the threshold, are reported as regressions.
+#
+# Usage: ./regress.sh [-j JOBS] [-t TIMEOUT] [-o RESULT] [-b BASELINE] [-T PERCENT] [TEST...]
+#
+# TESTs are names such as `cputest-fib' or `microbench-ref', or a prefix of
+# them such as `cputest'. All tests are run by default.
+
+jobs=`nproc`
+timeout=60
+result=build/regress.json
+baseline=
+threshold=10
+
+while getopts "j:t:o:b:T:h" opt; do
+  case $opt in
+    j) jobs=$OPTARG ;;
+    t) timeout=$OPTARG ;;
+    o) result=$OPTARG ;;
+    b) baseline=$OPTARG ;;
+    T) threshold=$OPTARG ;;
+    *)
+      echo "Usage: $0 [-j JOBS] [-t TIMEOUT] [-o RESULT] [-b BASELINE] [-T PERCENT] [TEST...]"
+      echo "  -j JOBS      number of NEMU processes at the same time (default: number of cores)"
+      echo "  -t TIMEOUT   seconds before a test is killed (default 60)"
+      echo "  -o RESULT    JSON file to write the results to (default build/regress.json)"
+      echo "  -b BASELINE  JSON file written by an earlier run to compare with"
+      echo "  -T PERCENT   report tests slower than the baseline by more than PERCENT (default 10)"
+      exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+filter="$@"
+
+nemu=build/nemu
+work=build/regress
+bin_dir=$work/bin
+out_dir=$work/out
+
+# Tests which never end by themselves. They pass if they are still running
+# without errors when they are killed after SMOKE_TIMEOUT seconds.
+smoke_tests="ctetest timetest keytest videotest guitest floattest vmtest"
+SMOKE_TIMEOUT=5
+
+# Other tests in nexus-am/tests which run on x86-nemu.
+single_tests="ioetest segmenttest smctest"
+# Tests with one binary for each file in tests/.
+multi_tests="cputest cachetest"
+
+echo "compiling NEMU..."
+if make -s &> /dev/null; then
+  echo "NEMU compile OK"
+else
+  echo "NEMU compile error... exit..."
+  exit 1
+fi
+
+rm -rf $work
+mkdir -p $bin_dir $out_dir
+
+selected() {
+  local f
+  [ -z "$filter" ] && return 0
+  for f in $filter; do
+    case $1 in $f*) return 0 ;; esac
+  done
+  return 1
+}
+
+# whether some test of the suite is selected
+suite_selected() {
+  local f
+  selected $1 && return 0
+  for f in $filter; do
+    case $f in $1-*) return 0 ;; esac
+  done
+  return 1
+}
+
+# build_app NAME DIR [MAKE_ARGS...]
+# The image script writes BINARY, BINARY.txt and BINARY.bin, so they are
+# built out of bin_dir, and only the .bin is copied into it.
+build_app() {
+  local name=$1 dir=$2 obj=`pwd`/$work/obj/$name
+  shift 2
+  selected $name || return
+  if make -s -C $dir ARCH=x86-nemu DST_DIR=$obj/ BINARY=$obj/$name "$@" &> $out_dir/$name.build &&
+      [ -e $obj/$name.bin ]; then
+    cp $obj/$name.bin $bin_dir/$name.bin
+  else
+    echo "$name" >> $work/build-failed
+  fi
+}
+
+echo "compiling testcases..."
+for t in $multi_tests; do
+  suite_selected $t || continue
+  make -C $AM_HOME/tests/$t ARCH=x86-nemu &> $out_dir/$t.build
+  for f in $AM_HOME/tests/$t/tests/*.c; do
+    [ -e $f ] || continue
+    name=$t-`basename $f .c`
+    selected $name || continue
+    bin=$AM_HOME/tests/$t/build/`basename $f .c`-x86-nemu.bin
+    if [ -e $bin ]; then cp $bin $bin_dir/$name.bin; else echo "$name" >> $work/build-failed; fi
+  done
+done
+for t in $single_tests $smoke_tests; do
+  build_app $t $AM_HOME/tests/$t
+done
+build_app microbench-test $AM_HOME/apps/microbench INPUT=TEST
+build_app microbench-ref $AM_HOME/apps/microbench INPUT=REF
+build_app coremark $AM_HOME/apps/coremark
+build_app dhrystone $AM_HOME/apps/dhrystone
+if [ -e $work/build-failed ]; then
+  echo "testcases compile error: `cat $work/build-failed | tr '\n' ' '`"
+fi
+
+# run_one NAME: run build/regress/bin/NAME.bin, and write a JSON object
+# of the result to build/regress/out/NAME.json
+run_one() {
+  local name=$1 limit=$timeout status
+  [[ " $smoke_tests " == *" $name "* ]] && limit=$SMOKE_TIMEOUT
+
+  local start=`date +%s%N`
+  timeout $limit $nemu -b $bin_dir/$name.bin &> $out_dir/$name.log
+  local ret=$?
+  local end=`date +%s%N`
+
+  if grep -q 'nemu: HIT GOOD TRAP' $out_dir/$name.log; then status=pass
+  elif grep -q 'nemu: HIT BAD TRAP' $out_dir/$name.log; then status=bad-trap
+  elif grep -q 'nemu: ABORT' $out_dir/$name.log; then status=abort
+  elif [ $ret -eq 124 ]; then
+    if [[ " $smoke_tests " == *" $name "* ]]; then status=pass; else status=timeout; fi
+  else status=crash
+  fi
+
+  local instr=`grep -o 'total guest instructions = [0-9]*' $out_dir/$name.log | grep -o '[0-9]*$'`
+  local time=`echo "$start $end" | awk '{ printf "%.3f", ($2 - $1) / 1e9 }'`
+  local mips=`echo "${instr:-0} $start $end" | awk '{ printf "%.2f", $1 * 1e3 / ($3 - $2) }'`
+  echo "{ \"name\": \"$name\", \"status\": \"$status\", \"instr\": ${instr:-0}, \"time\": $time, \"mips\": $mips }" \
+    > $out_dir/$name.json
+
+  if [ $status == pass ]; then
+    printf "[%16s] \033[1;32mPASS!\033[0m %8s s %10s MIPS\n" $name $time $mips
+  else
+    printf "[%16s] \033[1;31mFAIL!\033[0m (%s) see %s for more information\n" $name $status $out_dir/$name.log
+  fi
+}
+export -f run_one
+export nemu timeout bin_dir out_dir smoke_tests SMOKE_TIMEOUT
+
+echo "running testcases with $jobs jobs..."
+for f in $bin_dir/*.bin; do
+  [ -e $f ] && basename -s .bin $f
+done | xargs -P $jobs -I{} bash -c 'run_one {}'
+
+# the results are sorted by name, one test per line, so they can be
+# compared with grep and awk
+{
+  echo "{"
+  echo "  \"date\": \"`date -Iseconds`\","
+  echo "  \"commit\": \"`git rev-parse --short HEAD 2> /dev/null`\","
+  echo "  \"jobs\": $jobs,"
+  echo "  \"tests\": ["
+  for f in `ls $out_dir/*.json | sort`; do
+    cat $f
+  done | sed -e '$!s/$/,/' -e 's/^/    /'
+  echo "  ]"
+  echo "}"
+} > $result
+echo "results are written to $result"
+
+field() {
+  sed -n "s/.*\"$1\": \"\{0,1\}\([^\", }]*\).*/\1/p"
+}
+
+nr_fail=`grep -c '"status": "[^p]' $result`
+nr_regress=0
+if [ -n "$baseline" ]; then
+  echo "comparing with $baseline (threshold $threshold%)..."
+  while read -r line; do
+    name=`echo "$line" | field name`
+    old=`grep "\"name\": \"$name\"" $baseline`
+    [ -z "$old" ] && continue
+    status=`echo "$line" | field status`
+    mips=`echo "$line" | field mips`
+    instr=`echo "$line" | field instr`
+    old_status=`echo "$old" | field status`
+    old_mips=`echo "$old" | field mips`
+    old_instr=`echo "$old" | field instr`
+
+    if [ $old_status == pass ] && [ $status != pass ]; then
+      printf "[%16s] \033[1;31mREGRESSION!\033[0m it passed in the baseline\n" $name
+      nr_regress=$((nr_regress + 1))
+    elif [ $status == pass ] && [[ " $smoke_tests " != *" $name "* ]]; then
+      if awk "BEGIN { exit !($mips < $old_mips * (1 - $threshold / 100)) }"; then
+        printf "[%16s] \033[1;31mSLOWER!\033[0m %s MIPS, was %s MIPS\n" $name $mips $old_mips
+        nr_regress=$((nr_regress + 1))
+      fi
+      if [ "$instr" != "$old_instr" ]; then
+        printf "[%16s] %s instructions, was %s\n" $name $instr $old_instr
+      fi
+    fi
+  done < <(grep '"name"' $result)
+fi
+
+echo "$nr_fail failed, $nr_regress regressions"
+[ $nr_fail -eq 0 ] && [ $nr_regress -eq 0 ]
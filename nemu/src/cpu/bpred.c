@@ -0,0 +1,311 @@
+#include "nemu.h"
+#include "cpu/bpred.h"
+#include "monitor/perfcnt.h"
+#include "monitor/profile.h"
+#include "monitor/symbol.h"
+#include "util/htable.h"
+
+#ifdef BPRED
+
+#include <stdlib.h>
+
+/* Branch prediction model. The direction of conditional branches is
+ * predicted by a bimodal, gshare or TAGE-lite predictor. The targets of
+ * indirect jumps and calls are predicted by a BTB, and the targets of
+ * `ret' by a return address stack. Direct jumps and calls are assumed to
+ * be resolved at decode without penalty. Every misprediction adds
+ * BPRED_MISS_PENALTY cycles to the virtual cycle count.
+ */
+
+enum { BR_COND, BR_INDIRECT, BR_RET, NR_BR_TYPE };
+static const char *br_type_name[] = { "cond", "indirect", "ret" };
+
+static int predictor = BPRED_GSHARE;
+static const char *predictor_name[] = { "bimodal", "gshare", "tage" };
+
+static uint64_t ghr = 0;   // global history of conditional branches
+
+/* 2-bit saturating counters for bimodal and gshare, also the base
+ * predictor of TAGE */
+#define PHT_BITS 12
+#define PHT_SIZE (1 << PHT_BITS)
+#define GSHARE_HIST_BITS 12
+static uint8_t pht[PHT_SIZE];
+
+static inline void ctr_update(uint8_t *ctr, bool taken, int max) {
+  if (taken) { if (*ctr < max) (*ctr) ++; }
+  else { if (*ctr > 0) (*ctr) --; }
+}
+
+/* ------------------------------ TAGE-lite ----------------------------- */
+
+#define TAGE_NR_TABLE 4
+#define TAGE_IDX_BITS 10
+#define TAGE_TAG_BITS 9
+#define TAGE_U_RESET_PERIOD (256 * 1024)
+
+static const int tage_hist_len[TAGE_NR_TABLE] = { 4, 12, 28, 64 };
+
+typedef struct {
+  uint16_t tag;
+  uint8_t ctr;   // 3-bit counter, taken if >= 4
+  uint8_t u;     // 2-bit usefulness
+} TageEntry;
+
+static TageEntry tage[TAGE_NR_TABLE][1 << TAGE_IDX_BITS];
+static uint32_t tage_idx[TAGE_NR_TABLE], tage_tag[TAGE_NR_TABLE];
+static uint64_t tage_nr_branch = 0;
+
+/* fold the youngest `len' bits of history into `bits' bits */
+static inline uint32_t fold(uint64_t hist, int len, int bits) {
+  if (len < 64) hist &= (1ull << len) - 1;
+  uint32_t r = 0;
+  while (hist != 0) {
+    r ^= hist & ((1u << bits) - 1);
+    hist >>= bits;
+  }
+  return r;
+}
+
+static bool tage_predict(vaddr_t pc, int *provider, bool *alt_pred) {
+  bool base = pht[(pc >> 2) & (PHT_SIZE - 1)] >= 2;
+  *provider = -1;
+  *alt_pred = base;
+  bool pred = base;
+
+  int i;
+  for (i = 0; i < TAGE_NR_TABLE; i ++) {
+    tage_idx[i] = (pc ^ (pc >> TAGE_IDX_BITS) ^ fold(ghr, tage_hist_len[i], TAGE_IDX_BITS))
+      & ((1 << TAGE_IDX_BITS) - 1);
+    tage_tag[i] = (pc ^ fold(ghr, tage_hist_len[i], TAGE_TAG_BITS) ^
+        (fold(ghr, tage_hist_len[i], TAGE_TAG_BITS - 1) << 1)) & ((1 << TAGE_TAG_BITS) - 1);
+    if (tage[i][tage_idx[i]].tag == tage_tag[i]) {
+      *alt_pred = pred;
+      pred = tage[i][tage_idx[i]].ctr >= 4;
+      *provider = i;
+    }
+  }
+  return pred;
+}
+
+static void tage_update(vaddr_t pc, bool taken, bool pred, int provider, bool alt_pred) {
+  if (provider >= 0) {
+    TageEntry *e = &tage[provider][tage_idx[provider]];
+    ctr_update(&e->ctr, taken, 7);
+    if (pred != alt_pred) { ctr_update(&e->u, pred == taken, 3); }
+  }
+  else {
+    ctr_update(&pht[(pc >> 2) & (PHT_SIZE - 1)], taken, 3);
+  }
+
+  /* allocate an entry in a table with longer history on misprediction */
+  if (pred != taken && provider < TAGE_NR_TABLE - 1) {
+    int i;
+    bool allocated = false;
+    for (i = provider + 1; i < TAGE_NR_TABLE; i ++) {
+      TageEntry *e = &tage[i][tage_idx[i]];
+      if (e->u == 0) {
+        *e = (TageEntry) { .tag = tage_tag[i], .ctr = (taken ? 4 : 3), .u = 0 };
+        allocated = true;
+        break;
+      }
+    }
+    if (!allocated) {
+      for (i = provider + 1; i < TAGE_NR_TABLE; i ++) {
+        if (tage[i][tage_idx[i]].u > 0) tage[i][tage_idx[i]].u --;
+      }
+    }
+  }
+
+  if (++ tage_nr_branch % TAGE_U_RESET_PERIOD == 0) {
+    int i, j;
+    for (i = 0; i < TAGE_NR_TABLE; i ++) {
+      for (j = 0; j < (1 << TAGE_IDX_BITS); j ++) { tage[i][j].u >>= 1; }
+    }
+  }
+}
+
+/* -------------------------------- BTB/RAS ------------------------------- */
+
+#define BTB_BITS 9
+#define BTB_SIZE (1 << BTB_BITS)
+#define RAS_SIZE 16
+
+static struct {
+  vaddr_t pc, target;
+} btb[BTB_SIZE];
+
+static vaddr_t ras[RAS_SIZE];
+static int ras_top = 0;   // number of pushes minus pops
+static int ras_nr = 0;    // number of valid entries
+
+/* predict the target with the BTB and update it, return true if correct */
+static inline bool btb_predict(vaddr_t pc, vaddr_t target) {
+  int idx = (pc >> 2) & (BTB_SIZE - 1);
+  bool hit = (btb[idx].pc == pc && btb[idx].target == target);
+  btb[idx].pc = pc;
+  btb[idx].target = target;
+  return hit;
+}
+
+static inline void ras_push(vaddr_t ret_addr) {
+  ras[ras_top % RAS_SIZE] = ret_addr;
+  ras_top ++;
+  if (ras_nr < RAS_SIZE) ras_nr ++;
+}
+
+static inline bool ras_pop(vaddr_t target) {
+  if (ras_nr == 0) return false;
+  ras_nr --;
+  ras_top --;
+  return ras[ras_top % RAS_SIZE] == target;
+}
+
+/* ------------------------------ statistics ------------------------------ */
+
+typedef struct {
+  vaddr_t pc;
+  int type;
+  uint64_t cnt, miss;
+} Site;
+
+static Site *sites = NULL;
+static uint32_t nr_site = 0, max_site = 0;
+static HTable site_index;
+static uint64_t type_cnt[NR_BR_TYPE], type_miss[NR_BR_TYPE];
+
+static void record(vaddr_t pc, int type, bool correct) {
+  uint32_t *idx = htable_get(&site_index, pc);
+  if (*idx == HTABLE_EMPTY) {
+    if (nr_site == max_site) {
+      max_site = (max_site == 0 ? 1024 : max_site * 2);
+      sites = realloc(sites, sizeof(Site) * max_site);
+      assert(sites != NULL);
+    }
+    sites[nr_site] = (Site) { .pc = pc, .type = type };
+    *idx = nr_site ++;
+  }
+  Site *s = &sites[*idx];
+  s->cnt ++;
+  type_cnt[type] ++;
+  perfcnt[PERFCNT_BRANCH] ++;
+  if (!correct) {
+    s->miss ++;
+    type_miss[type] ++;
+    perfcnt[PERFCNT_BRANCH_MISS] ++;
+    perfcnt[PERFCNT_CYCLE] += BPRED_MISS_PENALTY;
+  }
+}
+
+void init_bpred(char *name) {
+  if (name != NULL) {
+    int i;
+    for (i = 0; i < sizeof(predictor_name) / sizeof(predictor_name[0]); i ++) {
+      if (strcmp(name, predictor_name[i]) == 0) break;
+    }
+    Assert(i < sizeof(predictor_name) / sizeof(predictor_name[0]),
+        "unknown branch predictor '%s', use bimodal, gshare or tage", name);
+    predictor = i;
+  }
+
+  /* weakly taken */
+  memset(pht, 2, sizeof(pht));
+  htable_init(&site_index, 1024);
+
+  Log("Branch predictor: \33[1;32m%s\33[0m", predictor_name[predictor]);
+}
+
+void bpred_cond(vaddr_t pc, bool taken) {
+  bool pred;
+  switch (predictor) {
+    case BPRED_BIMODAL: {
+      uint8_t *ctr = &pht[(pc >> 2) & (PHT_SIZE - 1)];
+      pred = *ctr >= 2;
+      ctr_update(ctr, taken, 3);
+      break;
+    }
+    case BPRED_GSHARE: {
+      uint32_t hist = ghr & ((1u << GSHARE_HIST_BITS) - 1);
+      uint8_t *ctr = &pht[((pc >> 2) ^ hist) & (PHT_SIZE - 1)];
+      pred = *ctr >= 2;
+      ctr_update(ctr, taken, 3);
+      break;
+    }
+    default: {
+      int provider;
+      bool alt_pred;
+      pred = tage_predict(pc, &provider, &alt_pred);
+      tage_update(pc, taken, pred, provider, alt_pred);
+      break;
+    }
+  }
+  ghr = (ghr << 1) | taken;
+  record(pc, BR_COND, pred == taken);
+}
+
+void bpred_indirect(vaddr_t pc, vaddr_t target) {
+  record(pc, BR_INDIRECT, btb_predict(pc, target));
+}
+
+void bpred_call(vaddr_t pc, vaddr_t target, vaddr_t ret_addr, bool is_indirect) {
+  if (is_indirect) { bpred_indirect(pc, target); }
+  ras_push(ret_addr);
+}
+
+void bpred_ret(vaddr_t pc, vaddr_t target) {
+  record(pc, BR_RET, ras_pop(target));
+}
+
+/* ------------------------------- report ------------------------------- */
+
+static int cmp_site(const void *a, const void *b) {
+  const Site *x = a, *y = b;
+  if (x->miss != y->miss) { return (x->miss < y->miss ? 1 : -1); }
+  return (x->pc < y->pc ? -1 : x->pc > y->pc);
+}
+
+static inline double rate(uint64_t miss, uint64_t cnt) {
+  return (cnt == 0 ? 0 : 100.0 * miss / cnt);
+}
+
+void bpred_report() {
+  printflog("==================== branch ====================\n");
+  printflog("Predictor: %s\n", predictor_name[predictor]);
+  printflog("  %-9s %14s %14s %7s\n", "type", "branches", "mispredicts", "rate");
+  int i;
+  for (i = 0; i < NR_BR_TYPE; i ++) {
+    printflog("  %-9s %14lu %14lu %6.2f%%\n", br_type_name[i], type_cnt[i], type_miss[i],
+        rate(type_miss[i], type_cnt[i]));
+  }
+
+  qsort(sites, nr_site, sizeof(Site), cmp_site);
+  char buf[SYM_STR_SIZE];
+  printflog("Top %d branch sites by mispredicts (%d distinct):\n", PROFILE_TOP_N, nr_site);
+  printflog("  %-10s %-9s %14s %14s %7s  %s\n", "pc", "type", "branches", "mispredicts",
+      "rate", "symbol");
+  for (i = 0; i < nr_site && i < PROFILE_TOP_N; i ++) {
+    Site *s = &sites[i];
+    printflog("  0x%08x %-9s %14lu %14lu %6.2f%%  %s\n", s->pc, br_type_name[s->type],
+        s->cnt, s->miss, rate(s->miss, s->cnt), symbol_str(s->pc, buf));
+  }
+
+  uint64_t instr = perfcnt_read(PERFCNT_INSTR);
+  if (instr > 0) {
+    printflog("Estimated CPI = %.3f (1 cycle per instruction, %d cycles per mispredict",
+        (double)perfcnt_read(PERFCNT_CYCLE) / instr, BPRED_MISS_PENALTY);
+#ifdef CACHE
+    printflog(", plus cache penalties");
+#endif
+    printflog(")\n");
+  }
+}
+
+#else
+
+void init_bpred(char *predictor) {
+  if (predictor != NULL) {
+    Log("Branch predictor is not enabled, define BPRED in include/common.h to enable it");
+  }
+}
+
+#endif
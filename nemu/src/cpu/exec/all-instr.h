@@ -1,8 +1,24 @@
 #include "cpu/exec.h"
 
 make_EHelper(mov);
+make_EHelper(xchg);
 
 make_EHelper(operand_size);
+make_EHelper(lock);
+make_EHelper(rep);
+make_EHelper(repne);
+
+make_EHelper(movs);
+make_EHelper(stos);
+make_EHelper(lods);
+make_EHelper(cmps);
+make_EHelper(scas);
+make_EHelper(cld);
+make_EHelper(std);
 
 make_EHelper(inv);
 make_EHelper(nemu_trap);
+make_EHelper(hlt);
+make_EHelper(lidt);
+make_EHelper(int);
+make_EHelper(iret);
@@ -1,5 +1,6 @@
 #include "cpu/exec.h"
 #include "cpu/cc.h"
+#include "monitor/profile.h"
 
 make_EHelper(jmp) {
   // the target address is calculated at the decode stage
@@ -13,18 +14,31 @@ make_EHelper(jcc) {
   uint32_t cc = decoding.opcode & 0xf;
   rtl_setcc(&t0, cc);
   rtl_li(&t1, 0);
+#ifdef BPRED
+  void bpred_cond(vaddr_t, bool);
+  if (is_detailed) { bpred_cond(cpu.eip, t0 != 0); }
+#endif
   rtl_jrelop(RELOP_NE, &t0, &t1, decoding.jmp_eip);
 
   print_asm("j%s %x", get_cc_name(cc), decoding.jmp_eip);
 }
 
 make_EHelper(jmp_rm) {
+#ifdef BPRED
+  void bpred_indirect(vaddr_t, vaddr_t);
+  if (is_detailed) { bpred_indirect(cpu.eip, id_dest->val); }
+#endif
   rtl_jr(&id_dest->val);
 
   print_asm("jmp *%s", id_dest->str);
 }
 
 make_EHelper(call) {
+#ifdef BPRED
+  void bpred_call(vaddr_t, vaddr_t, vaddr_t, bool);
+  if (is_detailed) { bpred_call(cpu.eip, decoding.jmp_eip, decoding.seq_eip, false); }
+#endif
+
   // the target address is calculated at the decode stage
   TODO();
 
@@ -32,12 +46,22 @@ make_EHelper(call) {
 }
 
 make_EHelper(ret) {
+#ifdef BPRED
+  void bpred_ret(vaddr_t, vaddr_t);
+  if (is_detailed) { bpred_ret(cpu.eip, vaddr_read(cpu.esp, 4)); }
+#endif
+
   TODO();
 
   print_asm("ret");
 }
 
 make_EHelper(call_rm) {
+#ifdef BPRED
+  void bpred_call(vaddr_t, vaddr_t, vaddr_t, bool);
+  if (is_detailed) { bpred_call(cpu.eip, id_dest->val, decoding.seq_eip, true); }
+#endif
+
   TODO();
 
   print_asm("call *%s", id_dest->str);
@@ -1,11 +1,7 @@
 #include "cpu/exec.h"
 #include "all-instr.h"
-
-typedef struct {
-  DHelper decode;
-  EHelper execute;
-  int width;
-} opcode_entry;
+#include "monitor/profile.h"
+#include "cpu/intr.h"
 
 #define IDEXW(id, ex, w)   {concat(decode_, id), concat(exec_, ex), w}
 #define IDEX(id, ex)       IDEXW(id, ex, 0)
@@ -66,7 +62,7 @@ make_group(gp5,
 
   /* 0x0f 0x01*/
 make_group(gp7,
-    EMPTY, EMPTY, EMPTY, EMPTY,
+    EMPTY, EMPTY, EMPTY, EX(lidt),
     EMPTY, EMPTY, EMPTY, EMPTY)
 
 /* TODO: Add more instructions!!! */
@@ -105,7 +101,7 @@ opcode_entry opcode_table [512] = {
   /* 0x78 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x7c */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x80 */	IDEXW(I2E, gp1, 1), IDEX(I2E, gp1), EMPTY, IDEX(SI2E, gp1),
-  /* 0x84 */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0x84 */	EMPTY, EMPTY, IDEXW(G2E, xchg, 1), IDEX(G2E, xchg),
   /* 0x88 */	IDEXW(mov_G2E, mov, 1), IDEX(mov_G2E, mov), IDEXW(mov_E2G, mov, 1), IDEX(mov_E2G, mov),
   /* 0x8c */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x90 */	EMPTY, EMPTY, EMPTY, EMPTY,
@@ -113,9 +109,9 @@ opcode_entry opcode_table [512] = {
   /* 0x98 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0x9c */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xa0 */	IDEXW(O2a, mov, 1), IDEX(O2a, mov), IDEXW(a2O, mov, 1), IDEX(a2O, mov),
-  /* 0xa4 */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xa8 */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xac */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0xa4 */	EXW(movs, 1), EX(movs), EXW(cmps, 1), EX(cmps),
+  /* 0xa8 */	EMPTY, EMPTY, EXW(stos, 1), EX(stos),
+  /* 0xac */	EXW(lods, 1), EX(lods), EXW(scas, 1), EX(scas),
   /* 0xb0 */	IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1),
   /* 0xb4 */	IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1), IDEXW(mov_I2r, mov, 1),
   /* 0xb8 */	IDEX(mov_I2r, mov), IDEX(mov_I2r, mov), IDEX(mov_I2r, mov), IDEX(mov_I2r, mov),
@@ -123,7 +119,7 @@ opcode_entry opcode_table [512] = {
   /* 0xc0 */	IDEXW(gp2_Ib2E, gp2, 1), IDEX(gp2_Ib2E, gp2), EMPTY, EMPTY,
   /* 0xc4 */	EMPTY, EMPTY, IDEXW(mov_I2E, mov, 1), IDEX(mov_I2E, mov),
   /* 0xc8 */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xcc */	EMPTY, EMPTY, EMPTY, EMPTY,
+  /* 0xcc */	EMPTY, IDEXW(I, int, 1), EMPTY, EX(iret),
   /* 0xd0 */	IDEXW(gp2_1_E, gp2, 1), IDEX(gp2_1_E, gp2), IDEXW(gp2_cl2E, gp2, 1), IDEX(gp2_cl2E, gp2),
   /* 0xd4 */	EMPTY, EMPTY, EX(nemu_trap), EMPTY,
   /* 0xd8 */	EMPTY, EMPTY, EMPTY, EMPTY,
@@ -132,10 +128,10 @@ opcode_entry opcode_table [512] = {
   /* 0xe4 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xe8 */	EMPTY, EMPTY, EMPTY, EMPTY,
   /* 0xec */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xf0 */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xf4 */	EMPTY, EMPTY, IDEXW(E, gp3, 1), IDEX(E, gp3),
+  /* 0xf0 */	EX(lock), EMPTY, EX(repne), EX(rep),
+  /* 0xf4 */	EX(hlt), EMPTY, IDEXW(E, gp3, 1), IDEX(E, gp3),
   /* 0xf8 */	EMPTY, EMPTY, EMPTY, EMPTY,
-  /* 0xfc */	EMPTY, EMPTY, IDEXW(E, gp4, 1), IDEX(E, gp5),
+  /* 0xfc */	EX(cld), EX(std), IDEXW(E, gp4, 1), IDEX(E, gp5),
 
   /*2 byte_opcode_table */
 
@@ -205,6 +201,26 @@ opcode_entry opcode_table [512] = {
   /* 0xfc */	EMPTY, EMPTY, EMPTY, EMPTY
 };
 
+/* the entry which executes `opcode' with `ext_opcode' in the reg field
+ * of ModR/M, looking into the groups */
+opcode_entry *get_opcode_entry(uint32_t opcode, int ext_opcode) {
+  static const struct {
+    EHelper group;
+    opcode_entry *table;
+  } groups[] = {
+    { exec_gp1, opcode_table_gp1 }, { exec_gp2, opcode_table_gp2 },
+    { exec_gp3, opcode_table_gp3 }, { exec_gp4, opcode_table_gp4 },
+    { exec_gp5, opcode_table_gp5 }, { exec_gp7, opcode_table_gp7 },
+  };
+
+  opcode_entry *e = &opcode_table[opcode];
+  int i;
+  for (i = 0; i < sizeof(groups) / sizeof(groups[0]); i ++) {
+    if (e->execute == groups[i].group) return &groups[i].table[ext_opcode];
+  }
+  return e;
+}
+
 static make_EHelper(2byte_esc) {
   uint32_t opcode = instr_fetch(eip, 1) | 0x100;
   decoding.opcode = opcode;
@@ -219,6 +235,8 @@ make_EHelper(real) {
   idex(eip, &opcode_table[opcode]);
 }
 
+bool is_reexec = false;
+
 static inline void update_eip(void) {
   if (decoding.is_jmp) { decoding.is_jmp = 0; }
   else { cpu.eip = decoding.seq_eip; }
@@ -230,25 +248,61 @@ void exec_wrapper(bool print_flag) {
 #ifdef DEBUG
   decoding.p = decoding.asm_buf;
   decoding.p += sprintf(decoding.p, "%8x:   ", ori_eip);
+  decoding.instr_len = 0;
 #endif
 
   decoding.seq_eip = ori_eip;
+  decoding.is_restart = false;
   exec_real(&decoding.seq_eip);
 
+#ifdef CACHE
+  void cache_ifetch(vaddr_t, vaddr_t);
+  if (is_detailed) { cache_ifetch(ori_eip, decoding.seq_eip); }
+#endif
+
 #ifdef DEBUG
   int instr_len = decoding.seq_eip - ori_eip;
   sprintf(decoding.p, "%*.s", 50 - (12 + 3 * instr_len), "");
   strcat(decoding.asm_buf, decoding.assembly);
-  Log_write("%s\n", decoding.asm_buf);
-  if (print_flag) {
-    puts(decoding.asm_buf);
+  if (!is_reexec) {
+    Log_write("%s\n", decoding.asm_buf);
+    if (print_flag) {
+      puts(decoding.asm_buf);
+    }
+    void itrace_push(vaddr_t, const uint8_t *, int);
+    itrace_push(ori_eip, decoding.instr, decoding.instr_len);
   }
 #endif
 
   update_eip();
 
+#ifdef PROFILE
+  void profile_step(vaddr_t, vaddr_t, vaddr_t);
+  if (is_detailed && !decoding.is_restart) { profile_step(ori_eip, decoding.seq_eip, cpu.eip); }
+#endif
+
+#ifdef FTRACE
+  void ftrace_step(vaddr_t, vaddr_t, vaddr_t);
+  if (!is_reexec && !decoding.is_restart) { ftrace_step(ori_eip, decoding.seq_eip, cpu.eip); }
+#endif
+
+#ifdef SIMPOINT
+  if (is_bbv && !is_reexec && !decoding.is_restart) { bbv_step(ori_eip, decoding.seq_eip, cpu.eip); }
+#endif
+
 #if defined(DIFF_TEST)
   void difftest_step(uint32_t);
   difftest_step(ori_eip);
 #endif
+
+  if (cpu.INTR && cpu.eflags.IF && !is_reexec) {
+    /* take the interrupt of the timer before the next instruction */
+    cpu.INTR = false;
+    raise_intr(IRQ_TIMER, cpu.eip);
+    update_eip();
+#if defined(DIFF_TEST)
+    void difftest_intr(uint8_t);
+    difftest_intr(IRQ_TIMER);
+#endif
+  }
 }
@@ -7,3 +7,21 @@ make_EHelper(operand_size) {
   exec_real(eip);
   decoding.is_operand_size_16 = false;
 }
+
+/* The vCPUs only switch between instructions, so every instruction is
+ * already atomic. */
+make_EHelper(lock) {
+  exec_real(eip);
+}
+
+make_EHelper(rep) {
+  decoding.rep = REP_E;
+  exec_real(eip);
+  decoding.rep = REP_NONE;
+}
+
+make_EHelper(repne) {
+  decoding.rep = REP_NE;
+  exec_real(eip);
+  decoding.rep = REP_NONE;
+}
@@ -0,0 +1,243 @@
+#include "cpu/exec.h"
+
+/* The string instructions. Without a prefix, an instruction processes one
+ * element. With a rep prefix, it is repeated ecx times, and cmps/scas also
+ * stop when ZF becomes 0 (repe) or 1 (repne). A repeated instruction runs
+ * at most STRING_CHUNK elements at a time, and then restarts itself if it
+ * is not finished, the same as being interrupted on a real processor. So
+ * the devices and interrupts are still handled between chunks.
+ *
+ * If the memory of a chunk is plain RAM, the whole chunk is done with the
+ * host memmove()/memset()/memchr(). Otherwise, or if the cache model has
+ * to see every access, the elements are executed one by one.
+ *
+ * QEMU, the reference of DiffTest, stops after every element when it is
+ * single-stepped, so the chunk is one element to stay in lock-step.
+ */
+
+#if defined(DIFF_TEST) && defined(DIFF_TEST_QEMU)
+#define STRING_CHUNK 1
+#else
+#define STRING_CHUNK 4096
+#endif
+
+static inline int step(int width) {
+  return (cpu.eflags.DF ? -width : width);
+}
+
+/* the lowest address of `n' elements starting from `addr' */
+static inline vaddr_t range_low(vaddr_t addr, uint32_t n, int width) {
+  return (cpu.eflags.DF ? addr - (n - 1) * width : addr);
+}
+
+/* eflags <- flags of (src1 - src2), src1 and src2 are `width' bytes */
+static inline void update_cmp_flags(const rtlreg_t *src1, const rtlreg_t *src2, int width) {
+  rtl_sub(&t2, src1, src2);
+  rtl_update_ZFSF(&t2, width);
+  rtl_setrelop(RELOP_LTU, &t3, src1, src2);
+  rtl_set_CF(&t3);
+  rtl_xor(&t3, src1, src2);
+  rtl_xor(&t2, src1, &t2);
+  rtl_and(&t3, &t3, &t2);
+  rtl_msb(&t3, &t3, width);
+  rtl_set_OF(&t3);
+}
+
+/* one element of each instruction */
+
+static void movs_elem(int width) {
+  rtl_lm(&t0, &cpu.esi, width);
+  rtl_sm(&cpu.edi, &t0, width);
+  cpu.esi += step(width);
+  cpu.edi += step(width);
+}
+
+static void stos_elem(int width) {
+  rtl_lr(&t0, R_EAX, width);
+  rtl_sm(&cpu.edi, &t0, width);
+  cpu.edi += step(width);
+}
+
+static void lods_elem(int width) {
+  rtl_lm(&t0, &cpu.esi, width);
+  rtl_sr(R_EAX, &t0, width);
+  cpu.esi += step(width);
+}
+
+static void cmps_elem(int width) {
+  rtl_lm(&t0, &cpu.esi, width);
+  rtl_lm(&t1, &cpu.edi, width);
+  update_cmp_flags(&t0, &t1, width);
+  cpu.esi += step(width);
+  cpu.edi += step(width);
+}
+
+static void scas_elem(int width) {
+  rtl_lr(&t0, R_EAX, width);
+  rtl_lm(&t1, &cpu.edi, width);
+  update_cmp_flags(&t0, &t1, width);
+  cpu.edi += step(width);
+}
+
+/* `n' elements in bulk, return the number of elements executed, or 0 if
+ * they should be executed one by one */
+
+static uint32_t movs_bulk(uint32_t n, int width) {
+  uint32_t len = n * width;
+  vaddr_t src = range_low(cpu.esi, n, width);
+  vaddr_t dest = range_low(cpu.edi, n, width);
+
+  /* Element by element, a destination which overlaps the source ahead of
+   * it copies the elements written in this chunk again, but memmove()
+   * does not. */
+  uint32_t ahead = (cpu.eflags.DF ? src - dest : dest - src);
+  if (ahead != 0 && ahead < len) return 0;
+
+  void *hsrc = vaddr_host_range(src, len, false);
+  if (hsrc == NULL) return 0;
+  void *hdest = vaddr_host_range(dest, len, true);
+  if (hdest == NULL) return 0;
+
+  memmove(hdest, hsrc, len);
+  cpu.esi += step(width) * n;
+  cpu.edi += step(width) * n;
+  return n;
+}
+
+static uint32_t stos_bulk(uint32_t n, int width) {
+  uint8_t *hdest = vaddr_host_range(range_low(cpu.edi, n, width), n * width, true);
+  if (hdest == NULL) return 0;
+
+  rtl_lr(&t0, R_EAX, width);
+  if (width == 1) { memset(hdest, t0, n); }
+  else {
+    /* store one element, and then double the filled part */
+    uint32_t len = width, total = n * width;
+    rtl_host_sm(hdest, &t0, width);
+    while (len < total) {
+      uint32_t copy = (len < total - len ? len : total - len);
+      memcpy(hdest + len, hdest, copy);
+      len += copy;
+    }
+  }
+  cpu.edi += step(width) * n;
+  return n;
+}
+
+/* For cmps and scas, the flags are those of the last comparison. Only
+ * the forward direction is done in bulk, as the backward one is rare. */
+
+static uint32_t cmps_bulk(uint32_t n, int width) {
+  if (cpu.eflags.DF) return 0;
+  uint8_t *hsrc = vaddr_host_range(cpu.esi, n * width, false);
+  if (hsrc == NULL) return 0;
+  uint8_t *hdest = vaddr_host_range(cpu.edi, n * width, false);
+  if (hdest == NULL) return 0;
+
+  /* repe stops at the first different element, repne at the first same one */
+  bool stop_same = (decoding.rep == REP_NE);
+  uint32_t i;
+  for (i = 0; i < n; i ++) {
+    bool same = (memcmp(hsrc + i * width, hdest + i * width, width) == 0);
+    if (same == stop_same) { i ++; break; }
+  }
+  rtl_host_lm(&t0, hsrc + (i - 1) * width, width);
+  rtl_host_lm(&t1, hdest + (i - 1) * width, width);
+  update_cmp_flags(&t0, &t1, width);
+  cpu.esi += width * i;
+  cpu.edi += width * i;
+  return i;
+}
+
+static uint32_t scas_bulk(uint32_t n, int width) {
+  /* repne scasb is strlen() and memchr() */
+  if (cpu.eflags.DF || width != 1 || decoding.rep != REP_NE) return 0;
+  uint8_t *hdest = vaddr_host_range(cpu.edi, n, false);
+  if (hdest == NULL) return 0;
+
+  rtl_lr(&t0, R_EAX, 1);
+  uint8_t *p = memchr(hdest, t0, n);
+  uint32_t i = (p == NULL ? n : p - hdest + 1);
+  rtl_host_lm(&t1, hdest + i - 1, 1);
+  update_cmp_flags(&t0, &t1, 1);
+  cpu.edi += i;
+  return i;
+}
+
+/* whether repe/repne stops by ZF */
+static inline bool rep_stop() {
+  return (decoding.rep == REP_E ? !cpu.eflags.ZF : cpu.eflags.ZF);
+}
+
+static void exec_string(void (*elem)(int), uint32_t (*bulk)(uint32_t, int), bool is_cmp) {
+  int width = id_dest->width;
+  if (decoding.rep == REP_NONE) {
+    elem(width);
+    return;
+  }
+  if (cpu.ecx == 0) return;
+
+  uint32_t n = (cpu.ecx < STRING_CHUNK ? cpu.ecx : STRING_CHUNK);
+  uint32_t done = (bulk != NULL && mem_can_bulk() ? bulk(n, width) : 0);
+  if (done == 0) {
+    while (done < n) {
+      elem(width);
+      done ++;
+      if (is_cmp && rep_stop()) break;
+    }
+  }
+  cpu.ecx -= done;
+
+  if (cpu.ecx != 0 && !(is_cmp && rep_stop())) {
+    /* restart the instruction for the next chunk, which is not counted
+     * as another instruction */
+    rtl_j(cpu.eip);
+    decoding.is_restart = true;
+  }
+}
+
+static inline const char *rep_name() {
+  switch (decoding.rep) {
+    case REP_E: return "rep ";
+    case REP_NE: return "repne ";
+    default: return "";
+  }
+}
+
+#define print_asm_string(instr) \
+  print_asm("%s" str(instr) "%c", rep_name(), suffix_char(id_dest->width))
+
+make_EHelper(movs) {
+  exec_string(movs_elem, movs_bulk, false);
+  print_asm_string(movs);
+}
+
+make_EHelper(stos) {
+  exec_string(stos_elem, stos_bulk, false);
+  print_asm_string(stos);
+}
+
+make_EHelper(lods) {
+  exec_string(lods_elem, NULL, false);
+  print_asm_string(lods);
+}
+
+make_EHelper(cmps) {
+  exec_string(cmps_elem, cmps_bulk, true);
+  print_asm_string(cmps);
+}
+
+make_EHelper(scas) {
+  exec_string(scas_elem, scas_bulk, true);
+  print_asm_string(scas);
+}
+
+make_EHelper(cld) {
+  cpu.eflags.DF = 0;
+  print_asm("cld");
+}
+
+make_EHelper(std) {
+  cpu.eflags.DF = 1;
+  print_asm("std");
+}
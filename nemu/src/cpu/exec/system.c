@@ -1,10 +1,15 @@
 #include "cpu/exec.h"
+#include "cpu/intr.h"
 
 void difftest_skip_ref();
 void difftest_skip_dut();
 
 make_EHelper(lidt) {
-  TODO();
+  rtl_lm(&t0, &id_dest->addr, 2);
+  cpu.idtr.limit = t0;
+  rtl_addi(&t1, &id_dest->addr, 2);
+  rtl_lm(&t0, &t1, 4);
+  cpu.idtr.base = (decoding.is_operand_size_16 ? t0 & 0xffffff : t0);
 
   print_asm_template1(lidt);
 }
@@ -26,7 +31,7 @@ make_EHelper(mov_cr2r) {
 }
 
 make_EHelper(int) {
-  TODO();
+  raise_intr(id_dest->val, decoding.seq_eip);
 
   print_asm("int %s", id_dest->str);
 
@@ -36,11 +41,24 @@ make_EHelper(int) {
 }
 
 make_EHelper(iret) {
-  TODO();
+  return_intr();
 
   print_asm("iret");
 }
 
+make_EHelper(hlt) {
+#ifdef HAS_IOE
+  void device_wait();
+  device_wait();
+#endif
+
+  print_asm("hlt");
+
+#if defined(DIFF_TEST)
+  difftest_skip_ref();
+#endif
+}
+
 make_EHelper(in) {
   TODO();
 
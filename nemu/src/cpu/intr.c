@@ -1,13 +1,115 @@
 #include "cpu/exec.h"
-#include "memory/mmu.h"
+#include "cpu/intr.h"
+#include "memory/codepage.h"
+
+/* Interrupts and exceptions. The gates of the IDT are decoded on their
+ * first use, and kept until the IDTR is changed by `lidt', or the IDT is
+ * written. The pages of the cached gates are marked in the code-page
+ * tracker to catch the writes. The IDT is assumed to be identity-mapped,
+ * as it is in AM, so its virtual address is also the physical one.
+ *
+ * The frame of eip, cs and eflags is pushed by raise_intr() and popped
+ * by return_intr() with one host copy when the stack is plain RAM, and
+ * one word at a time otherwise.
+ */
+
+#define NR_GATE 256
+#define FRAME_SIZE (3 * sizeof(uint32_t))
+
+static struct {
+  vaddr_t entry;
+  bool is_trap;   // a trap gate does not clear IF
+  bool valid;
+} gates[NR_GATE];
+
+/* the IDTR which the cached gates come from */
+static vaddr_t gates_base = 0;
+static uint16_t gates_limit = 0;
+
+static void intr_flush_gates() {
+  int i;
+  for (i = 0; i < NR_GATE; i ++) { gates[i].valid = false; }
+}
+
+/* the callback of the code-page tracker */
+static void gates_invalidate(paddr_t page) {
+  int i;
+  for (i = 0; i < NR_GATE; i ++) {
+    paddr_t addr = gates_base + i * sizeof(GateDesc);
+    if (addr + sizeof(GateDesc) > page && addr < page + PAGE_SIZE) { gates[i].valid = false; }
+  }
+}
+
+static void load_gate(uint8_t NO) {
+  Assert((NO + 1) * sizeof(GateDesc) - 1 <= cpu.idtr.limit,
+      "interrupt %d is beyond the IDT (limit = 0x%x)", NO, cpu.idtr.limit);
+
+  vaddr_t addr = cpu.idtr.base + NO * sizeof(GateDesc);
+  GateDesc gate;
+  uint32_t *w = (void *)&gate;
+  w[0] = vaddr_read(addr, 4);
+  w[1] = vaddr_read(addr + 4, 4);
+  Assert(gate.present, "the gate of interrupt %d is not present", NO);
+
+  gates[NO].entry = (gate.offset_31_16 << 16) | gate.offset_15_0;
+  /* the type is 0xe for an interrupt gate, and 0xf for a trap gate */
+  gates[NO].is_trap = (w[1] >> 8) & 0x1;
+  gates[NO].valid = true;
+
+  codepage_add_callback(gates_invalidate);
+  codepage_mark(addr);
+  codepage_mark(addr + sizeof(GateDesc) - 1);
+}
+
+static void push_frame(vaddr_t ret_addr) {
+  uint32_t frame[3] = { ret_addr, cpu.cs, cpu.eflags.val };
+  void *host = (mem_can_bulk() ? vaddr_host_range(cpu.esp - FRAME_SIZE, FRAME_SIZE, true) : NULL);
+  if (host != NULL) {
+    memcpy(host, frame, FRAME_SIZE);
+    cpu.esp -= FRAME_SIZE;
+  }
+  else {
+    rtl_push(&frame[2]);
+    rtl_push(&frame[1]);
+    rtl_push(&frame[0]);
+  }
+}
+
+static void pop_frame(uint32_t *frame) {
+  void *host = (mem_can_bulk() ? vaddr_host_range(cpu.esp, FRAME_SIZE, false) : NULL);
+  if (host != NULL) {
+    memcpy(frame, host, FRAME_SIZE);
+    cpu.esp += FRAME_SIZE;
+  }
+  else {
+    rtl_pop(&frame[0]);
+    rtl_pop(&frame[1]);
+    rtl_pop(&frame[2]);
+  }
+}
 
 void raise_intr(uint8_t NO, vaddr_t ret_addr) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * That is, use ``NO'' to index the IDT.
-   */
+  if (cpu.idtr.base != gates_base || cpu.idtr.limit != gates_limit) {
+    intr_flush_gates();
+    gates_base = cpu.idtr.base;
+    gates_limit = cpu.idtr.limit;
+  }
+  if (!gates[NO].valid) { load_gate(NO); }
+
+  push_frame(ret_addr);
+  if (!gates[NO].is_trap) { cpu.eflags.IF = 0; }
+  rtl_j(gates[NO].entry);
+}
 
-  TODO();
+void return_intr() {
+  uint32_t frame[3];
+  pop_frame(frame);
+  cpu.cs = frame[1];
+  cpu.eflags.val = frame[2];
+  rtl_j(frame[0]);
 }
 
 void dev_raise_intr() {
+  void vcpu_raise_intr();
+  vcpu_raise_intr();
 }
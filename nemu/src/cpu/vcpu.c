@@ -0,0 +1,109 @@
+#include "nemu.h"
+#include "cpu/vcpu.h"
+
+#include <stdlib.h>
+
+/* Virtual CPUs for the multi-processor extension of AM. `cpu' is the
+ * register file of the vCPU running now, and the others are kept in
+ * `vcpus'. The vCPUs take turns on the host thread of NEMU in a fixed
+ * round-robin order, each running `quantum' instructions, so a run is
+ * always the same and can be debugged like one on a uniprocessor. As they
+ * only switch between instructions, every instruction is atomic, and so
+ * are `lock' and `xchg'.
+ *
+ * Only CPU 0 runs at the beginning. The others are started by a startup
+ * IPI through the MP port (device/mp.c). Every vCPU has its own interrupt
+ * pin, but there is only one timer, and its interrupt is raised on all the
+ * started vCPUs at once.
+ *
+ * Without MULTI_CPU, there is always one CPU, which never switches.
+ */
+
+int nr_cpu = 1, cur_cpu = 0;
+
+/* never reach zero with a single CPU */
+uint64_t vcpu_countdown = -1ull;
+
+static uint64_t quantum = VCPU_QUANTUM;
+static CPU_state vcpus[MAX_CPU];
+static bool is_started[MAX_CPU] = { true };
+
+#ifdef MULTI_CPU
+void vcpu_switch() {
+  vcpu_countdown = quantum;
+
+  int next = cur_cpu;
+  do { next = (next + 1) % nr_cpu; } while (!is_started[next]);
+  if (next == cur_cpu) return;
+
+  vcpus[cur_cpu] = cpu;
+  cpu = vcpus[next];
+  cur_cpu = next;
+}
+#endif
+
+void vcpu_start(int id, vaddr_t eip, vaddr_t esp) {
+  if (id <= 0 || id >= nr_cpu || is_started[id]) {
+    Log("IPI to CPU %d is ignored", id);
+    return;
+  }
+
+  CPU_state *c = &vcpus[id];
+  memset(c, 0, sizeof(*c));
+  c->eip = eip;
+  c->esp = esp;
+  c->eflags.val = 0x2;
+  c->cs = cpu.cs;
+  c->idtr = cpu.idtr;
+  c->cr0 = cpu.cr0;
+  c->cr3 = cpu.cr3;
+  is_started[id] = true;
+  Log("CPU %d starts at eip = 0x%08x, esp = 0x%08x", id, eip, esp);
+}
+
+void vcpu_raise_intr() {
+  int i;
+  for (i = 0; i < nr_cpu; i ++) {
+    if (!is_started[i]) continue;
+    if (i == cur_cpu) { cpu.INTR = true; }
+    else { vcpus[i].INTR = true; }
+  }
+}
+
+void vcpu_snapshot(Snapshot *s) {
+  int n = nr_cpu;
+  snapshot_rw(s, &n, sizeof(n));
+  if (n != nr_cpu) {
+    printf("snapshot: taken with %d CPUs, but there are %d CPUs\n", n, nr_cpu);
+    s->ok = false;
+    return;
+  }
+
+  /* `cpu' itself is in the snapshot of the CPU */
+  if (s->is_save) { vcpus[cur_cpu] = cpu; }
+  snapshot_rw(s, &cur_cpu, sizeof(cur_cpu));
+  snapshot_rw(s, &vcpu_countdown, sizeof(vcpu_countdown));
+  snapshot_rw(s, vcpus, sizeof(vcpus[0]) * nr_cpu);
+  snapshot_rw(s, is_started, sizeof(is_started[0]) * nr_cpu);
+}
+
+void init_vcpu(char *spec) {
+  if (spec == NULL) return;
+
+#ifndef MULTI_CPU
+  Log("Multiple CPUs are not enabled, define MULTI_CPU in include/common.h to enable them");
+  return;
+#endif
+
+  char *p;
+  nr_cpu = strtol(spec, &p, 0);
+  if (*p == ':') { quantum = strtoull(p + 1, NULL, 0); }
+  Assert(nr_cpu >= 1 && nr_cpu <= MAX_CPU, "the number of CPUs should be in [1, %d]", MAX_CPU);
+  Assert(quantum > 0, "the quantum should be positive");
+#ifdef DIFF_TEST
+  Assert(nr_cpu == 1, "DiffTest only supports one CPU");
+#endif
+
+  if (nr_cpu > 1) { vcpu_countdown = quantum; }
+  Log("%d virtual CPUs in round-robin, %lu instructions at a time", nr_cpu, quantum);
+}
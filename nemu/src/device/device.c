@@ -4,7 +4,9 @@
 
 #include <sys/time.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <SDL2/SDL.h>
+#include "device/replay.h"
 
 #define TIMER_HZ 100
 #define VGA_HZ 50
@@ -13,11 +15,14 @@ static uint64_t jiffy = 0;
 static struct itimerval it;
 static int device_update_flag = false;
 static int update_screen_flag = false;
+static int timer_flag = false;
 
 void init_serial();
 void init_timer();
 void init_vga();
 void init_i8042();
+void init_perfcnt();
+void init_mp();
 
 extern void timer_intr();
 extern void send_key(uint8_t, bool);
@@ -26,7 +31,8 @@ extern void update_screen();
 
 static void timer_sig_handler(int signum) {
   jiffy ++;
-  timer_intr();
+  /* raise the interrupt between instructions, so it can be recorded */
+  timer_flag = true;
 
   device_update_flag = true;
   if (jiffy % (TIMER_HZ / VGA_HZ) == 0) {
@@ -38,11 +44,21 @@ static void timer_sig_handler(int signum) {
 }
 
 void device_update() {
+  if (replay_state == REPLAY_PLAY) {
+    replay_update();
+    return;
+  }
+
   if (!device_update_flag) {
     return;
   }
   device_update_flag = false;
 
+  if (timer_flag) {
+    timer_intr();
+    timer_flag = false;
+  }
+
   if (update_screen_flag) {
     update_screen();
     update_screen_flag = false;
@@ -72,7 +88,35 @@ void device_update() {
   }
 }
 
+/* Raise the next timer tick now, and return how far away it still was,
+ * in us. The interval timer counts the CPU time of NEMU, so this is only
+ * an estimate of the host time. */
+uint32_t timer_tick_now() {
+  struct itimerval cur;
+  int ret = getitimer(ITIMER_VIRTUAL, &cur);
+  Assert(ret == 0, "Can not get timer");
+  timer_sig_handler(SIGVTALRM);
+  return cur.it_value.tv_sec * 1000000 + cur.it_value.tv_usec;
+}
+
+/* Called by `hlt'. Sleep until the next device event, which is the next
+ * timer tick or an input event. The interval timer does not run while
+ * NEMU sleeps, so the tick is raised here when the sleep ends. */
+void device_wait() {
+  /* inputs come from the log when replaying, there is nothing to wait */
+  if (replay_state == REPLAY_PLAY || device_update_flag) return;
+
+  struct itimerval cur;
+  int ret = getitimer(ITIMER_VIRTUAL, &cur);
+  Assert(ret == 0, "Can not get timer");
+  int ms = cur.it_value.tv_sec * 1000 + (cur.it_value.tv_usec + 999) / 1000;
+
+  if (SDL_WaitEventTimeout(NULL, ms)) { device_update_flag = true; }
+  else { timer_sig_handler(SIGVTALRM); }
+}
+
 void sdl_clear_event_queue() {
+  if (replay_state == REPLAY_PLAY) return;
   SDL_Event event;
   while (SDL_PollEvent(&event));
 }
@@ -82,6 +126,11 @@ void init_device() {
   init_timer();
   init_vga();
   init_i8042();
+  init_perfcnt();
+  init_mp();
+
+  /* inputs come from the log when replaying, run at full speed */
+  if (replay_state == REPLAY_PLAY) return;
 
   struct sigaction s;
   memset(&s, 0, sizeof(s));
@@ -99,4 +148,6 @@ void init_device() {
 void init_device() {
 }
 
+uint32_t timer_tick_now() { return 0; }
+
 #endif	/* HAS_IOE */
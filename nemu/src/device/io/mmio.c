@@ -1,7 +1,7 @@
 #include "common.h"
 #include "device/mmio.h"
+#include "monitor/snapshot.h"
 
-#define MMIO_SPACE_MAX (512 * 1024)
 #define NR_MAP 2
 
 static uint8_t mmio_space_pool[MMIO_SPACE_MAX];
@@ -32,6 +32,15 @@ void* add_mmio_map(paddr_t addr, int len, mmio_callback_t callback) {
   return space_base;
 }
 
+/* the spaces of all maps, in [0, MMIO_SPACE_MAX) */
+uint8_t* mmio_pool() {
+  return mmio_space_pool;
+}
+
+void mmio_snapshot(Snapshot *s) {
+  snapshot_rw_mem(s, mmio_space_pool, mmio_space_free_index);
+}
+
 /* bus interface */
 int is_mmio(paddr_t addr) {
   int i;
@@ -43,6 +52,17 @@ int is_mmio(paddr_t addr) {
   return -1;
 }
 
+/* whether [addr, addr + len) overlaps some map */
+bool is_mmio_range(paddr_t addr, uint32_t len) {
+  int i;
+  for (i = 0; i < nr_map; i ++) {
+    if (addr <= maps[i].high && (uint64_t)addr + len > maps[i].low) {
+      return true;
+    }
+  }
+  return false;
+}
+
 uint32_t mmio_read(paddr_t addr, int len, int map_NO) {
   assert(len >= 1 && len <= 4);
   MMIO_t *map = &maps[map_NO];
@@ -60,6 +80,10 @@ void mmio_write(paddr_t addr, int len, uint32_t data, int map_NO) {
 
   uint8_t *p = map->mmio_space + (addr - map->low);
   uint8_t *p_data = (uint8_t *)&data;
+#ifdef REVERSE
+  void checkpoint_mmio_write(uint32_t offset, int len);
+  checkpoint_mmio_write(p - mmio_space_pool, len);
+#endif
 
   switch (len) {
     case 4: p[3] = p_data[3];
@@ -1,8 +1,9 @@
 #include "common.h"
 #include "device/port-io.h"
+#include "monitor/snapshot.h"
 
 #define PORT_IO_SPACE_MAX 65536
-#define NR_MAP 8
+#define NR_MAP 16
 
 /* "+ 3" is for hacking, see pio_read() below */
 static uint8_t pio_space[PORT_IO_SPACE_MAX + 3];
@@ -61,6 +62,18 @@ static inline void pio_write_common(ioaddr_t addr, uint32_t data, int len) {
   pio_callback(addr, len, true);
 }
 
+void pio_snapshot(Snapshot *s) {
+  snapshot_rw_mem(s, pio_space, sizeof(pio_space));
+}
+
+/* only the ports of the maps, which are much smaller than the whole space */
+void pio_snapshot_maps(Snapshot *s) {
+  int i;
+  for (i = 0; i < nr_map; i ++) {
+    snapshot_rw(s, pio_space + maps[i].low, maps[i].high - maps[i].low + 1);
+  }
+}
+
 /* CPU interface */
 uint32_t pio_read_l(ioaddr_t addr) {
   return pio_read_common(addr, 4);
@@ -1,5 +1,7 @@
 #include "device/port-io.h"
 #include "monitor/monitor.h"
+#include "monitor/snapshot.h"
+#include "device/replay.h"
 #include <SDL2/SDL.h>
 
 #define I8042_DATA_PORT 0x60
@@ -35,13 +37,18 @@ static int key_f = 0, key_r = 0;
 
 #define KEYDOWN_MASK 0x8000
 
+void key_enqueue(uint32_t am_scancode) {
+  key_queue[key_r] = am_scancode;
+  key_r = (key_r + 1) % KEY_QUEUE_LEN;
+  Assert(key_r != key_f, "key queue overflow!");
+}
+
 void send_key(uint8_t scancode, bool is_keydown) {
   if (nemu_state == NEMU_RUNNING &&
       keymap[scancode] != _KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
-    key_queue[key_r] = am_scancode;
-    key_r = (key_r + 1) % KEY_QUEUE_LEN;
-    Assert(key_r != key_f, "key queue overflow!");
+    replay_key(am_scancode);
+    key_enqueue(am_scancode);
   }
 }
 
@@ -57,6 +64,12 @@ static void i8042_data_io_handler(ioaddr_t addr, int len, bool is_write) {
   }
 }
 
+void i8042_snapshot(Snapshot *s) {
+  snapshot_rw(s, key_queue, sizeof(key_queue));
+  snapshot_rw(s, &key_f, sizeof(key_f));
+  snapshot_rw(s, &key_r, sizeof(key_r));
+}
+
 void init_i8042() {
   i8042_data_port_base = add_pio_map(I8042_DATA_PORT, 4, i8042_data_io_handler);
   i8042_data_port_base[0] = _KEY_NONE;
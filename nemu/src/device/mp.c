@@ -0,0 +1,25 @@
+#include "nemu.h"
+#include "cpu/vcpu.h"
+#include "device/port-io.h"
+
+/* The MP port. The number of CPUs is read from MP_PORT, and the id of the
+ * CPU reading from MP_PORT + 4. To start CPU i with a startup IPI, write
+ * the eip and the esp it starts with to MP_PORT + 8 and MP_PORT + 12, and
+ * then write i to MP_PORT + 16. */
+#define MP_PORT 0x70   // Note that this is not the standard
+
+static uint32_t *mp_port_base;
+
+static void mp_io_handler(ioaddr_t addr, int len, bool is_write) {
+  if (!is_write) {
+    mp_port_base[0] = nr_cpu;
+    mp_port_base[1] = cur_cpu;
+  }
+  else if (addr == MP_PORT + 16) {
+    vcpu_start(mp_port_base[4], mp_port_base[2], mp_port_base[3]);
+  }
+}
+
+void init_mp() {
+  mp_port_base = add_pio_map(MP_PORT, 20, mp_io_handler);
+}
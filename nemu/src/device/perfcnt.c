@@ -0,0 +1,21 @@
+#include "device/port-io.h"
+#include "monitor/perfcnt.h"
+
+/* Write the index of a counter to PERFCNT_PORT, then read its low and
+ * high 32 bits from the following two ports. The counter is latched by
+ * the write, so the two halves are consistent. */
+#define PERFCNT_PORT 0x50   // Note that this is not the standard
+
+static uint32_t *perfcnt_port_base;
+
+static void perfcnt_io_handler(ioaddr_t addr, int len, bool is_write) {
+  if (is_write && addr == PERFCNT_PORT) {
+    uint64_t val = perfcnt_read(perfcnt_port_base[0]);
+    perfcnt_port_base[1] = (uint32_t)val;
+    perfcnt_port_base[2] = val >> 32;
+  }
+}
+
+void init_perfcnt() {
+  perfcnt_port_base = add_pio_map(PERFCNT_PORT, 12, perfcnt_io_handler);
+}
@@ -0,0 +1,172 @@
+#include "common.h"
+#include "device/replay.h"
+#include "monitor/monitor.h"
+#include "monitor/snapshot.h"
+
+int replay_state = REPLAY_OFF;
+
+#ifdef HAS_IOE
+
+#include <stdlib.h>
+
+/* The log is a text file, one input per line:
+ *   <instructions> rtc <value>
+ *   <instructions> key <scancode>
+ *   <instructions> intr 0
+ * Keys and interrupts are injected between instructions, so their
+ * instruction counts determine where they happen. RTC values are taken
+ * in order, and their instruction counts are only used to detect that
+ * the replay has diverged from the recorded run.
+ */
+
+enum { EV_RTC, EV_KEY, EV_INTR, NR_EV };
+static const char *ev_name[] = { "rtc", "key", "intr" };
+
+typedef struct {
+  uint64_t instr;
+  int type;
+  uint32_t value;
+} Event;
+
+static FILE *record_fp = NULL;
+
+/* the events to replay, RTC reads are kept separately */
+static Event *events = NULL, *rtcs = NULL;
+static uint32_t nr_event = 0, nr_rtc = 0;
+static uint32_t event_idx = 0, rtc_idx = 0;
+static bool is_diverged = false;
+
+uint64_t get_nr_guest_instr();
+void key_enqueue(uint32_t am_scancode);
+void dev_raise_intr();
+
+static void record(int type, uint32_t value) {
+  fprintf(record_fp, "%lu %s %u\n", get_nr_guest_instr(), ev_name[type], value);
+}
+
+static void diverge(const char *reason) {
+  if (!is_diverged) {
+    Log("Replay diverges after %lu instructions: %s", get_nr_guest_instr(), reason);
+    is_diverged = true;
+  }
+}
+
+static void load_events(char *file) {
+  FILE *fp = fopen(file, "r");
+  Assert(fp, "Can not open '%s'", file);
+
+  uint32_t max_event = 0, max_rtc = 0;
+  Event e;
+  char name[8];
+  while (fscanf(fp, "%lu %7s %u", &e.instr, name, &e.value) == 3) {
+    for (e.type = 0; e.type < NR_EV; e.type ++) {
+      if (strcmp(name, ev_name[e.type]) == 0) break;
+    }
+    Assert(e.type < NR_EV, "unknown event '%s' in %s", name, file);
+
+    if (e.type == EV_RTC) {
+      if (nr_rtc == max_rtc) {
+        max_rtc = (max_rtc == 0 ? 1024 : max_rtc * 2);
+        rtcs = realloc(rtcs, sizeof(Event) * max_rtc);
+        assert(rtcs != NULL);
+      }
+      rtcs[nr_rtc ++] = e;
+    }
+    else {
+      if (nr_event == max_event) {
+        max_event = (max_event == 0 ? 1024 : max_event * 2);
+        events = realloc(events, sizeof(Event) * max_event);
+        assert(events != NULL);
+      }
+      Assert(nr_event == 0 || events[nr_event - 1].instr <= e.instr,
+          "events in %s are not in order", file);
+      events[nr_event ++] = e;
+    }
+  }
+  fclose(fp);
+}
+
+static void close_record() {
+  fclose(record_fp);
+}
+
+void init_replay(char *record_file, char *replay_file) {
+  if (record_file == NULL && replay_file == NULL) return;
+
+  Assert(record_file == NULL || replay_file == NULL, "Can not record and replay at the same time");
+
+  if (record_file != NULL) {
+    record_fp = fopen(record_file, "w");
+    Assert(record_fp, "Can not open '%s'", record_file);
+    atexit(close_record);
+    replay_state = REPLAY_RECORD;
+    Log("Record device inputs to %s", record_file);
+  }
+  else {
+    load_events(replay_file);
+    replay_state = REPLAY_PLAY;
+    Log("Replay %d device inputs and %d RTC reads from %s without SDL",
+        nr_event, nr_rtc, replay_file);
+  }
+}
+
+/* called when the guest reads the RTC, return the value it should see */
+uint32_t replay_rtc(uint32_t value) {
+  switch (replay_state) {
+    case REPLAY_RECORD: record(EV_RTC, value); return value;
+    case REPLAY_PLAY:
+      if (rtc_idx == nr_rtc) {
+        diverge("more RTC reads than recorded");
+        return value;
+      }
+      if (rtcs[rtc_idx].instr != get_nr_guest_instr()) {
+        diverge("RTC is read at a different instruction");
+      }
+      return rtcs[rtc_idx ++].value;
+    default: return value;
+  }
+}
+
+void replay_key(uint32_t am_scancode) {
+  if (replay_state == REPLAY_RECORD) { record(EV_KEY, am_scancode); }
+}
+
+void replay_intr() {
+  if (replay_state == REPLAY_RECORD) { record(EV_INTR, 0); }
+}
+
+/* the position in the log, so a checkpoint can be replayed again */
+void replay_snapshot(Snapshot *s) {
+  snapshot_rw(s, &event_idx, sizeof(event_idx));
+  snapshot_rw(s, &rtc_idx, sizeof(rtc_idx));
+}
+
+/* called between instructions to inject the inputs due */
+void replay_update() {
+  uint64_t now = get_nr_guest_instr();
+  while (event_idx < nr_event && events[event_idx].instr <= now) {
+    Event *e = &events[event_idx ++];
+    if (e->instr < now) { diverge("an input is injected late"); }
+    switch (e->type) {
+      case EV_KEY: key_enqueue(e->value); break;
+      case EV_INTR: dev_raise_intr(); break;
+      default: assert(0);
+    }
+  }
+}
+
+#else
+
+void init_replay(char *record_file, char *replay_file) {
+  if (record_file != NULL || replay_file != NULL) {
+    Log("Record and replay need devices, define HAS_IOE in include/common.h to enable it");
+  }
+}
+
+uint32_t replay_rtc(uint32_t value) { return value; }
+void replay_key(uint32_t am_scancode) { }
+void replay_intr() { }
+void replay_update() { }
+void replay_snapshot(Snapshot *s) { }
+
+#endif
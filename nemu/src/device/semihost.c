@@ -0,0 +1,166 @@
+#include "nemu.h"
+#include "device/port-io.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+
+/* Semihosting: the guest accesses the files in a host directory given by
+ * --semihost=DIR, such as the inputs of a benchmark, without going
+ * through a disk device. The guest fills a command block in its memory,
+ * and writes the physical address of the block to SEMIHOST_PORT. The
+ * command is done before the `out' instruction finishes, and the result
+ * is written to `ret' of the block, which is -errno on failure.
+ *
+ * The data are moved between the host files and the guest memory
+ * directly by read() and write(), so `buf' is also a physical address.
+ * The paths are relative to DIR, and can not contain "..". Symbolic
+ * links put in DIR by the host are followed, except the last component.
+ */
+#define SEMIHOST_PORT 0x88   // Note that this is not the standard
+
+enum { SH_OPEN = 1, SH_READ, SH_WRITE, SH_LSEEK, SH_CLOSE };
+
+/* the flags of SH_OPEN, independent of the host */
+#define SH_O_ACCMODE 0x3
+#define SH_O_CREAT   0x100
+#define SH_O_TRUNC   0x200
+#define SH_O_APPEND  0x400
+
+#define NR_SEMIHOST_FD 32
+#define SEMIHOST_PATH_MAX 256
+
+typedef struct {
+  uint32_t cmd;
+  uint32_t fd;
+  uint32_t buf;     // SH_OPEN: the path, SH_READ/SH_WRITE: the data
+  uint32_t len;
+  uint32_t flags;   // SH_OPEN
+  int32_t offset;   // SH_LSEEK
+  uint32_t whence;  // SH_LSEEK, SEEK_SET, SEEK_CUR or SEEK_END
+  int32_t ret;
+} SemihostBlock;
+
+static uint32_t *semihost_port_base;
+static int dir_fd = -1;
+static int host_fd[NR_SEMIHOST_FD];
+
+static inline bool in_pmem(uint32_t addr, uint32_t len) {
+  return (uint64_t)addr + len <= pmem_size;
+}
+
+static int sh_open(const SemihostBlock *b) {
+  if (b->len == 0 || b->len >= SEMIHOST_PATH_MAX) return -ENAMETOOLONG;
+  if (!in_pmem(b->buf, b->len)) return -EFAULT;
+
+  char path[SEMIHOST_PATH_MAX];
+  memcpy(path, guest_to_host(b->buf), b->len);
+  path[b->len] = '\0';
+  if (strlen(path) != b->len || path[0] == '/') return -EACCES;
+  char *p;
+  for (p = path; p != NULL; p = strchr(p, '/')) {
+    if (*p == '/') p ++;
+    if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0')) return -EACCES;
+  }
+
+  if (b->flags & ~(SH_O_ACCMODE | SH_O_CREAT | SH_O_TRUNC | SH_O_APPEND)) return -EINVAL;
+  static const int accmode[] = { O_RDONLY, O_WRONLY, O_RDWR, -1 };
+  int flags = accmode[b->flags & SH_O_ACCMODE];
+  if (flags == -1) return -EINVAL;
+  if (b->flags & SH_O_CREAT) flags |= O_CREAT;
+  if (b->flags & SH_O_TRUNC) flags |= O_TRUNC;
+  if (b->flags & SH_O_APPEND) flags |= O_APPEND;
+
+  int fd;
+  for (fd = 0; fd < NR_SEMIHOST_FD; fd ++) {
+    if (host_fd[fd] == -1) break;
+  }
+  if (fd == NR_SEMIHOST_FD) return -EMFILE;
+
+  int hfd = openat(dir_fd, path, flags | O_NOFOLLOW | O_CLOEXEC, 0644);
+  if (hfd < 0) return -errno;
+  host_fd[fd] = hfd;
+  return fd;
+}
+
+static int sh_read(const SemihostBlock *b, int hfd) {
+  if (!in_pmem(b->buf, b->len)) return -EFAULT;
+  uint8_t *p = dma_write_begin(b->buf, b->len);
+  uint32_t done = 0;
+  while (done < b->len) {
+    ssize_t n = read(hfd, p + done, b->len - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && done == 0) { dma_write_end(b->buf, 0); return -errno; }
+    if (n <= 0) break;
+    done += n;
+  }
+  dma_write_end(b->buf, done);
+  return done;
+}
+
+static int sh_write(const SemihostBlock *b, int hfd) {
+  if (!in_pmem(b->buf, b->len)) return -EFAULT;
+  const uint8_t *p = guest_to_host(b->buf);
+  uint32_t done = 0;
+  while (done < b->len) {
+    ssize_t n = write(hfd, p + done, b->len - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && done == 0) return -errno;
+    if (n <= 0) break;
+    done += n;
+  }
+  return done;
+}
+
+static int sh_lseek(const SemihostBlock *b, int hfd) {
+  if (b->whence != SEEK_SET && b->whence != SEEK_CUR && b->whence != SEEK_END) return -EINVAL;
+  off_t off = lseek(hfd, b->offset, b->whence);
+  if (off < 0) return -errno;
+  /* the offset is returned in `ret', so it should fit in it */
+  if (off > INT32_MAX) return -EOVERFLOW;
+  return off;
+}
+
+static int semihost_cmd(const SemihostBlock *b) {
+  if (dir_fd < 0) return -EACCES;
+  if (b->cmd == SH_OPEN) return sh_open(b);
+
+  if (b->fd >= NR_SEMIHOST_FD || host_fd[b->fd] == -1) return -EBADF;
+  int hfd = host_fd[b->fd];
+  switch (b->cmd) {
+    case SH_READ: return sh_read(b, hfd);
+    case SH_WRITE: return sh_write(b, hfd);
+    case SH_LSEEK: return sh_lseek(b, hfd);
+    case SH_CLOSE:
+      host_fd[b->fd] = -1;
+      return (close(hfd) == 0 ? 0 : -errno);
+    default: return -ENOSYS;
+  }
+}
+
+static void semihost_io_handler(ioaddr_t addr, int len, bool is_write) {
+  if (!is_write || addr != SEMIHOST_PORT || len != 4) return;
+
+  paddr_t block = semihost_port_base[0];
+  if (!in_pmem(block, sizeof(SemihostBlock))) {
+    Log("semihosting: the command block at 0x%08x is out of bound", block);
+    return;
+  }
+  SemihostBlock b;
+  memcpy(&b, guest_to_host(block), sizeof(b));
+  int32_t ret = semihost_cmd(&b);
+  dma_write(block + offsetof(SemihostBlock, ret), &ret, sizeof(ret));
+}
+
+void init_semihost(const char *dir) {
+  int i;
+  for (i = 0; i < NR_SEMIHOST_FD; i ++) {
+    host_fd[i] = -1;
+  }
+  semihost_port_base = add_pio_map(SEMIHOST_PORT, 4, semihost_io_handler);
+
+  if (dir == NULL) return;
+  dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  Assert(dir_fd >= 0, "Can not open the semihosting directory '%s'", dir);
+  Log("Semihosting the files in %s", dir);
+}
@@ -1,11 +1,14 @@
+#include "nemu.h"
 #include "device/port-io.h"
 #include "monitor/monitor.h"
+#include "device/replay.h"
 #include <sys/time.h>
 
 #define RTC_PORT 0x48   // Note that this is not the standard
 
 void timer_intr() {
   if (nemu_state == NEMU_RUNNING) {
+    replay_intr();
     extern void dev_raise_intr(void);
     dev_raise_intr();
   }
@@ -13,13 +16,56 @@ void timer_intr() {
 
 static uint32_t *rtc_port_base;
 
+/* A guest which waits for some time by polling the RTC, such as
+ * `while (uptime() < next_frame)', keeps the host CPU busy for nothing.
+ * It is taken as spinning when the same instruction reads the RTC
+ * SPIN_READS times in a row, each within SPIN_MAX_INSTR instructions of
+ * the last one, and without storing anything outside the stack between
+ * them. The RTC then skips to the next timer tick, which is raised at
+ * once, so the guest reaches its deadline without spinning all the way.
+ */
+#define SPIN_READS 32
+#define SPIN_MAX_INSTR 256
+
+extern uint64_t nr_nonstack_store;
+uint64_t get_nr_guest_instr();
+uint32_t timer_tick_now();
+
+/* the time skipped, in us, which the RTC is ahead of the host */
+static uint64_t skipped_us = 0;
+
+static bool is_spinning() {
+  static vaddr_t last_eip;
+  static uint64_t last_instr, last_store;
+  static int nr_spin = 0;
+
+  uint64_t instr = get_nr_guest_instr();
+  if (cpu.eip == last_eip && instr - last_instr <= SPIN_MAX_INSTR &&
+      nr_nonstack_store == last_store) {
+    nr_spin ++;
+  }
+  else {
+    nr_spin = 0;
+  }
+  last_eip = cpu.eip;
+  last_instr = instr;
+  last_store = nr_nonstack_store;
+
+  if (nr_spin < SPIN_READS) return false;
+  nr_spin = 0;
+  return true;
+}
+
 void rtc_io_handler(ioaddr_t addr, int len, bool is_write) {
   if (!is_write) {
+    if (replay_state != REPLAY_PLAY && is_spinning()) {
+      skipped_us += timer_tick_now();
+    }
+
     struct timeval now;
     gettimeofday(&now, NULL);
-    uint32_t seconds = now.tv_sec;
-    uint32_t useconds = now.tv_usec;
-    rtc_port_base[0] = seconds * 1000 + (useconds + 500) / 1000;
+    uint64_t us = now.tv_sec * 1000000ull + now.tv_usec + skipped_us;
+    rtc_port_base[0] = replay_rtc((us + 500) / 1000);
   }
 }
 
@@ -5,6 +5,7 @@
 #include "device/mmio.h"
 #include "device/port-io.h"
 #include <SDL2/SDL.h>
+#include "device/replay.h"
 
 #define VMEM 0x40000
 
@@ -27,14 +28,17 @@ void update_screen() {
 }
 
 void init_vga() {
+  screensize_port_base = add_pio_map(SCREEN_PORT, 4, NULL);
+  *screensize_port_base = ((SCREEN_W) << 16) | (SCREEN_H);
+  vmem = add_mmio_map(VMEM, 0x80000, NULL);
+
+  /* headless when replaying */
+  if (replay_state == REPLAY_PLAY) return;
+
   SDL_Init(SDL_INIT_VIDEO);
   SDL_CreateWindowAndRenderer(SCREEN_W * 2, SCREEN_H * 2, 0, &window, &renderer);
   SDL_SetWindowTitle(window, "NEMU");
   texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
       SDL_TEXTUREACCESS_STATIC, SCREEN_W, SCREEN_H);
-
-  screensize_port_base = add_pio_map(SCREEN_PORT, 4, NULL);
-  *screensize_port_base = ((SCREEN_W) << 16) | (SCREEN_H);
-  vmem = add_mmio_map(VMEM, 0x80000, NULL);
 }
 #endif	/* HAS_IOE */
@@ -0,0 +1,337 @@
+#include "nemu.h"
+#include "memory/cache.h"
+#include "monitor/perfcnt.h"
+#include "monitor/profile.h"
+#include "monitor/symbol.h"
+#include "util/htable.h"
+
+#ifdef CACHE
+
+#include <stdlib.h>
+
+/* A model of L1 instruction cache, L1 data cache and unified L2 cache.
+ * Only tags are modeled, the data always come from pmem. Caches are
+ * write-allocate, and write-backs are not counted. An access to the same
+ * line as the last access of a cache must hit and does not change the
+ * replacement state, so it only bumps the counter.
+ */
+
+enum { L1I, L1D, L2, NR_CACHE };
+
+typedef struct {
+  const char *name;
+  uint32_t size, ways, line_size;
+  int policy;
+
+  uint32_t nr_set, line_shift;
+  uint32_t *tag;      // line address, [nr_set][ways]
+  uint64_t *stamp;    // the time of the last access to a line, for LRU
+  uint32_t *plru;     // tree bits of every set, for PLRU
+  uint64_t clock;
+  uint32_t last_line;
+
+  uint64_t *access, *miss;  // counters in perfcnt[]
+} Cache;
+
+#define INVALID_LINE 0xffffffffu
+
+static Cache caches[NR_CACHE] = {
+  [L1I] = { .name = "l1i", .size = 32 * 1024, .ways = 8, .line_size = 64, .policy = CACHE_LRU },
+  [L1D] = { .name = "l1d", .size = 32 * 1024, .ways = 8, .line_size = 64, .policy = CACHE_LRU },
+  [L2]  = { .name = "l2", .size = 256 * 1024, .ways = 8, .line_size = 64, .policy = CACHE_PLRU },
+};
+
+static const char *policy_name[] = { "lru", "plru", "random" };
+
+/* Per-eip counters for the miss rates of code regions. They are kept in
+ * a sparse page table like the one of the profiler. */
+typedef struct {
+  uint64_t iaccess, imiss, daccess, dmiss, l2miss;
+} EipCnt;
+
+#define CNT_PAGE_SHIFT 12
+#define CNT_PAGE_SIZE (1 << CNT_PAGE_SHIFT)
+#define NR_CNT_PAGE (1 << (32 - CNT_PAGE_SHIFT))
+
+static EipCnt *eip_cnt[NR_CNT_PAGE];
+
+static inline EipCnt* get_eip_cnt(vaddr_t eip) {
+  EipCnt **p = &eip_cnt[eip >> CNT_PAGE_SHIFT];
+  if (*p == NULL) {
+    *p = calloc(CNT_PAGE_SIZE, sizeof(EipCnt));
+    assert(*p != NULL);
+  }
+  return &(*p)[eip & (CNT_PAGE_SIZE - 1)];
+}
+
+static uint32_t seed = 1;
+
+static inline uint32_t cache_rand() {
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static inline bool is_pow2(uint32_t x) { return x != 0 && (x & (x - 1)) == 0; }
+
+static uint32_t parse_size(const char *s) {
+  char *end;
+  uint32_t n = strtoul(s, &end, 0);
+  switch (*end) {
+    case 'k': case 'K': n *= 1024; break;
+    case 'm': case 'M': n *= 1024 * 1024; break;
+  }
+  return n;
+}
+
+/* `spec' is in the form of NAME:SIZE:WAYS:LINE[:POLICY],
+ * e.g. l1d:16K:4:32:plru */
+void cache_config(char *spec) {
+  char *name = strtok(spec, ":");
+  char *size = strtok(NULL, ":");
+  char *ways = strtok(NULL, ":");
+  char *line = strtok(NULL, ":");
+  char *policy = strtok(NULL, ":");
+  Assert(line != NULL, "cache configuration should be NAME:SIZE:WAYS:LINE[:POLICY]");
+
+  int i;
+  for (i = 0; i < NR_CACHE; i ++) {
+    if (strcmp(name, caches[i].name) == 0) break;
+  }
+  Assert(i < NR_CACHE, "no cache named '%s', use l1i, l1d or l2", name);
+
+  Cache *c = &caches[i];
+  c->size = parse_size(size);
+  c->ways = strtoul(ways, NULL, 0);
+  c->line_size = parse_size(line);
+  if (policy != NULL) {
+    int j;
+    for (j = 0; j < sizeof(policy_name) / sizeof(policy_name[0]); j ++) {
+      if (strcmp(policy, policy_name[j]) == 0) break;
+    }
+    Assert(j < sizeof(policy_name) / sizeof(policy_name[0]),
+        "unknown replacement policy '%s', use lru, plru or random", policy);
+    c->policy = j;
+  }
+}
+
+static void cache_init_one(Cache *c, int access_idx, int miss_idx) {
+  Assert(is_pow2(c->line_size) && is_pow2(c->ways) && c->ways <= 32,
+      "%s: the line size and the associativity should be powers of 2", c->name);
+  Assert(c->size % (c->ways * c->line_size) == 0 && is_pow2(c->size / (c->ways * c->line_size)),
+      "%s: the number of sets should be a power of 2", c->name);
+
+  c->nr_set = c->size / (c->ways * c->line_size);
+  c->line_shift = __builtin_ctz(c->line_size);
+  c->tag = malloc(sizeof(uint32_t) * c->nr_set * c->ways);
+  c->stamp = calloc(c->nr_set * c->ways, sizeof(uint64_t));
+  c->plru = calloc(c->nr_set, sizeof(uint32_t));
+  assert(c->tag && c->stamp && c->plru);
+  memset(c->tag, 0xff, sizeof(uint32_t) * c->nr_set * c->ways);
+  c->last_line = INVALID_LINE;
+  c->access = &perfcnt[access_idx];
+  c->miss = &perfcnt[miss_idx];
+
+  Log("Cache %s: %d KB, %d-way, %d-byte lines, %s", c->name, c->size / 1024,
+      c->ways, c->line_size, policy_name[c->policy]);
+}
+
+void init_cache() {
+  cache_init_one(&caches[L1I], PERFCNT_ICACHE_ACCESS, PERFCNT_ICACHE_MISS);
+  cache_init_one(&caches[L1D], PERFCNT_DCACHE_ACCESS, PERFCNT_DCACHE_MISS);
+  cache_init_one(&caches[L2], PERFCNT_L2_ACCESS, PERFCNT_L2_MISS);
+}
+
+/* Walk the PLRU tree of a set. Every node points to the half which is
+ * less recently used. Touching a way makes the nodes on its path point
+ * away from it. */
+static inline void plru_touch(Cache *c, uint32_t set, uint32_t way) {
+  uint32_t bits = c->plru[set];
+  uint32_t node = 1, half = c->ways >> 1;
+  while (half > 0) {
+    bool right = (way & half) != 0;
+    if (right) bits &= ~(1u << node);
+    else bits |= (1u << node);
+    node = node * 2 + right;
+    half >>= 1;
+  }
+  c->plru[set] = bits;
+}
+
+static inline uint32_t plru_victim(Cache *c, uint32_t set) {
+  uint32_t bits = c->plru[set];
+  uint32_t node = 1, way = 0, half = c->ways >> 1;
+  while (half > 0) {
+    bool right = (bits >> node) & 1;
+    if (right) way |= half;
+    node = node * 2 + right;
+    half >>= 1;
+  }
+  return way;
+}
+
+/* return true if `line' hits in `c' */
+static bool cache_lookup(Cache *c, uint32_t line) {
+  (*c->access) ++;
+  if (line == c->last_line) return true;
+  c->last_line = line;
+
+  uint32_t set = line & (c->nr_set - 1);
+  uint32_t *tag = &c->tag[set * c->ways];
+  uint32_t way;
+  bool hit = false;
+  for (way = 0; way < c->ways; way ++) {
+    if (tag[way] == line) { hit = true; break; }
+  }
+
+  if (!hit) {
+    (*c->miss) ++;
+    switch (c->policy) {
+      case CACHE_LRU: {
+        uint64_t *stamp = &c->stamp[set * c->ways];
+        uint32_t i;
+        way = 0;
+        for (i = 0; i < c->ways; i ++) {
+          if (tag[i] == INVALID_LINE) { way = i; break; }
+          if (stamp[i] < stamp[way]) way = i;
+        }
+        break;
+      }
+      case CACHE_PLRU: way = plru_victim(c, set); break;
+      default: way = cache_rand() & (c->ways - 1); break;
+    }
+    tag[way] = line;
+  }
+
+  switch (c->policy) {
+    case CACHE_LRU: c->stamp[set * c->ways + way] = ++ c->clock; break;
+    case CACHE_PLRU: plru_touch(c, set, way); break;
+  }
+  return hit;
+}
+
+/* access L2 after a miss in L1, and charge the penalty */
+static inline bool l2_access(vaddr_t addr) {
+  Cache *c = &caches[L2];
+  bool hit = cache_lookup(c, addr >> c->line_shift);
+  perfcnt[PERFCNT_CYCLE] += (hit ? CACHE_L2_LATENCY : CACHE_MEM_LATENCY);
+  return hit;
+}
+
+static inline void l1_access(int idx, vaddr_t addr, int len, EipCnt *cnt) {
+  Cache *c = &caches[idx];
+  uint32_t line = addr >> c->line_shift;
+  uint32_t last = (addr + len - 1) >> c->line_shift;
+  for (; line <= last; line ++) {
+    bool hit = cache_lookup(c, line);
+    if (idx == L1I) cnt->iaccess ++;
+    else cnt->daccess ++;
+    if (!hit) {
+      if (idx == L1I) cnt->imiss ++;
+      else cnt->dmiss ++;
+      if (!l2_access(line << c->line_shift)) cnt->l2miss ++;
+    }
+  }
+}
+
+void cache_ifetch(vaddr_t eip, vaddr_t seq_eip) {
+  l1_access(L1I, eip, seq_eip - eip, get_eip_cnt(eip));
+}
+
+void cache_daccess(vaddr_t addr, int len, bool is_write) {
+  /* the eip is updated after the instruction is executed */
+  l1_access(L1D, addr, len, get_eip_cnt(cpu.eip));
+}
+
+/* ------------------------------- report ------------------------------- */
+
+typedef struct {
+  vaddr_t start;
+  EipCnt cnt;
+  uint64_t nr_miss;
+} Region;
+
+static int cmp_region(const void *a, const void *b) {
+  const Region *x = a, *y = b;
+  if (x->nr_miss != y->nr_miss) { return (x->nr_miss < y->nr_miss ? 1 : -1); }
+  return (x->start < y->start ? -1 : x->start > y->start);
+}
+
+static inline double rate(uint64_t miss, uint64_t access) {
+  return (access == 0 ? 0 : 100.0 * miss / access);
+}
+
+/* Code regions are functions if symbols are loaded, or 4KB pages. */
+static void report_regions() {
+  HTable index;
+  htable_init(&index, 1024);
+  Region *regions = NULL;
+  uint32_t nr_region = 0, max_region = 0;
+
+  int i, j;
+  for (i = 0; i < NR_CNT_PAGE; i ++) {
+    if (eip_cnt[i] == NULL) continue;
+    for (j = 0; j < CNT_PAGE_SIZE; j ++) {
+      EipCnt *e = &eip_cnt[i][j];
+      if (e->iaccess == 0 && e->daccess == 0) continue;
+
+      vaddr_t start = ((vaddr_t)i << CNT_PAGE_SHIFT) | j;
+      if (symbol_find(start, &start) == NULL) { start &= ~(CNT_PAGE_SIZE - 1); }
+      uint32_t *idx = htable_get(&index, start);
+      if (*idx == HTABLE_EMPTY) {
+        if (nr_region == max_region) {
+          max_region = (max_region == 0 ? 256 : max_region * 2);
+          regions = realloc(regions, sizeof(Region) * max_region);
+          assert(regions != NULL);
+        }
+        regions[nr_region] = (Region) { .start = start };
+        *idx = nr_region ++;
+      }
+      Region *r = &regions[*idx];
+      r->cnt.iaccess += e->iaccess;
+      r->cnt.imiss += e->imiss;
+      r->cnt.daccess += e->daccess;
+      r->cnt.dmiss += e->dmiss;
+      r->cnt.l2miss += e->l2miss;
+      r->nr_miss += e->imiss + e->dmiss;
+    }
+  }
+
+  qsort(regions, nr_region, sizeof(Region), cmp_region);
+  char buf[SYM_STR_SIZE];
+  printflog("Top %d code regions by L1 misses:\n", PROFILE_TOP_N);
+  printflog("  %-32s %12s %7s %12s %7s %12s\n", "region", "l1i miss", "rate",
+      "l1d miss", "rate", "l2 miss");
+  for (i = 0; i < nr_region && i < PROFILE_TOP_N; i ++) {
+    EipCnt *c = &regions[i].cnt;
+    printflog("  %-32s %12lu %6.2f%% %12lu %6.2f%% %12lu\n", symbol_name(regions[i].start, buf),
+        c->imiss, rate(c->imiss, c->iaccess), c->dmiss, rate(c->dmiss, c->daccess), c->l2miss);
+  }
+
+  free(regions);
+  htable_free(&index);
+}
+
+void cache_report() {
+  printflog("==================== cache ====================\n");
+  printflog("  %-5s %14s %14s %7s\n", "cache", "access", "miss", "rate");
+  int i;
+  for (i = 0; i < NR_CACHE; i ++) {
+    Cache *c = &caches[i];
+    printflog("  %-5s %14lu %14lu %6.2f%%\n", c->name, *c->access, *c->miss,
+        rate(*c->miss, *c->access));
+  }
+  report_regions();
+}
+
+#else
+
+void init_cache() {
+}
+
+void cache_config(char *spec) {
+  Log("Cache simulator is not enabled, define CACHE in include/common.h to enable it");
+}
+
+#endif
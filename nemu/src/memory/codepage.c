@@ -0,0 +1,74 @@
+#include "nemu.h"
+#include "memory/codepage.h"
+
+#include <stdlib.h>
+
+/* The code-page tracker. A component which caches the contents of a
+ * physical page, such as decoded instructions or the gates of the IDT,
+ * marks the page. Every write to the physical memory checks the mark of
+ * its pages, so the unmarked pages cost one load. A write to a marked
+ * page clears the mark, bumps the generation of the page, and calls the
+ * invalidation callbacks with the page. The page is marked again when
+ * something is cached from it.
+ *
+ * A component can either register a callback to drop its entries of the
+ * page, or keep the generation with its entries, and check it before an
+ * entry is used.
+ *
+ * Besides the stores of the guest, the writes which bypass paddr_write()
+ * are covered: bulk writes through vaddr_host_range(), dma_write() of
+ * devices, difftest_memcpy_from_dut() of the reference, the undo log of
+ * DiffTest, reverse execution and snapshots.
+ */
+
+uint8_t *code_page = NULL;
+uint32_t nr_code_page = 0;
+static uint32_t *page_gen = NULL;
+
+static void (*callbacks[NR_CODEPAGE_CALLBACK])(paddr_t);
+static int nr_callback = 0;
+
+void init_codepage(uint32_t size) {
+  nr_code_page = size / PAGE_SIZE;
+  free(code_page);
+  free(page_gen);
+  code_page = calloc(nr_code_page, sizeof(code_page[0]));
+  page_gen = calloc(nr_code_page, sizeof(page_gen[0]));
+  assert(code_page != NULL && page_gen != NULL);
+}
+
+void codepage_mark(paddr_t addr) {
+  assert(addr / PAGE_SIZE < nr_code_page);
+  code_page[addr / PAGE_SIZE] = true;
+}
+
+uint32_t codepage_gen(paddr_t addr) {
+  assert(addr / PAGE_SIZE < nr_code_page);
+  return page_gen[addr / PAGE_SIZE];
+}
+
+void codepage_add_callback(void (*callback)(paddr_t page)) {
+  int i;
+  for (i = 0; i < nr_callback; i ++) {
+    if (callbacks[i] == callback) return;
+  }
+  Assert(nr_callback < NR_CODEPAGE_CALLBACK, "too many callbacks of code pages");
+  callbacks[nr_callback ++] = callback;
+}
+
+/* the slow path of codepage_write() */
+void codepage_invalidate(paddr_t page) {
+  uint32_t idx = page / PAGE_SIZE;
+  code_page[idx] = false;
+  page_gen[idx] ++;
+  int i;
+  for (i = 0; i < nr_callback; i ++) { callbacks[i](idx * PAGE_SIZE); }
+}
+
+/* the whole memory is replaced, such as by loading a snapshot */
+void codepage_invalidate_all() {
+  uint32_t i;
+  for (i = 0; i < nr_code_page; i ++) {
+    if (code_page[i]) { codepage_invalidate(i * PAGE_SIZE); }
+  }
+}
@@ -1,13 +1,106 @@
 #include "nemu.h"
-
-#define PMEM_SIZE (128 * 1024 * 1024)
+#include "device/mmio.h"
+#include "memory/codepage.h"
+#include <sys/mman.h>
 
 #define pmem_rw(addr, type) *(type *)({\
-    Assert(addr < PMEM_SIZE, "physical address(0x%08x) is out of bound", addr); \
+    Assert(addr < pmem_size, "physical address(0x%08x) is out of bound", addr); \
     guest_to_host(addr); \
     })
 
-uint8_t pmem[PMEM_SIZE];
+uint8_t *pmem = NULL;
+uint32_t pmem_size = 0;
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* The physical memory is an anonymous mapping, so the host gives a page
+ * only when it is touched for the first time, and it is zero then. Huge
+ * pages make the TLB of the host cover much more of the guest memory. The
+ * reserved huge pages of hugetlbfs are tried first, and then the normal
+ * pages, which the kernel may merge into transparent huge pages. */
+void init_pmem(uint32_t size) {
+  Assert(size > 0 && size <= PMEM_MAX_SIZE && size % PAGE_SIZE == 0,
+      "the size of the physical memory should be a multiple of %d bytes, and at most %u MB",
+      PAGE_SIZE, PMEM_MAX_SIZE >> 20);
+  const char *backing = "normal pages";
+  void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  /* without MAP_NORESERVE, mmap() fails if there are not enough huge pages,
+   * instead of the guest getting SIGBUS later */
+  if (size % HUGE_PAGE_SIZE == 0) {
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) { backing = "hugetlbfs pages"; }
+  }
+#endif
+  if (p == MAP_FAILED) {
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    Assert(p != MAP_FAILED, "Can not allocate %u MB for the physical memory", size >> 20);
+#ifdef MADV_HUGEPAGE
+    if (madvise(p, size, MADV_HUGEPAGE) == 0) { backing = "transparent huge pages"; }
+#endif
+  }
+  pmem = p;
+  pmem_size = size;
+  init_codepage(size);
+  Log("Physical memory: %u MB, backed by %s", size >> 20, backing);
+}
+
+/* Zero [addr, addr + len) of the physical memory. The whole pages in it
+ * are given back to the host, so they cost nothing until touched again. */
+void pmem_zero(paddr_t addr, uint32_t len) {
+  assert((uint64_t)addr + len <= pmem_size);
+  codepage_write(addr, len);
+  uint8_t *start = guest_to_host(addr), *end = start + len;
+  uint8_t *lo = (uint8_t *)(((uintptr_t)start + PAGE_SIZE - 1) & ~(uintptr_t)(PAGE_SIZE - 1));
+  uint8_t *hi = (uint8_t *)((uintptr_t)end & ~(uintptr_t)(PAGE_SIZE - 1));
+  if (lo >= hi || madvise(lo, hi - lo, MADV_DONTNEED) != 0) {
+    /* huge pages can only be dropped as a whole */
+    memset(start, 0, len);
+    return;
+  }
+  memset(start, 0, lo - start);
+  memset(hi, 0, end - hi);
+}
+
+/* the number of stores, except those near the stack pointer, which tell
+ * a guest spinning on the RTC from one making progress */
+#define SPIN_STACK 4096
+uint64_t nr_nonstack_store = 0;
+
+/* Devices which write the physical memory directly (DMA) go through
+ * here, so the writes are seen by the code-page tracker, reverse
+ * execution and DiffTest. dma_write_begin() returns where to write at
+ * most `len' bytes at `addr', and dma_write_end() is called with the
+ * number of bytes written, so a device can fill the memory in place,
+ * such as by read(). */
+uint8_t *dma_write_begin(paddr_t addr, uint32_t len) {
+  Assert((uint64_t)addr + len <= pmem_size, "DMA to [0x%08x, 0x%08x) is out of bound", addr, addr + len);
+#ifdef DIFF_TEST
+  void difftest_mem_write(paddr_t addr, int len);
+  uint32_t i;
+  for (i = 0; i < len; i += 4) {
+    difftest_mem_write(addr + i, (len - i < 4 ? len - i : 4));
+  }
+#endif
+#ifdef REVERSE
+  void checkpoint_mem_write(paddr_t addr, int len);
+  checkpoint_mem_write(addr, len);
+#endif
+  codepage_write(addr, len);
+  return guest_to_host(addr);
+}
+
+void dma_write_end(paddr_t addr, uint32_t len) {
+#ifdef DIFF_TEST
+  void difftest_dma_write(paddr_t addr, uint32_t len);
+  difftest_dma_write(addr, len);
+#endif
+}
+
+void dma_write(paddr_t addr, const void *src, uint32_t len) {
+  memcpy(dma_write_begin(addr, len), src, len);
+  dma_write_end(addr, len);
+}
 
 /* Memory accessing interfaces */
 
@@ -16,6 +109,20 @@ uint32_t paddr_read(paddr_t addr, int len) {
 }
 
 void paddr_write(paddr_t addr, uint32_t data, int len) {
+  /* checked before the trackers below index their arrays with it */
+  Assert(addr < pmem_size, "physical address(0x%08x) is out of bound", addr);
+#ifdef HAS_IOE
+  if (addr - cpu.esp + SPIN_STACK >= 2 * SPIN_STACK) { nr_nonstack_store ++; }
+#endif
+#ifdef DIFF_TEST
+  void difftest_mem_write(paddr_t addr, int len);
+  difftest_mem_write(addr, len);
+#endif
+#ifdef REVERSE
+  void checkpoint_mem_write(paddr_t addr, int len);
+  checkpoint_mem_write(addr, len);
+#endif
+  codepage_write(addr, len);
   memcpy(guest_to_host(addr), &data, len);
 }
 
@@ -26,3 +133,35 @@ uint32_t vaddr_read(vaddr_t addr, int len) {
 void vaddr_write(vaddr_t addr, uint32_t data, int len) {
   paddr_write(addr, data, len);
 }
+
+/* Return the host address of [addr, addr + len) to access it in bulk, or
+ * NULL if it should be accessed one by one with vaddr_read()/vaddr_write().
+ * That is the case if the range is not all plain RAM, or if paging is
+ * enabled, since then the pages in the range may be mapped differently.
+ * For a write, the hooks of paddr_write() are called for the whole range.
+ */
+void* vaddr_host_range(vaddr_t addr, uint32_t len, bool is_write) {
+  if (cpu.cr0.paging || (uint64_t)addr + len > pmem_size || is_mmio_range(addr, len)) {
+    return NULL;
+  }
+
+  if (is_write) {
+#ifdef HAS_IOE
+    nr_nonstack_store ++;
+#endif
+#ifdef DIFF_TEST
+    /* the undo log of diff-test keeps at most 4 bytes for each write */
+    void difftest_mem_write(paddr_t addr, int len);
+    uint32_t i;
+    for (i = 0; i < len; i += 4) {
+      difftest_mem_write(addr + i, (len - i < 4 ? len - i : 4));
+    }
+#endif
+#ifdef REVERSE
+    void checkpoint_mem_write(paddr_t addr, int len);
+    checkpoint_mem_write(addr, len);
+#endif
+    codepage_write(addr, len);
+  }
+  return guest_to_host(addr);
+}
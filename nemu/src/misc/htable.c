@@ -0,0 +1,71 @@
+#include "util/htable.h"
+#include <stdlib.h>
+
+static inline uint32_t hash64(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  return (uint32_t)key;
+}
+
+void htable_init(HTable *t, uint32_t size) {
+  assert((size & (size - 1)) == 0);
+  t->key = malloc(sizeof(t->key[0]) * size);
+  t->val = malloc(sizeof(t->val[0]) * size);
+  assert(t->key != NULL && t->val != NULL);
+  memset(t->val, 0xff, sizeof(t->val[0]) * size);
+  t->size = size;
+  t->used = 0;
+}
+
+void htable_free(HTable *t) {
+  free(t->key);
+  free(t->val);
+  t->key = NULL;
+  t->val = NULL;
+  t->size = t->used = 0;
+}
+
+static inline uint32_t lookup(HTable *t, uint64_t key) {
+  uint32_t mask = t->size - 1;
+  uint32_t idx = hash64(key) & mask;
+  while (t->val[idx] != HTABLE_EMPTY && t->key[idx] != key) {
+    idx = (idx + 1) & mask;
+  }
+  return idx;
+}
+
+static void grow(HTable *t) {
+  HTable old = *t;
+  htable_init(t, old.size * 2);
+  int i;
+  for (i = 0; i < old.size; i ++) {
+    if (old.val[i] != HTABLE_EMPTY) {
+      uint32_t idx = lookup(t, old.key[i]);
+      t->key[idx] = old.key[i];
+      t->val[idx] = old.val[i];
+    }
+  }
+  t->used = old.used;
+  htable_free(&old);
+}
+
+/* return the value of `key', or HTABLE_EMPTY if it does not exist */
+uint32_t htable_find(HTable *t, uint64_t key) {
+  return t->val[lookup(t, key)];
+}
+
+/* Return the slot of `key', and create it if it does not exist. The slot
+ * of a new key holds HTABLE_EMPTY, and the caller should fill it. The
+ * pointer is only valid until the next call of htable_get().
+ */
+uint32_t* htable_get(HTable *t, uint64_t key) {
+  if (t->used * 4 >= t->size * 3) { grow(t); }
+
+  uint32_t idx = lookup(t, key);
+  if (t->val[idx] == HTABLE_EMPTY) {
+    t->key[idx] = key;
+    t->used ++;
+  }
+  return &t->val[idx];
+}
@@ -1,6 +1,10 @@
 #include "nemu.h"
+#include "cpu/decode.h"
 #include "monitor/monitor.h"
 #include "monitor/watchpoint.h"
+#include "monitor/profile.h"
+#include "monitor/reverse.h"
+#include "cpu/vcpu.h"
 
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
@@ -19,8 +23,45 @@ void nr_guest_instr_add(uint32_t n) {
   g_nr_guest_instr += n;
 }
 
+uint64_t get_nr_guest_instr() {
+  return g_nr_guest_instr;
+}
+
+void nr_guest_instr_set(uint64_t n) {
+  g_nr_guest_instr = n;
+}
+
 void monitor_statistic() {
   Log("total guest instructions = %ld", g_nr_guest_instr);
+
+#ifdef SAMPLE
+  sample_report();
+#endif
+
+#ifdef PROFILE
+  void profile_report();
+  profile_report();
+#endif
+
+#ifdef FTRACE
+  void ftrace_report();
+  ftrace_report();
+#endif
+
+#ifdef CACHE
+  void cache_report();
+  cache_report();
+#endif
+
+#ifdef BPRED
+  void bpred_report();
+  bpred_report();
+#endif
+
+#ifdef SIMPOINT
+  fastfwd_report();
+  bbv_report();
+#endif
 }
 
 /* Simulate how the CPU works. */
@@ -37,7 +78,27 @@ void cpu_exec(uint64_t n) {
     /* Execute one instruction, including instruction fetch,
      * instruction decode, and the actual execution. */
     exec_wrapper(print_flag);
-    nr_guest_instr_add(1);
+    if (decoding.is_restart) {
+      /* a string instruction has only run a chunk, and the next one is
+       * still the same instruction */
+      n ++;
+    }
+    else {
+      nr_guest_instr_add(1);
+
+#ifdef SAMPLE
+      if (-- sample_countdown == 0) { sample_take(); }
+#endif
+#ifdef SIMPOINT
+      if (-- ff_countdown == 0) { fastfwd_switch(); }
+#endif
+#ifdef MULTI_CPU
+      if (-- vcpu_countdown == 0) { vcpu_switch(); }
+#endif
+#ifdef REVERSE
+      if (-- checkpoint_countdown == 0) { checkpoint_take(); }
+#endif
+    }
 
 #ifdef DEBUG
     /* TODO: check watchpoints here. */
@@ -62,6 +123,8 @@ void cpu_exec(uint64_t n) {
       }
       else if (nemu_state == NEMU_ABORT) {
         printflog("\33[1;31mnemu: ABORT\33[0m at eip = 0x%08x\n\n", cpu.eip);
+        void itrace_dump();
+        itrace_dump();
         return;
       }
     }
@@ -1,4 +1,5 @@
 #include "nemu.h"
+#include "monitor/symbol.h"
 
 /* We use the POSIX regex functions to process regular expressions.
  * Type 'man regex' for more information about POSIX regex functions.
@@ -11,7 +12,7 @@ enum {
 
   /* TODO: Add more token types */
   TK_ADD, TK_SUB, TK_MUL, TK_DIV,
-  TK_REG, TK_DEC, TK_HEX, TK_LP, TK_RP,
+  TK_REG, TK_DEC, TK_HEX, TK_LP, TK_RP, TK_SYM,
   DEREF
 };
 
@@ -32,6 +33,7 @@ static struct rule {
   {"\\$[a-zA-Z]+", TK_REG},
   {"0[xX][0-9a-fA-F]+", TK_HEX},
   {"-?[0-9]+", TK_DEC},
+  {"[a-zA-Z_][a-zA-Z0-9_.]*", TK_SYM},  // symbol loaded from ELF files
   {"-", TK_SUB},
   {"\\*", TK_MUL},
   {"/", TK_DIV},
@@ -152,6 +154,15 @@ static bool make_token(char *e) {
                 strncpy(tokens[nr_token].str, substr_start, substr_len);
                 ++nr_token;
                 break;
+            case TK_SYM:
+                if (substr_len >= sizeof(tokens[nr_token].str)) {
+                    printf("make_token: symbol is too long.\n");
+                    return false;
+                }
+                tokens[nr_token].type = TK_SYM;
+                strncpy(tokens[nr_token].str, substr_start, substr_len);
+                ++nr_token;
+                break;
             case TK_NOTYPE:
                 break;
             default:
@@ -287,6 +298,14 @@ uint32_t eval(int p, int q) {
             printf("eval: wrong register name. \n");
             BAD_EXPRESSION_SIGNAL = true;
             return 0;
+        } else if (tokens[p].type == TK_SYM) {
+            vaddr_t addr;
+            if (symbol_addr(tokens[p].str, &addr)) {
+                return addr;
+            }
+            printf("eval: no symbol named '%s'. \n", tokens[p].str);
+            BAD_EXPRESSION_SIGNAL = true;
+            return 0;
         } else {
             printf("eval: wrong base type. \n");
             BAD_EXPRESSION_SIGNAL = true;
@@ -0,0 +1,57 @@
+#include "nemu.h"
+#include "monitor/symbol.h"
+#include "cpu/decode.h"
+
+#ifdef DEBUG
+
+/* A ring buffer of the most recently executed instructions. It is
+ * dumped when the guest program aborts, so that the instructions
+ * leading to the failure can be seen without the log file. Only the
+ * eip and the bytes are kept for every instruction, and they are
+ * formatted when the ring is dumped. The assembly is only known for
+ * the last one, which is still in `decoding'.
+ */
+
+#define NR_ITRACE 16
+
+static struct {
+  vaddr_t eip;
+  int len;
+  uint8_t bytes[16];
+} iring[NR_ITRACE];
+static int iring_idx = 0;
+static int iring_nr = 0;
+
+void itrace_push(vaddr_t eip, const uint8_t *bytes, int len) {
+  iring[iring_idx].eip = eip;
+  iring[iring_idx].len = len;
+  memcpy(iring[iring_idx].bytes, bytes, sizeof(iring[iring_idx].bytes));
+  iring_idx = (iring_idx + 1) % NR_ITRACE;
+  if (iring_nr < NR_ITRACE) iring_nr ++;
+}
+
+void itrace_dump() {
+  int i, j;
+  printflog("Recently executed instructions:\n");
+  for (i = iring_nr; i > 0; i --) {
+    int idx = (iring_idx - i + NR_ITRACE) % NR_ITRACE;
+    if (i == 1) { printflog("--> %s", decoding.asm_buf); }
+    else {
+      printflog("    %8x:   ", iring[idx].eip);
+      for (j = 0; j < iring[idx].len; j ++) {
+        printflog("%02x ", iring[idx].bytes[j]);
+      }
+    }
+    vaddr_t start;
+    const char *name = symbol_find(iring[idx].eip, &start);
+    if (name != NULL) { printflog("    <%s+0x%x>", name, iring[idx].eip - start); }
+    printflog("\n");
+  }
+}
+
+#else
+
+void itrace_dump() {
+}
+
+#endif
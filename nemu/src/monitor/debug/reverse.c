@@ -0,0 +1,431 @@
+#include "nemu.h"
+#include "cpu/decode.h"
+#include "monitor/monitor.h"
+#include "monitor/perfcnt.h"
+#include "monitor/reverse.h"
+#include "memory/codepage.h"
+#include "monitor/snapshot.h"
+#include "monitor/watchpoint.h"
+#include "cpu/vcpu.h"
+#include "device/mmio.h"
+
+uint64_t checkpoint_countdown = -1ull;
+
+#ifdef REVERSE
+
+#include <stdlib.h>
+
+/* Reverse execution. A checkpoint is taken every `interval' instructions.
+ * It keeps the registers and the state of devices, and the contents of
+ * the pages of the physical memory at the time of the checkpoint, but
+ * only for the pages written before the next checkpoint (they are saved
+ * on the first write). To go back to a checkpoint, the saved pages of it
+ * and all later checkpoints are written back, from the latest one.
+ *
+ * Going back to an arbitrary instruction restores the nearest earlier
+ * checkpoint, then executes forward. This is deterministic as long as the
+ * inputs of devices are replayed with `--replay'.
+ *
+ * The space of MMIO, such as the VGA memory, is saved on the first write
+ * like the physical memory, as pages after those of the memory. The other
+ * devices are small, and are saved in every checkpoint.
+ *
+ * When the checkpoints use more memory than the budget, one of them is
+ * merged into its predecessor. The one whose neighbours are the closest
+ * relative to its age is chosen, so the checkpoints become exponentially
+ * sparser into the past.
+ */
+
+typedef struct {
+  uint32_t page;  // the memory, then the MMIO space, see page_host()
+  uint8_t *data;
+} SavedPage;
+
+typedef struct {
+  uint32_t seq;
+  uint64_t instr;
+  CPU_state cpu;
+  uint64_t perfcnt[NR_PERFCNT];
+  char *dev;
+  size_t dev_len;
+  SavedPage *pages;
+  uint32_t nr_page, max_page;
+} Checkpoint;
+
+static uint64_t interval = CHECKPOINT_INTERVAL;
+static size_t budget = (size_t)CHECKPOINT_BUDGET_MB << 20;
+static size_t used = 0;
+
+static Checkpoint **ckpts = NULL;
+static int nr_ckpt = 0, max_ckpt = 0;
+static uint32_t seq = 0;
+
+static uint32_t nr_pmem_page = 0, nr_page = 0;
+
+/* the checkpoint in which the page is saved, 0 for none */
+static uint32_t *page_seq = NULL;
+/* whether the page is saved in the previous checkpoint, used by merge() */
+static uint8_t *in_prev = NULL;
+
+uint64_t get_nr_guest_instr();
+void nr_guest_instr_set(uint64_t n);
+void exec_wrapper(bool);
+void nr_guest_instr_add(uint32_t);
+
+static inline uint8_t* page_host(uint32_t page) {
+  return (page < nr_pmem_page ? guest_to_host(page * PAGE_SIZE) :
+      mmio_pool() + (page - nr_pmem_page) * PAGE_SIZE);
+}
+
+static void save_devices(Checkpoint *c) {
+  Snapshot s = { .fp = open_memstream(&c->dev, &c->dev_len), .is_save = true, .ok = true };
+  assert(s.fp != NULL);
+  pio_snapshot_maps(&s);
+  i8042_snapshot(&s);
+  replay_snapshot(&s);
+  vcpu_snapshot(&s);
+  fclose(s.fp);
+  assert(s.ok);
+}
+
+static void load_devices(Checkpoint *c) {
+  Snapshot s = { .fp = fmemopen(c->dev, c->dev_len, "rb"), .is_save = false, .ok = true };
+  assert(s.fp != NULL);
+  pio_snapshot_maps(&s);
+  i8042_snapshot(&s);
+  replay_snapshot(&s);
+  vcpu_snapshot(&s);
+  fclose(s.fp);
+  assert(s.ok);
+}
+
+static void free_checkpoint(Checkpoint *c) {
+  uint32_t i;
+  for (i = 0; i < c->nr_page; i ++) { free(c->pages[i].data); }
+  used -= c->nr_page * PAGE_SIZE + c->dev_len;
+  free(c->pages);
+  free(c->dev);
+  free(c);
+}
+
+static void add_page(Checkpoint *c, uint32_t page, uint8_t *data) {
+  if (c->nr_page == c->max_page) {
+    c->max_page = (c->max_page == 0 ? 64 : c->max_page * 2);
+    c->pages = realloc(c->pages, sizeof(SavedPage) * c->max_page);
+    assert(c->pages != NULL);
+  }
+  c->pages[c->nr_page ++] = (SavedPage) { .page = page, .data = data };
+}
+
+/* merge checkpoint `i' into checkpoint `i - 1' */
+static void merge(int i) {
+  Checkpoint *prev = ckpts[i - 1], *c = ckpts[i];
+  uint32_t j;
+  for (j = 0; j < prev->nr_page; j ++) { in_prev[prev->pages[j].page] = true; }
+
+  /* a page not written between the two checkpoints has the same content
+   * at the time of both of them */
+  for (j = 0; j < c->nr_page; j ++) {
+    SavedPage *p = &c->pages[j];
+    if (!in_prev[p->page]) {
+      add_page(prev, p->page, p->data);
+      p->data = NULL;
+    }
+  }
+  for (j = 0; j < prev->nr_page; j ++) { in_prev[prev->pages[j].page] = false; }
+
+  /* pages moved to `prev' are not freed */
+  uint32_t k = 0;
+  for (j = 0; j < c->nr_page; j ++) {
+    if (c->pages[j].data != NULL) { c->pages[k ++] = c->pages[j]; }
+  }
+  c->nr_page = k;
+
+  free_checkpoint(c);
+  memmove(&ckpts[i], &ckpts[i + 1], sizeof(ckpts[0]) * (nr_ckpt - i - 1));
+  nr_ckpt --;
+}
+
+static void thin() {
+  uint64_t now = get_nr_guest_instr();
+  while (used > budget && nr_ckpt > 2) {
+    int i, victim = 1;
+    double best = 0;
+    for (i = 1; i < nr_ckpt - 1; i ++) {
+      double gap = ckpts[i + 1]->instr - ckpts[i - 1]->instr;
+      double age = now - ckpts[i + 1]->instr + 1;
+      if (i == 1 || gap / age < best) {
+        best = gap / age;
+        victim = i;
+      }
+    }
+    merge(victim);
+  }
+  if (used > budget && nr_ckpt == 2) {
+    /* no way to go back beyond the latest one */
+    free_checkpoint(ckpts[0]);
+    ckpts[0] = ckpts[1];
+    nr_ckpt = 1;
+  }
+}
+
+void checkpoint_take() {
+  checkpoint_countdown = interval;
+
+  Checkpoint *c = calloc(1, sizeof(Checkpoint));
+  assert(c != NULL);
+  c->seq = ++ seq;
+  c->instr = get_nr_guest_instr();
+  c->cpu = cpu;
+  memcpy(c->perfcnt, perfcnt, sizeof(perfcnt));
+  save_devices(c);
+  used += c->dev_len;
+
+  if (nr_ckpt == max_ckpt) {
+    max_ckpt = (max_ckpt == 0 ? 64 : max_ckpt * 2);
+    ckpts = realloc(ckpts, sizeof(ckpts[0]) * max_ckpt);
+    assert(ckpts != NULL);
+  }
+  ckpts[nr_ckpt ++] = c;
+
+  thin();
+}
+
+/* save pages [page, last] in the latest checkpoint if they are not yet */
+static void save_pages(uint32_t page, uint32_t last) {
+  if (nr_ckpt == 0) return;
+  Checkpoint *c = ckpts[nr_ckpt - 1];
+  for (; page <= last; page ++) {
+    if (page_seq[page] != c->seq) {
+      page_seq[page] = c->seq;
+      uint8_t *data = malloc(PAGE_SIZE);
+      assert(data != NULL);
+      memcpy(data, page_host(page), PAGE_SIZE);
+      add_page(c, page, data);
+      used += PAGE_SIZE;
+    }
+  }
+}
+
+/* called by paddr_write() before `len' bytes at `addr' are written */
+void checkpoint_mem_write(paddr_t addr, int len) {
+  save_pages(addr / PAGE_SIZE, (addr + len - 1) / PAGE_SIZE);
+}
+
+/* called by mmio_write() before `len' bytes at `offset' of the MMIO space are written */
+void checkpoint_mmio_write(uint32_t offset, int len) {
+  save_pages(nr_pmem_page + offset / PAGE_SIZE, nr_pmem_page + (offset + len - 1) / PAGE_SIZE);
+}
+
+/* go back to checkpoint `k', and drop the later ones */
+static void restore(int k) {
+  int i;
+  uint32_t j;
+  for (i = nr_ckpt - 1; i >= k; i --) {
+    Checkpoint *c = ckpts[i];
+    for (j = 0; j < c->nr_page; j ++) {
+      uint32_t page = c->pages[j].page;
+      if (page < nr_pmem_page) { codepage_write(page * PAGE_SIZE, PAGE_SIZE); }
+      memcpy(page_host(page), c->pages[j].data, PAGE_SIZE);
+    }
+  }
+  for (i = nr_ckpt - 1; i > k; i --) { free_checkpoint(ckpts[i]); }
+  nr_ckpt = k + 1;
+
+  Checkpoint *c = ckpts[k];
+  for (j = 0; j < c->nr_page; j ++) { page_seq[c->pages[j].page] = c->seq; }
+  cpu = c->cpu;
+  nr_guest_instr_set(c->instr);
+  memcpy(perfcnt, c->perfcnt, sizeof(perfcnt));
+  load_devices(c);
+  nemu_state = NEMU_STOP;
+}
+
+/* execute forward silently until `target' instructions are executed */
+static void run_to(uint64_t target) {
+  nemu_state = NEMU_RUNNING;
+  while (get_nr_guest_instr() < target && nemu_state == NEMU_RUNNING) {
+    exec_wrapper(false);
+    if (!decoding.is_restart) {
+      nr_guest_instr_add(1);
+#ifdef MULTI_CPU
+      if (-- vcpu_countdown == 0) { vcpu_switch(); }
+#endif
+    }
+#ifdef HAS_IOE
+    void device_update();
+    device_update();
+#endif
+  }
+  if (nemu_state == NEMU_RUNNING) { nemu_state = NEMU_STOP; }
+
+  uint64_t next = ckpts[nr_ckpt - 1]->instr + interval;
+  checkpoint_countdown = (next > target ? next - target : 1);
+}
+
+/* restore the latest checkpoint not after `target', return its index */
+static int restore_before(uint64_t target) {
+  int k = nr_ckpt - 1;
+  while (k > 0 && ckpts[k]->instr > target) k --;
+  restore(k);
+  return k;
+}
+
+static void go_to(uint64_t target) {
+  restore_before(target);
+  if (get_nr_guest_instr() > target) {
+    printf("Can not go back beyond the oldest checkpoint\n");
+  }
+  else {
+    run_to(target);
+  }
+  wp_refresh();
+  printf("Back to instruction %lu, eip = 0x%08x\n", get_nr_guest_instr(), cpu.eip);
+}
+
+/* The reference of DiffTest does not go back, so it is detached while
+ * the instructions are executed again, and synchronized at the end. */
+static inline void difftest_detach() {
+#ifdef DIFF_TEST
+  void difftest_set_detached(bool);
+  difftest_set_detached(true);
+#endif
+}
+
+static inline void difftest_attach() {
+#ifdef DIFF_TEST
+  void difftest_set_detached(bool);
+  void difftest_sync();
+  difftest_set_detached(false);
+  difftest_sync();
+#endif
+}
+
+void reverse_step(uint64_t n) {
+  if (nr_ckpt == 0) {
+    printf("Reverse execution is not enabled, use `--checkpoint' to enable it\n");
+    return;
+  }
+  uint64_t now = get_nr_guest_instr();
+  difftest_detach();
+  go_to(now > n ? now - n : 0);
+  difftest_attach();
+}
+
+/* Go back to the latest instruction which changes a watch point. Each
+ * interval between checkpoints is executed again from the latest one. */
+static void go_back_to_change(uint32_t *vals, int nr_wp) {
+  static uint32_t new_vals[NR_WP];
+
+  /* a change by the last instruction is where we are now */
+  uint64_t now = get_nr_guest_instr(), end = now;
+  int k = nr_ckpt - 1;
+  for (; k >= 0; k --) {
+    while (ckpts[k]->instr >= end && k > 0) k --;
+    uint64_t start = ckpts[k]->instr;
+    if (start >= end) break;
+
+    restore(k);
+    uint64_t found = 0;
+    wp_values(vals);
+    nemu_state = NEMU_RUNNING;
+    while (get_nr_guest_instr() < end && nemu_state == NEMU_RUNNING) {
+      exec_wrapper(false);
+      if (!decoding.is_restart) {
+        nr_guest_instr_add(1);
+#ifdef MULTI_CPU
+        if (-- vcpu_countdown == 0) { vcpu_switch(); }
+#endif
+      }
+#ifdef HAS_IOE
+      void device_update();
+      device_update();
+#endif
+      /* the watchpoints are checked after whole instructions */
+      if (decoding.is_restart) continue;
+      wp_values(new_vals);
+      if (memcmp(vals, new_vals, sizeof(vals[0]) * nr_wp) != 0 && get_nr_guest_instr() < now) {
+        found = get_nr_guest_instr();
+        memcpy(vals, new_vals, sizeof(vals[0]) * nr_wp);
+      }
+    }
+    nemu_state = NEMU_STOP;
+
+    if (found != 0) {
+      /* stop right after the instruction which changes the watch point */
+      go_to(found);
+      printf("Watch point changed by the instruction before\n");
+      return;
+    }
+    end = start;
+  }
+
+  go_to(end);
+}
+
+void reverse_continue() {
+  if (nr_ckpt == 0) {
+    printf("Reverse execution is not enabled, use `--checkpoint' to enable it\n");
+    return;
+  }
+
+  static uint32_t vals[NR_WP];
+  int nr_wp = wp_values(vals);
+  if (nr_wp == 0) {
+    printf("No watch point is set\n");
+    return;
+  }
+
+  difftest_detach();
+  go_back_to_change(vals, nr_wp);
+  difftest_attach();
+}
+
+/* The memory is replaced by a snapshot, so the checkpoints are of
+ * another machine. Drop them and start again from here. */
+void reverse_reset() {
+  if (page_seq == NULL) return;
+  int i;
+  for (i = nr_ckpt - 1; i >= 0; i --) { free_checkpoint(ckpts[i]); }
+  nr_ckpt = 0;
+  memset(page_seq, 0, sizeof(page_seq[0]) * nr_page);
+  checkpoint_take();
+}
+
+void init_reverse(char *spec) {
+  if (spec == NULL) return;
+  char *p;
+  interval = strtoull(spec, &p, 0);
+  if (*p == ':') { budget = (size_t)strtoull(p + 1, NULL, 0) << 20; }
+  Assert(interval > 0, "the interval of checkpoints should be positive");
+
+  Log("Reverse execution: \33[1;32m%s\33[0m, one checkpoint every %lu instructions, budget %lu MB",
+      "ON", interval, budget >> 20);
+  nr_pmem_page = pmem_size / PAGE_SIZE;
+  nr_page = nr_pmem_page + MMIO_SPACE_MAX / PAGE_SIZE;
+  page_seq = calloc(nr_page, sizeof(page_seq[0]));
+  in_prev = calloc(nr_page, sizeof(in_prev[0]));
+  assert(page_seq != NULL && in_prev != NULL);
+  checkpoint_take();
+}
+
+#else
+
+void init_reverse(char *spec) {
+  if (spec != NULL) {
+    Log("Reverse execution is not enabled, define REVERSE in include/common.h to enable it");
+  }
+}
+
+void reverse_step(uint64_t n) {
+  printf("Reverse execution is not enabled\n");
+}
+
+void reverse_continue() {
+  printf("Reverse execution is not enabled\n");
+}
+
+void reverse_reset() {
+}
+
+#endif
@@ -0,0 +1,170 @@
+#include "nemu.h"
+#include "monitor/symbol.h"
+
+#include <stdlib.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Symbols are loaded from the symbol tables of ELF files, such as the
+ * AM image, nanos-lite and the navy-apps. They are only used by the
+ * monitor. When the image itself is an ELF file, its symbols are loaded
+ * with it, and `--elf' is only needed for the other files.
+ */
+
+typedef struct {
+  vaddr_t addr;
+  uint32_t size;
+  char *name;
+} Symbol;
+
+static Symbol *syms = NULL;
+static int nr_sym = 0;
+static int max_sym = 0;
+
+static void add_symbol(vaddr_t addr, uint32_t size, const char *name) {
+  if (nr_sym == max_sym) {
+    max_sym = (max_sym == 0 ? 1024 : max_sym * 2);
+    syms = realloc(syms, sizeof(Symbol) * max_sym);
+    assert(syms != NULL);
+  }
+  syms[nr_sym].addr = addr;
+  syms[nr_sym].size = size;
+  syms[nr_sym].name = strdup(name);
+  assert(syms[nr_sym].name != NULL);
+  nr_sym ++;
+}
+
+static int cmp_symbol(const void *a, const void *b) {
+  const Symbol *x = a, *y = b;
+  return (x->addr < y->addr ? -1 : x->addr > y->addr);
+}
+
+/* add the symbols of the ELF file `file' in `buf' */
+static int elf_symbols(const uint8_t *buf, size_t size, const char *file, vaddr_t bias) {
+  const Elf32_Ehdr *eh = (void *)buf;
+  Assert(size >= sizeof(*eh) && memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0,
+      "'%s' is not an ELF file", file);
+  Assert(eh->e_ident[EI_CLASS] == ELFCLASS32, "'%s' is not a 32-bit ELF file", file);
+
+  const Elf32_Shdr *sh = (void *)(buf + eh->e_shoff);
+  int nr = 0, i, j;
+  for (i = 0; i < eh->e_shnum; i ++) {
+    if (sh[i].sh_type != SHT_SYMTAB) continue;
+
+    const Elf32_Sym *sym = (void *)(buf + sh[i].sh_offset);
+    const char *strtab = (void *)(buf + sh[sh[i].sh_link].sh_offset);
+    for (j = 0; j < sh[i].sh_size / sizeof(Elf32_Sym); j ++) {
+      int type = ELF32_ST_TYPE(sym[j].st_info);
+      if ((type != STT_FUNC && type != STT_OBJECT) || sym[j].st_shndx == SHN_UNDEF) continue;
+      if (strtab[sym[j].st_name] == '\0') continue;
+      add_symbol(sym[j].st_value + bias, sym[j].st_size, strtab + sym[j].st_name);
+      nr ++;
+    }
+  }
+  return nr;
+}
+
+static int load_elf_symbols(const char *file, vaddr_t bias) {
+  int fd = open(file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", file);
+  struct stat st;
+  assert(fstat(fd, &st) == 0);
+  size_t size = st.st_size;
+  Assert(size > 0, "'%s' is not an ELF file", file);
+  void *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  Assert(buf != MAP_FAILED, "Can not map '%s'", file);
+  close(fd);
+
+  int nr = elf_symbols(buf, size, file, bias);
+  munmap(buf, size);
+  return nr;
+}
+
+/* `arg' is in the form of FILE[@BIAS], where BIAS is added to the
+ * address of every symbol in FILE.
+ */
+void load_symbols(char *arg) {
+  vaddr_t bias = 0;
+  char *at = strrchr(arg, '@');
+  if (at != NULL) {
+    *at = '\0';
+    bias = strtoul(at + 1, NULL, 0);
+  }
+
+  int nr = load_elf_symbols(arg, bias);
+  Log("Load %d symbols from %s (bias = 0x%x)", nr, arg, bias);
+
+  qsort(syms, nr_sym, sizeof(Symbol), cmp_symbol);
+}
+
+/* the symbols of the ELF image, which is already mapped by the loader */
+void load_image_symbols(const void *buf, size_t size, const char *file) {
+  int nr = elf_symbols(buf, size, file, 0);
+  Log("Load %d symbols from %s", nr, file);
+
+  qsort(syms, nr_sym, sizeof(Symbol), cmp_symbol);
+}
+
+/* Find the symbol containing `addr'. Return its name and set `*start'
+ * to its address, or return NULL if there is no such symbol.
+ */
+const char* symbol_find(vaddr_t addr, vaddr_t *start) {
+  /* find the first symbol above `addr' */
+  int lo = 0, hi = nr_sym;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (syms[mid].addr <= addr) lo = mid + 1;
+    else hi = mid;
+  }
+
+  /* symbols may overlap, so look at a few of the symbols below `addr' */
+  int i;
+  for (i = lo - 1; i >= 0 && i >= lo - 8; i --) {
+    Symbol *s = &syms[i];
+    if (addr - s->addr < s->size || addr == s->addr) {
+      if (start != NULL) { *start = s->addr; }
+      return s->name;
+    }
+  }
+  return NULL;
+}
+
+bool symbol_addr(const char *name, vaddr_t *addr) {
+  int i;
+  for (i = 0; i < nr_sym; i ++) {
+    if (strcmp(syms[i].name, name) == 0) {
+      *addr = syms[i].addr;
+      return true;
+    }
+  }
+  return false;
+}
+
+/* format `addr' as "name+offset" into `buf', which should be able
+ * to hold SYM_STR_SIZE bytes */
+char* symbol_str(vaddr_t addr, char *buf) {
+  vaddr_t start;
+  const char *name = symbol_find(addr, &start);
+  if (name == NULL) {
+    snprintf(buf, SYM_STR_SIZE, "0x%08x", addr);
+  }
+  else if (addr == start) {
+    snprintf(buf, SYM_STR_SIZE, "%s", name);
+  }
+  else {
+    snprintf(buf, SYM_STR_SIZE, "%s+0x%x", name, addr - start);
+  }
+  return buf;
+}
+
+/* the name of the symbol containing `addr', or `addr' in hex
+ * formatted into `buf' if there is no such symbol */
+const char* symbol_name(vaddr_t addr, char *buf) {
+  const char *name = symbol_find(addr, NULL);
+  if (name != NULL) return name;
+  snprintf(buf, SYM_STR_SIZE, "0x%08x", addr);
+  return buf;
+}
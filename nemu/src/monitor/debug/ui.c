@@ -1,6 +1,8 @@
 #include "monitor/monitor.h"
 #include "monitor/expr.h"
 #include "monitor/watchpoint.h"
+#include "monitor/snapshot.h"
+#include "monitor/reverse.h"
 #include "cpu/reg.h"
 #include "memory.h"
 #include "nemu.h"
@@ -177,6 +179,50 @@ static int cmd_d(char *args) {
     return 0;
 }
 
+static int cmd_ftrace(char *args) {
+    void ftrace_dump(int);
+    int n = (args == NULL ? 20 : atoi(args));
+    ftrace_dump(n);
+    return 0;
+}
+
+static int cmd_save(char *args) {
+    if (args == NULL) {
+        printf("save FILE\n");
+        return 0;
+    }
+    if (!snapshot_save(args)) { printf("Can not save snapshot to '%s'\n", args); }
+    return 0;
+}
+
+static int cmd_load(char *args) {
+    if (args == NULL) {
+        printf("load FILE\n");
+        return 0;
+    }
+    if (snapshot_load(args) && nemu_state != NEMU_RUNNING) { nemu_state = NEMU_STOP; }
+    return 0;
+}
+
+static int cmd_fork(char *args) {
+    int status = snapshot_fork();
+    if (status >= 0) {
+        printf("Child exited with %d, back to the state at fork\n", status);
+    }
+    return 0;
+}
+
+static int cmd_rsi(char *args) {
+    uint64_t n = (args == NULL ? 1 : strtoull(args, NULL, 0));
+    reverse_step(n);
+    return 0;
+}
+
+static int cmd_rc(char *args) {
+    reverse_continue();
+    return 0;
+}
+
 static int cmd_help(char *args);
 
 static struct {
@@ -193,6 +239,12 @@ static struct {
   { "x", "calculate EXPR", cmd_x },
   { "w", "suspend execution when the value of EXPR changes", cmd_w },
   { "d", "delete watch point N", cmd_d },
+  { "ftrace", "print the last N calls and returns, default N=20", cmd_ftrace },
+  { "save", "save the snapshot of the machine to FILE", cmd_save },
+  { "load", "load the snapshot of the machine from FILE", cmd_load },
+  { "fork", "continue in a child, and come back to the current state when it exits", cmd_fork },
+  { "rsi", "go back N instructions, default N=1", cmd_rsi },
+  { "rc", "go back to the last change of a watch point", cmd_rc },
 
   /* TODO: Add more commands */
   /* DONE: 2018-9-24 18:23*/
@@ -223,41 +275,73 @@ static int cmd_help(char *args) {
   return 0;
 }
 
+/* execute the command in `str', return a negative value to exit */
+static int ui_exec(char *str) {
+  char *str_end = str + strlen(str);
+
+  /* extract the first token as the command */
+  char *cmd = strtok(str, " ");
+  if (cmd == NULL) { return 0; }
+
+  /* treat the remaining string as the arguments,
+   * which may need further parsing
+   */
+  char *args = cmd + strlen(cmd) + 1;
+  if (args >= str_end) {
+    args = NULL;
+  }
+
+#ifdef HAS_IOE
+  extern void sdl_clear_event_queue(void);
+  sdl_clear_event_queue();
+#endif
+
+  int i;
+  for (i = 0; i < NR_CMD; i ++) {
+    if (strcmp(cmd, cmd_table[i].name) == 0) {
+      return cmd_table[i].handler(args);
+    }
+  }
+
+  printf("Unknown command '%s'\n", cmd);
+  return 0;
+}
+
+/* Every line from stdin is a command run by a child forked from the
+ * current state, which exits with 0 if the program hits the good trap. */
+static void fork_server() {
+  char *line = NULL;
+  size_t size = 0;
+  int nr_run = 0;
+  while (getline(&line, &size, stdin) != -1) {
+    line[strcspn(line, "\n")] = '\0';
+    int status = snapshot_fork();
+    if (status == -1) {
+      ui_exec(line);
+      snapshot_child_exit(nemu_state == NEMU_END && cpu.eax == 0 ? 0 : 1);
+    }
+    printf("fork server: run %d '%s' exited with %d\n", nr_run ++, line, status);
+  }
+  free(line);
+}
+
 void ui_mainloop(int is_batch_mode) {
   if (is_batch_mode) {
+    snapshot_batch_start();
+    if (snapshot_is_fork_server()) {
+      fork_server();
+      return;
+    }
     cmd_c(NULL);
+    snapshot_batch_end();
     return;
   }
 
   while (1) {
     char *str = rl_gets();
-    char *str_end = str + strlen(str);
-
-    /* extract the first token as the command */
-    char *cmd = strtok(str, " ");
-    if (cmd == NULL) { continue; }
-
-    /* treat the remaining string as the arguments,
-     * which may need further parsing
-     */
-    char *args = cmd + strlen(cmd) + 1;
-    if (args >= str_end) {
-      args = NULL;
+    if (ui_exec(str) < 0) {
+      if (snapshot_is_child()) { snapshot_child_exit(0); }
+      return;
     }
-
-#ifdef HAS_IOE
-    extern void sdl_clear_event_queue(void);
-    sdl_clear_event_queue();
-#endif
-
-    int i;
-    for (i = 0; i < NR_CMD; i ++) {
-      if (strcmp(cmd, cmd_table[i].name) == 0) {
-        if (cmd_table[i].handler(args) < 0) { return; }
-        break;
-      }
-    }
-
-    if (i == NR_CMD) { printf("Unknown command '%s'\n", cmd); }
   }
 }
@@ -82,6 +82,27 @@ void get_wp_info() {
     printf("%-5s%-32s%-32s\n", "Num", "Expression", "value");
     while(cur != NULL) {
         printf("%-5d%-32s%-32d\n", cur -> NO, cur -> str, cur -> val);
+        cur = cur -> next;
+    }
+}
+
+
+/* values of the watch points, used by reverse execution */
+int wp_values(uint32_t *vals) {
+    int n = 0;
+    WP* cur;
+    for (cur = head; cur != NULL; cur = cur -> next) {
+        bool success = true;
+        vals[n ++] = expr(cur -> str, &success);
     }
+    return n;
 }
 
+void wp_refresh() {
+    WP* cur;
+    for (cur = head; cur != NULL; cur = cur -> next) {
+        bool success = true;
+        uint32_t val = expr(cur -> str, &success);
+        if (success) { cur -> val = val; }
+    }
+}
@@ -1,26 +1,97 @@
 #include <dlfcn.h>
+#include <stdlib.h>
 
 #include "nemu.h"
 #include "monitor/monitor.h"
+#include "monitor/profile.h"
 #include "diff-test.h"
+#include "util/hash.h"
+#include "memory/codepage.h"
 
 static void (*ref_difftest_memcpy_from_dut)(paddr_t dest, void *src, size_t n);
+static void (*ref_difftest_memcpy_to_dut)(paddr_t src, void *dest, size_t n);
 static void (*ref_difftest_getregs)(void *c);
 static void (*ref_difftest_setregs)(const void *c);
 static void (*ref_difftest_exec)(uint64_t n);
+static void (*ref_difftest_raise_intr)(uint8_t NO);
+static uint64_t (*ref_difftest_memhash)(const paddr_t *pages, int nr);
+static void (*ref_difftest_setregs_eflags)(const void *c);
 
 static bool is_skip_ref;
 static bool is_skip_dut;
+/* set while reverse execution runs the instructions again */
+static bool is_detached = false;
+
+void difftest_set_detached(bool detached) { is_detached = detached; }
 
 void difftest_skip_ref() { is_skip_ref = true; }
 void difftest_skip_dut() { is_skip_dut = true; }
 
-void init_difftest(char *ref_so_file, long img_size) {
+/* Batched mode. NEMU and the reference run `batch_size' instructions
+ * before the registers and the memory written by NEMU are compared.
+ * Every write of NEMU in a batch is recorded in an undo log, so both
+ * sides can go back to the checkpoint at the beginning of the batch.
+ * On a mismatch, the batch is bisected to find the first instruction
+ * whose result differs. Batches are cut at the instructions which call
+ * difftest_skip_ref() or difftest_skip_dut().
+ */
+
+static uint64_t batch_size = 1;
+static uint64_t batch_nr = 0;
+static bool is_single = false;    // the reference is one instruction behind
+
+static CPU_state checkpoint;      // state at the beginning of the batch
+static CPU_state prev_cpu;        // state before the last instruction
+
+typedef struct {
+  paddr_t addr;
+  int len;
+  uint32_t data;
+} UndoEntry;
+
+static UndoEntry *undo_log = NULL;
+static uint32_t nr_undo = 0, max_undo = 0;
+static uint32_t instr_undo;       // position of the undo log before the last instruction
+
+/* Pages written by NEMU since the last comparison of the memory. They
+ * are compared at the end of each batch, or every `mem_period'
+ * instructions otherwise.
+ */
+
+static bool is_tracking = false;
+static uint64_t mem_period = 0, mem_countdown = 0;
+static uint8_t *is_dirty = NULL;
+static paddr_t *dirty_pages = NULL;
+static uint32_t nr_dirty = 0;
+
+/* Lead mode. The reference executes the instructions in another
+ * process, trailing NEMU by at most `lead' instructions. The register
+ * files of NEMU are kept until the reference catches up.
+ */
+
+static int lead = 0;
+static bool is_shm = false;
+static uint64_t lead_nr = 0, lead_checked = 0;
+static struct {
+  CPU_state r;
+  vaddr_t eip;
+} lead_ring[DIFFTEST_MAX_LEAD + 1];
+
+/* set the registers of the reference, with EFLAGS if it can */
+static void ref_setregs(const CPU_state *c) {
+  if (ref_difftest_setregs_eflags != NULL) { ref_difftest_setregs_eflags(c); }
+  else { ref_difftest_setregs(c); }
+}
+
+void init_difftest(char *ref_so_file, long img_size, uint64_t batch, int shm_lead, uint64_t mem) {
 #ifndef DIFF_TEST
   return;
 #endif
 
   assert(ref_so_file != NULL);
+  /* the reference always has the memory of the default size */
+  Assert(pmem_size <= PMEM_DEFAULT_SIZE, "DiffTest supports at most %d MB of physical memory",
+      PMEM_DEFAULT_SIZE >> 20);
 
   void *handle;
   handle = dlopen(ref_so_file, RTLD_LAZY | RTLD_DEEPBIND);
@@ -41,35 +112,466 @@ void init_difftest(char *ref_so_file, long img_size) {
   void (*ref_difftest_init)(void) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
+  /* optional, only needed to compare the memory */
+  ref_difftest_memcpy_to_dut = dlsym(handle, "difftest_memcpy_to_dut");
+  ref_difftest_memhash = dlsym(handle, "difftest_memhash");
+  ref_difftest_raise_intr = dlsym(handle, "difftest_raise_intr");
+  /* optional, needed by the batched mode to go back with the flags */
+  ref_difftest_setregs_eflags = dlsym(handle, "difftest_setregs_eflags");
+
+  if (shm_lead >= 0) {
+    DifftestRef ref = {
+      .memcpy_from_dut = ref_difftest_memcpy_from_dut,
+      .memcpy_to_dut = ref_difftest_memcpy_to_dut,
+      .getregs = ref_difftest_getregs,
+      .setregs = ref_difftest_setregs,
+      .exec = ref_difftest_exec,
+      .init = ref_difftest_init,
+      .memhash = ref_difftest_memhash,
+      .setregs_eflags = ref_difftest_setregs_eflags,
+    };
+    difftest_shm_start(&ref);
+    is_shm = true;
+    ref_difftest_memcpy_from_dut = ref.memcpy_from_dut;
+    ref_difftest_memcpy_to_dut = ref.memcpy_to_dut;
+    ref_difftest_getregs = ref.getregs;
+    ref_difftest_setregs = ref.setregs;
+    ref_difftest_exec = ref.exec;
+    ref_difftest_init = ref.init;
+    ref_difftest_memhash = ref.memhash;
+    ref_difftest_setregs_eflags = ref.setregs_eflags;
+  }
+
+  if (batch > 1 && ref_difftest_setregs_eflags == NULL) {
+    Log("%s can not set its EFLAGS to go back to the beginning of a batch, batched mode is disabled",
+        ref_so_file);
+    batch = 1;
+  }
+  if (batch > 1 || mem > 0) {
+    if (ref_difftest_memcpy_to_dut == NULL) {
+      Log("%s can not copy its memory to NEMU, memory comparison and batched mode are disabled",
+          ref_so_file);
+    }
+    else {
+      batch_size = (batch > 1 ? batch : 1);
+      mem_period = mem_countdown = (batch > 1 ? 0 : mem);
+      is_tracking = true;
+      is_dirty = calloc(pmem_size / PAGE_SIZE, sizeof(is_dirty[0]));
+      dirty_pages = malloc(sizeof(paddr_t) * (pmem_size / PAGE_SIZE));
+      assert(is_dirty != NULL && dirty_pages != NULL);
+    }
+  }
+
+  if (shm_lead > 0) {
+    if (batch_size > 1) {
+      Log("the reference runs in lock-step in the batched mode");
+    }
+    else {
+      Assert(shm_lead <= DIFFTEST_MAX_LEAD, "the lead of the reference should be at most %d",
+          DIFFTEST_MAX_LEAD);
+      lead = shm_lead;
+    }
+  }
+
   Log("Differential testing: \33[1;32m%s\33[0m", "ON");
   Log("The result of every instruction will be compared with %s. "
       "This will help you a lot for debugging, but also significantly reduce the performance. "
       "If it is not necessary, you can turn it off in include/common.h.", ref_so_file);
+  if (batch_size > 1) {
+    Log("Results are compared every %lu instructions", batch_size);
+  }
+  if (mem_period > 0) {
+    Log("Memory written by NEMU is compared every %lu instructions", mem_period);
+  }
+  if (shm_lead >= 0) {
+    Log("The reference runs in another process through shared memory, trailing by at most %d instructions", lead);
+  }
 
   ref_difftest_init();
   ref_difftest_memcpy_from_dut(ENTRY_START, guest_to_host(ENTRY_START), img_size);
-  ref_difftest_setregs(&cpu);
+  ref_setregs(&cpu);
+
+  checkpoint = prev_cpu = cpu;
+}
+
+/* called after a device writes the memory of NEMU by DMA, which the
+ * reference does not have */
+void difftest_dma_write(paddr_t addr, uint32_t len) {
+  if (is_reexec || is_detached) return;
+  ref_difftest_memcpy_from_dut(addr, guest_to_host(addr), len);
+}
+
+/* called by paddr_write() before `len' bytes at `addr' are written */
+void difftest_mem_write(paddr_t addr, int len) {
+  if (!is_tracking || is_detached) return;
+
+  if (batch_size > 1) {
+    if (nr_undo == max_undo) {
+      max_undo = (max_undo == 0 ? 4096 : max_undo * 2);
+      undo_log = realloc(undo_log, sizeof(UndoEntry) * max_undo);
+      assert(undo_log != NULL);
+    }
+    UndoEntry *e = &undo_log[nr_undo ++];
+    e->addr = addr;
+    e->len = len;
+    memcpy(&e->data, guest_to_host(addr), len);
+  }
+
+  paddr_t page = addr / PAGE_SIZE, last = (addr + len - 1) / PAGE_SIZE;
+  for (; page <= last; page ++) {
+    if (!is_dirty[page]) {
+      is_dirty[page] = true;
+      dirty_pages[nr_dirty ++] = page * PAGE_SIZE;
+    }
+  }
+}
+
+static bool check_regs(CPU_state *ref_r, CPU_state *r, bool report) {
+  bool same = (ref_r->eip == r->eip);
+  int i;
+  for (i = 0; i < 8; i ++) {
+    if (ref_r->gpr[i]._32 != r->gpr[i]._32) same = false;
+  }
+  if (!same && report) {
+    for (i = 0; i < 8; i ++) {
+      if (ref_r->gpr[i]._32 != r->gpr[i]._32) {
+        printflog("%s is different: ref = 0x%08x, nemu = 0x%08x\n",
+            regsl[i], ref_r->gpr[i]._32, r->gpr[i]._32);
+      }
+    }
+    if (ref_r->eip != r->eip) {
+      printflog("eip is different: ref = 0x%08x, nemu = 0x%08x\n", ref_r->eip, r->eip);
+    }
+  }
+  return same;
+}
+
+#define MAX_BYTE_DIFF 8
+
+/* show the bytes which are different in the dirty pages */
+static void report_mem() {
+  static uint8_t buf[PAGE_SIZE];
+  uint32_t i;
+  for (i = 0; i < nr_dirty; i ++) {
+    uint8_t *p = guest_to_host(dirty_pages[i]);
+    ref_difftest_memcpy_to_dut(dirty_pages[i], buf, PAGE_SIZE);
+    if (memcmp(buf, p, PAGE_SIZE) == 0) continue;
+
+    int j, nr_diff = 0;
+    for (j = 0; j < PAGE_SIZE; j ++) { nr_diff += (buf[j] != p[j]); }
+    printflog("memory of page 0x%08x is different in %d bytes\n", dirty_pages[i], nr_diff);
+    for (j = 0, nr_diff = 0; j < PAGE_SIZE && nr_diff < MAX_BYTE_DIFF; j ++) {
+      if (buf[j] != p[j]) {
+        printflog("  0x%08x: ref = 0x%02x, nemu = 0x%02x\n", dirty_pages[i] + j, buf[j], p[j]);
+        nr_diff ++;
+      }
+    }
+  }
+}
+
+/* compare the hash of the pages written by NEMU */
+static bool check_mem(bool report) {
+  uint64_t h = hash_pages(guest_to_host(0), dirty_pages, nr_dirty, PAGE_SIZE);
+  uint64_t ref_h = 0;
+  if (ref_difftest_memhash != NULL) {
+    ref_h = ref_difftest_memhash(dirty_pages, nr_dirty);
+  }
+  else {
+    static uint8_t buf[PAGE_SIZE];
+    uint32_t i;
+    for (i = 0; i < nr_dirty; i ++) {
+      ref_difftest_memcpy_to_dut(dirty_pages[i], buf, PAGE_SIZE);
+      ref_h = hash64(buf, PAGE_SIZE, ref_h ^ dirty_pages[i]);
+    }
+  }
+  if (h != ref_h && report) { report_mem(); }
+  return h == ref_h;
+}
+
+static void clear_dirty() {
+  uint32_t i;
+  for (i = 0; i < nr_dirty; i ++) { is_dirty[dirty_pages[i] / PAGE_SIZE] = false; }
+  nr_dirty = 0;
+}
+
+static bool check(bool report) {
+  CPU_state ref_r;
+  ref_difftest_getregs(&ref_r);
+  bool regs_ok = check_regs(&ref_r, &cpu, report);
+  bool mem_ok = (batch_size == 1 || check_mem(report));
+  return regs_ok && mem_ok;
+}
+
+static void undo(uint32_t pos) {
+  while (nr_undo > pos) {
+    UndoEntry *e = &undo_log[-- nr_undo];
+    codepage_write(e->addr, e->len);
+    memcpy(guest_to_host(e->addr), &e->data, e->len);
+  }
+}
+
+/* start a new batch from the current state */
+static void commit() {
+  clear_dirty();
+  nr_undo = 0;
+  batch_nr = 0;
+  checkpoint = cpu;
+}
+
+/* Bring both NEMU and the reference back to the checkpoint. The whole
+ * memory is copied, as the reference may have written pages which NEMU
+ * has not. It is only done to bisect a batch which goes wrong. */
+static void restore() {
+  undo(0);
+  cpu = checkpoint;
+  ref_setregs(&cpu);
+  ref_difftest_memcpy_from_dut(0, guest_to_host(0), pmem_size);
+}
+
+/* the models are also off, so nothing is counted twice */
+static void replay(uint64_t n) {
+  void exec_wrapper(bool);
+  bool detailed = is_detailed;
+  is_reexec = true;
+  is_detailed = false;
+  for (; n > 0; n --) { exec_wrapper(false); }
+  is_detailed = detailed;
+  is_reexec = false;
+}
+
+/* The first `n' instructions from the checkpoint give different results.
+ * Find the first instruction which goes wrong. */
+static void bisect(uint64_t n) {
+  uint64_t good = 0, bad = n;
+  while (bad - good > 1) {
+    uint64_t mid = good + (bad - good) / 2;
+    restore();
+    replay(mid);
+    ref_difftest_exec(mid);
+    if (check(false)) good = mid;
+    else bad = mid;
+  }
+
+  restore();
+  replay(good);
+  ref_difftest_exec(good);
+  vaddr_t eip = cpu.eip;
+  replay(1);
+  ref_difftest_exec(1);
+  printflog("The first difference is found after instruction %lu of the batch at eip = 0x%08x\n",
+      good + 1, eip);
+  check(true);
+}
+
+/* run the reference for the `n' instructions NEMU has executed in the batch */
+static void check_batch(uint64_t n) {
+  if (n == 0) return;
+  ref_difftest_exec(n);
+  if (!check(false)) {
+    bisect(n);
+    nemu_state = NEMU_ABORT;
+    return;
+  }
+  commit();
+}
+
+/* The last instruction should not be compared. Roll it back to check
+ * the instructions before it, then apply it again. */
+static void cut_batch() {
+  CPU_state post_cpu = cpu;
+  uint32_t nr_redo = nr_undo - instr_undo, i;
+  UndoEntry redo[nr_redo + 1];
+  for (i = 0; i < nr_redo; i ++) {
+    redo[i] = undo_log[instr_undo + i];
+    memcpy(&redo[i].data, guest_to_host(redo[i].addr), redo[i].len);
+  }
+  undo(instr_undo);
+  cpu = prev_cpu;
+
+  check_batch(batch_nr - 1);
+  if (nemu_state == NEMU_ABORT) return;
+
+  for (i = 0; i < nr_redo; i ++) {
+    codepage_write(redo[i].addr, redo[i].len);
+    memcpy(guest_to_host(redo[i].addr), &redo[i].data, redo[i].len);
+  }
+  cpu = post_cpu;
+
+  if (is_skip_ref) {
+    ref_setregs(&cpu);
+    for (i = 0; i < nr_redo; i ++) {
+      ref_difftest_memcpy_from_dut(redo[i].addr, &redo[i].data, redo[i].len);
+    }
+    is_skip_ref = false;
+  }
+  if (is_skip_dut) {
+    /* the reference will execute this instruction together with the next one */
+    is_single = true;
+    is_skip_dut = false;
+  }
+  commit();
+}
+
+static void difftest_batch_step() {
+  batch_nr ++;
+
+  if (is_skip_ref || is_skip_dut) {
+    cut_batch();
+  }
+  else if (is_single) {
+    is_single = false;
+    ref_difftest_exec(1);
+    if (!check(true)) { nemu_state = NEMU_ABORT; }
+    commit();
+  }
+  else if (batch_nr == batch_size) {
+    check_batch(batch_nr);
+  }
+
+  prev_cpu = cpu;
+  instr_undo = nr_undo;
+}
+
+/* check the oldest instruction which the reference has not been compared */
+static void lead_check() {
+  CPU_state ref_r;
+  int i = lead_checked % (DIFFTEST_MAX_LEAD + 1);
+  difftest_shm_getregs_async(lead_checked, &ref_r);
+  lead_checked ++;
+  if (!check_regs(&ref_r, &lead_ring[i].r, true)) {
+    printflog("Difference found after the instruction at eip = 0x%08x, "
+        "NEMU has run %lu instructions further\n", lead_ring[i].eip, lead_nr - lead_checked);
+    nemu_state = NEMU_ABORT;
+  }
+}
+
+static void lead_drain() {
+  while (lead_checked < lead_nr && nemu_state != NEMU_ABORT) { lead_check(); }
+}
+
+/* Make the reference the same as NEMU, after the state of NEMU is
+ * changed behind its back, such as by loading a snapshot. */
+void difftest_sync() {
+  if (ref_difftest_setregs == NULL) return;
+  if (lead > 0) {
+    lead_drain();
+    if (nemu_state == NEMU_ABORT) return;
+  }
+  ref_difftest_memcpy_from_dut(0, guest_to_host(0), pmem_size);
+  ref_setregs(&cpu);
+  is_skip_ref = is_skip_dut = is_single = false;
+  commit();
+  prev_cpu = cpu;
+  instr_undo = 0;
+}
+
+/* Called after NEMU takes an interrupt from a device, which the
+ * reference does not have. The reference takes it by itself if it can.
+ * Otherwise the instructions before are checked, and the registers and
+ * the frame pushed by NEMU are copied to the reference. Without a plain
+ * frame, or when the reference is behind NEMU, all the memory is copied.
+ */
+void difftest_intr(uint8_t NO) {
+  if (is_reexec || is_detached) return;
+
+  if (batch_size > 1 && !is_single) {
+    /* like an instruction which skips the reference */
+    batch_nr ++;
+    is_skip_ref = true;
+    cut_batch();
+    prev_cpu = cpu;
+    instr_undo = nr_undo;
+    return;
+  }
+
+  if (lead > 0) {
+    lead_drain();
+    if (nemu_state == NEMU_ABORT) return;
+  }
+  else if (ref_difftest_raise_intr != NULL && batch_size == 1 && !is_shm && !is_single) {
+    ref_difftest_raise_intr(NO);
+    return;
+  }
+
+  void *frame = (is_single ? NULL : vaddr_host_range(cpu.esp, 3 * sizeof(uint32_t), false));
+  if (frame == NULL) {
+    difftest_sync();
+    return;
+  }
+  /* without paging, as checked by vaddr_host_range() */
+  ref_setregs(&cpu);
+  ref_difftest_memcpy_from_dut(cpu.esp, frame, 3 * sizeof(uint32_t));
+}
+
+/* compare the memory when NEMU and the reference are at the same instruction */
+static void check_mem_period(vaddr_t eip) {
+  if (mem_period == 0 || mem_countdown > 0) return;
+  mem_countdown = mem_period;
+  if (lead > 0) {
+    lead_drain();
+    if (nemu_state == NEMU_ABORT) return;
+  }
+  if (!check_mem(true)) {
+    printflog("Difference of memory found within %lu instructions before eip = 0x%08x\n",
+        mem_period, eip);
+    nemu_state = NEMU_ABORT;
+  }
+  clear_dirty();
 }
 
 void difftest_step(uint32_t eip) {
   CPU_state ref_r;
 
+  if (is_reexec || is_detached) return;
+
+  if (batch_size > 1) {
+    difftest_batch_step();
+    return;
+  }
+
+  if (mem_countdown > 0) { mem_countdown --; }
+
+  if (lead > 0) {
+    if (is_skip_dut || is_skip_ref) {
+      /* the reference should catch up before it is synchronized */
+      lead_drain();
+      if (nemu_state == NEMU_ABORT) return;
+    }
+    else {
+      int i = lead_nr % (DIFFTEST_MAX_LEAD + 1);
+      lead_ring[i].r = cpu;
+      lead_ring[i].eip = eip;
+      difftest_shm_exec_async();
+      is_single = false;
+      lead_nr ++;
+      if (lead_nr - lead_checked > lead) { lead_check(); }
+      check_mem_period(eip);
+      return;
+    }
+  }
+
   if (is_skip_dut) {
+    is_single = true;
     is_skip_dut = false;
     return;
   }
 
   if (is_skip_ref) {
     // to skip the checking of an instruction, just copy the reg state to reference design
-    ref_difftest_setregs(&cpu);
-    is_skip_ref = false;
+    ref_setregs(&cpu);
+    is_skip_ref = is_single = false;
+    check_mem_period(eip);
     return;
   }
 
   ref_difftest_exec(1);
   ref_difftest_getregs(&ref_r);
+  is_single = false;
 
-  // TODO: Check the registers state with the reference design.
-  // Set `nemu_state` to `NEMU_ABORT` if they are not the same.
-  TODO();
+  if (!check_regs(&ref_r, &cpu, true)) {
+    printflog("Difference found after the instruction at eip = 0x%08x\n", eip);
+    nemu_state = NEMU_ABORT;
+    return;
+  }
+  check_mem_period(eip);
 }
@@ -2,5 +2,25 @@
 #define __DIFF_TEST_H__
 
 #define DIFFTEST_REG_SIZE (sizeof(uint32_t) * 9) // GRPs + EIP
+#define DIFFTEST_REG_EFLAGS_SIZE (DIFFTEST_REG_SIZE + sizeof(uint32_t)) // and EFLAGS
+
+/* the interface of a reference design */
+typedef struct {
+  void (*memcpy_from_dut)(paddr_t dest, void *src, size_t n);
+  void (*memcpy_to_dut)(paddr_t src, void *dest, size_t n);
+  void (*getregs)(void *c);
+  void (*setregs)(const void *c);
+  void (*exec)(uint64_t n);
+  void (*init)(void);
+  uint64_t (*memhash)(const paddr_t *pages, int nr);   // optional
+  void (*setregs_eflags)(const void *c);                // optional
+} DifftestRef;
+
+/* the reference may trail NEMU by at most this number of instructions */
+#define DIFFTEST_MAX_LEAD 64
+
+void difftest_shm_start(DifftestRef *ref);
+void difftest_shm_exec_async(void);
+void difftest_shm_getregs_async(uint64_t seq, void *r);
 
 #endif
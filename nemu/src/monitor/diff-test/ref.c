@@ -1,12 +1,25 @@
 #include "nemu.h"
 #include "diff-test.h"
+#include "util/hash.h"
+#include "cpu/intr.h"
+#include "memory/codepage.h"
 
 void cpu_exec(uint64_t);
+void decoding_set_jmp(bool);
 
 void difftest_memcpy_from_dut(paddr_t dest, void *src, size_t n) {
+  codepage_write(dest, n);
   memcpy(guest_to_host(dest), src, n);
 }
 
+void difftest_memcpy_to_dut(paddr_t src, void *dest, size_t n) {
+  memcpy(dest, guest_to_host(src), n);
+}
+
+uint64_t difftest_memhash(const paddr_t *pages, int nr) {
+  return hash_pages(guest_to_host(0), pages, nr, PAGE_SIZE);
+}
+
 void difftest_getregs(void *r) {
   memcpy(r, &cpu, DIFFTEST_REG_SIZE);
 }
@@ -15,9 +28,26 @@ void difftest_setregs(const void *r) {
   memcpy(&cpu, r, DIFFTEST_REG_SIZE);
 }
 
+/* optional, with EFLAGS, used by the fuzzer */
+void difftest_getregs_eflags(void *r) {
+  memcpy(r, &cpu, DIFFTEST_REG_EFLAGS_SIZE);
+}
+
+void difftest_setregs_eflags(const void *r) {
+  memcpy(&cpu, r, DIFFTEST_REG_EFLAGS_SIZE);
+}
+
 void difftest_exec(uint64_t n) {
   cpu_exec(n);
 }
 
+void difftest_raise_intr(uint8_t NO) {
+  raise_intr(NO, cpu.eip);
+  /* the eip is already set, and no update_eip() follows here to clear
+   * the jump, which would be taken by the next instruction */
+  decoding_set_jmp(false);
+}
+
 void difftest_init(void) {
+  init_pmem(PMEM_DEFAULT_SIZE);
 }
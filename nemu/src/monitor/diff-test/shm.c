@@ -0,0 +1,248 @@
+#include "nemu.h"
+#include "diff-test.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+/* Shared-memory transport of the reference design. The reference is
+ * run by a child process forked after the reference library is loaded,
+ * so it can run on another core. Commands, register files and memory are
+ * exchanged through a shared mapping, with a short spin before falling
+ * back to futex for the handoff.
+ *
+ * Besides the lock-step commands, NEMU can post instructions for the
+ * reference to execute asynchronously. The reference writes the register
+ * file after each of them into a ring, which NEMU checks later.
+ */
+
+#define SHM_BUF_SIZE (1024 * 1024)
+#define SHM_RING_SIZE (DIFFTEST_MAX_LEAD + 1)
+#define SPIN_COUNT 4096
+
+enum { CMD_NONE, CMD_MEMCPY_FROM_DUT, CMD_MEMCPY_TO_DUT, CMD_GETREGS, CMD_SETREGS,
+  CMD_EXEC, CMD_INIT, CMD_MEMHASH, CMD_SETREGS_EFLAGS, CMD_EXIT };
+
+typedef struct {
+  /* parent -> child */
+  uint32_t doorbell;
+  uint32_t child_sleeping;
+  uint32_t req;
+  uint64_t exec_req;
+  /* child -> parent */
+  uint32_t ack_bell;
+  uint32_t parent_sleeping;
+  uint32_t ack;
+  uint64_t exec_done;
+
+  /* arguments of the command */
+  int cmd;
+  paddr_t addr;
+  size_t len;
+  uint64_t n;
+  uint8_t regs[DIFFTEST_REG_EFLAGS_SIZE];
+
+  uint8_t ring[SHM_RING_SIZE][DIFFTEST_REG_SIZE];
+  uint8_t buf[SHM_BUF_SIZE];
+} ShmCtl;
+
+static ShmCtl *ctl = NULL;
+static DifftestRef real;
+
+#define load(p) __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define store(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+
+static inline void futex(uint32_t *addr, int op, uint32_t val) {
+  syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+/* wait until `*word' is no longer `old' */
+static void wait_change(uint32_t *word, uint32_t old, uint32_t *sleeping) {
+  int i;
+  for (i = 0; i < SPIN_COUNT; i ++) {
+    if (load(word) != old) return;
+    __builtin_ia32_pause();
+  }
+  while (load(word) == old) {
+    store(sleeping, 1);
+    futex(word, FUTEX_WAIT, old);
+    store(sleeping, 0);
+  }
+}
+
+static inline void ring_bell(uint32_t *word, uint32_t *sleeping) {
+  __atomic_add_fetch(word, 1, __ATOMIC_SEQ_CST);
+  if (load(sleeping)) { futex(word, FUTEX_WAKE, 1); }
+}
+
+/* ------------------------------- child -------------------------------- */
+
+static void serve_cmd() {
+  switch (ctl->cmd) {
+    case CMD_MEMCPY_FROM_DUT: real.memcpy_from_dut(ctl->addr, ctl->buf, ctl->len); break;
+    case CMD_MEMCPY_TO_DUT: real.memcpy_to_dut(ctl->addr, ctl->buf, ctl->len); break;
+    case CMD_GETREGS: real.getregs(ctl->regs); break;
+    case CMD_SETREGS: real.setregs(ctl->regs); break;
+    case CMD_EXEC: real.exec(ctl->n); break;
+    case CMD_INIT: real.init(); break;
+    case CMD_MEMHASH: ctl->n = real.memhash((paddr_t *)ctl->buf, ctl->len); break;
+    case CMD_SETREGS_EFLAGS: real.setregs_eflags(ctl->regs); break;
+    case CMD_EXIT: _exit(0);
+    default: panic("unknown command %d", ctl->cmd);
+  }
+}
+
+static void serve() {
+  uint32_t last_req = 0;
+  while (1) {
+    uint32_t bell = load(&ctl->doorbell);
+    bool busy = true;
+    while (busy) {
+      busy = false;
+      /* asynchronous instructions are posted before any later command */
+      uint64_t done = ctl->exec_done;
+      if (done < load(&ctl->exec_req)) {
+        real.exec(1);
+        real.getregs(ctl->ring[done % SHM_RING_SIZE]);
+        store(&ctl->exec_done, done + 1);
+        ring_bell(&ctl->ack_bell, &ctl->parent_sleeping);
+        busy = true;
+      }
+      else if (load(&ctl->req) != last_req) {
+        serve_cmd();
+        last_req = ctl->req;
+        store(&ctl->ack, last_req);
+        ring_bell(&ctl->ack_bell, &ctl->parent_sleeping);
+        busy = true;
+      }
+    }
+    wait_change(&ctl->doorbell, bell, &ctl->child_sleeping);
+  }
+}
+
+/* ------------------------------- parent ------------------------------- */
+
+static void call(int cmd) {
+  ctl->cmd = cmd;
+  uint32_t req = ctl->req + 1;
+  store(&ctl->req, req);
+  ring_bell(&ctl->doorbell, &ctl->child_sleeping);
+  while (1) {
+    uint32_t bell = load(&ctl->ack_bell);
+    if (load(&ctl->ack) == req) break;
+    wait_change(&ctl->ack_bell, bell, &ctl->parent_sleeping);
+  }
+}
+
+static void shm_memcpy_from_dut(paddr_t dest, void *src, size_t n) {
+  while (n > 0) {
+    size_t len = (n < SHM_BUF_SIZE ? n : SHM_BUF_SIZE);
+    memcpy(ctl->buf, src, len);
+    ctl->addr = dest;
+    ctl->len = len;
+    call(CMD_MEMCPY_FROM_DUT);
+    dest += len;
+    src += len;
+    n -= len;
+  }
+}
+
+static void shm_memcpy_to_dut(paddr_t src, void *dest, size_t n) {
+  while (n > 0) {
+    size_t len = (n < SHM_BUF_SIZE ? n : SHM_BUF_SIZE);
+    ctl->addr = src;
+    ctl->len = len;
+    call(CMD_MEMCPY_TO_DUT);
+    memcpy(dest, ctl->buf, len);
+    src += len;
+    dest += len;
+    n -= len;
+  }
+}
+
+static void shm_getregs(void *r) {
+  call(CMD_GETREGS);
+  memcpy(r, ctl->regs, DIFFTEST_REG_SIZE);
+}
+
+static void shm_setregs(const void *r) {
+  memcpy(ctl->regs, r, DIFFTEST_REG_SIZE);
+  call(CMD_SETREGS);
+}
+
+static void shm_setregs_eflags(const void *r) {
+  memcpy(ctl->regs, r, DIFFTEST_REG_EFLAGS_SIZE);
+  call(CMD_SETREGS_EFLAGS);
+}
+
+static void shm_exec(uint64_t n) {
+  ctl->n = n;
+  call(CMD_EXEC);
+}
+
+static uint64_t shm_memhash(const paddr_t *pages, int nr) {
+  assert(sizeof(paddr_t) * nr <= SHM_BUF_SIZE);
+  memcpy(ctl->buf, pages, sizeof(paddr_t) * nr);
+  ctl->len = nr;
+  call(CMD_MEMHASH);
+  return ctl->n;
+}
+
+static void shm_init() {
+  call(CMD_INIT);
+}
+
+static void shm_exit() {
+  ctl->cmd = CMD_EXIT;
+  store(&ctl->req, ctl->req + 1);
+  ring_bell(&ctl->doorbell, &ctl->child_sleeping);
+}
+
+/* Let the reference execute one more instruction in the background. */
+void difftest_shm_exec_async() {
+  store(&ctl->exec_req, ctl->exec_req + 1);
+  ring_bell(&ctl->doorbell, &ctl->child_sleeping);
+}
+
+/* Get the register file after the `seq'-th asynchronous instruction,
+ * counting from 0. At most SHM_RING_SIZE of them can be kept. */
+void difftest_shm_getregs_async(uint64_t seq, void *r) {
+  assert(seq < ctl->exec_req && seq + SHM_RING_SIZE > ctl->exec_req);
+  while (1) {
+    uint32_t bell = load(&ctl->ack_bell);
+    if (load(&ctl->exec_done) > seq) break;
+    wait_change(&ctl->ack_bell, bell, &ctl->parent_sleeping);
+  }
+  memcpy(r, ctl->ring[seq % SHM_RING_SIZE], DIFFTEST_REG_SIZE);
+}
+
+/* Fork the process to serve the reference `ref', and replace
+ * the interface in `ref' with the one through shared memory. */
+void difftest_shm_start(DifftestRef *ref) {
+  ctl = mmap(NULL, sizeof(ShmCtl), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  Assert(ctl != MAP_FAILED, "can not map the shared memory for the reference");
+  real = *ref;
+
+  int ppid_before_fork = getpid();
+  int pid = fork();
+  Assert(pid != -1, "can not fork the process for the reference");
+  if (pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != ppid_before_fork) _exit(0);
+    serve();
+  }
+
+  ref->memcpy_from_dut = shm_memcpy_from_dut;
+  ref->memcpy_to_dut = (ref->memcpy_to_dut ? shm_memcpy_to_dut : NULL);
+  ref->getregs = shm_getregs;
+  ref->setregs = shm_setregs;
+  ref->exec = shm_exec;
+  ref->init = shm_init;
+  ref->memhash = (ref->memhash ? shm_memhash : NULL);
+  ref->setregs_eflags = (ref->setregs_eflags ? shm_setregs_eflags : NULL);
+  atexit(shm_exit);
+}
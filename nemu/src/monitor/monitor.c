@@ -1,18 +1,57 @@
 #include "nemu.h"
 #include "monitor/monitor.h"
+#include "monitor/profile.h"
+#include "monitor/snapshot.h"
+#include "device/replay.h"
+#include "monitor/reverse.h"
+#include "cpu/vcpu.h"
+#include "monitor/symbol.h"
 #include <unistd.h>
+#include <getopt.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-void init_difftest(char *ref_so_file, long img_size);
+void init_difftest(char *ref_so_file, long img_size, uint64_t batch, int shm_lead, uint64_t mem);
 void init_regex();
 void init_wp_pool();
 void init_device();
+void init_semihost(const char *dir);
+void init_cache();
+void cache_config(char *spec);
+void init_bpred(char *predictor);
 
 void reg_test();
 
 FILE *log_fp = NULL;
 static char *log_file = NULL;
 static char *diff_so_file = NULL;
+static uint64_t diff_batch = 1;
+static int diff_lead = -1;
+static uint64_t diff_mem = 0;
 static char *img_file = NULL;
+static vaddr_t img_entry = ENTRY_START;
+static char *profile_file = NULL;
+static char *ftrace_file = NULL;
+static char *sample_file = NULL;
+static uint64_t sample_period = 0;
+static char *bpred = NULL;
+static char *load_file = NULL;
+static char *save_spec = NULL;
+static bool fork_server = false;
+static char *record_file = NULL;
+static char *replay_file = NULL;
+static char *checkpoint_spec = NULL;
+static char *sampling_spec = NULL;
+static char *bbv_spec = NULL;
+static char *ncpu_spec = NULL;
+static char *semihost_dir = NULL;
+static uint32_t pmem_mb = PMEM_DEFAULT_SIZE >> 20;
+#define MAX_ELF_FILE 8
+static char *elf_file[MAX_ELF_FILE];
+static int nr_elf_file = 0;
 static int is_batch_mode = false;
 
 static inline void init_log() {
@@ -58,49 +97,195 @@ static inline int load_default_img() {
   return sizeof(img);
 }
 
+/* Map the whole file read-only, so it is copied only once, from the page
+ * cache of the host to the physical memory. */
+static void* map_file(const char *file, size_t *size) {
+  int fd = open(file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", file);
+  struct stat st;
+  assert(fstat(fd, &st) == 0);
+  *size = st.st_size;
+  void *buf = NULL;
+  if (*size > 0) {
+    buf = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    Assert(buf != MAP_FAILED, "Can not map '%s'", file);
+  }
+  close(fd);
+  return buf;
+}
+
+/* Load the PT_LOAD segments of an ELF image to their physical addresses,
+ * and return the size from ENTRY_START to the end of the last one. The
+ * memory beyond the file size of a segment, such as .bss, is zeroed
+ * lazily by pmem_zero(). */
+static long load_elf(const uint8_t *buf, size_t size) {
+  const Elf32_Ehdr *eh = (void *)buf;
+  Assert(size >= sizeof(*eh) && eh->e_ident[EI_CLASS] == ELFCLASS32 && eh->e_machine == EM_386,
+      "'%s' is not a 32-bit x86 ELF file", img_file);
+  Assert(eh->e_phoff + (size_t)eh->e_phnum * sizeof(Elf32_Phdr) <= size, "'%s' is broken", img_file);
+
+  const Elf32_Phdr *ph = (void *)(buf + eh->e_phoff);
+  paddr_t end = ENTRY_START;
+  int i;
+  for (i = 0; i < eh->e_phnum; i ++) {
+    if (ph[i].p_type != PT_LOAD || ph[i].p_memsz == 0) continue;
+    paddr_t addr = ph[i].p_paddr;
+    Assert(addr >= ENTRY_START && (uint64_t)addr + ph[i].p_memsz <= pmem_size,
+        "segment [0x%08x, 0x%08x) of '%s' is out of the physical memory above 0x%x",
+        addr, addr + ph[i].p_memsz, img_file, ENTRY_START);
+    Assert(ph[i].p_filesz <= ph[i].p_memsz && (size_t)ph[i].p_offset + ph[i].p_filesz <= size,
+        "'%s' is broken", img_file);
+    memcpy(guest_to_host(addr), buf + ph[i].p_offset, ph[i].p_filesz);
+    pmem_zero(addr + ph[i].p_filesz, ph[i].p_memsz - ph[i].p_filesz);
+    if (addr + ph[i].p_memsz > end) { end = addr + ph[i].p_memsz; }
+  }
+
+  img_entry = eh->e_entry;
+  Log("Entry point: 0x%08x", img_entry);
+  return end - ENTRY_START;
+}
+
+/* Load a raw image to ENTRY_START, or an ELF image by its program headers.
+ * The symbols of an ELF image are also loaded for the monitor. */
 static inline long load_img() {
   long size;
   if (img_file == NULL) {
     size = load_default_img();
   }
   else {
-    int ret;
-
-    FILE *fp = fopen(img_file, "rb");
-    Assert(fp, "Can not open '%s'", img_file);
+    size_t file_size;
+    uint8_t *buf = map_file(img_file, &file_size);
 
     Log("The image is %s", img_file);
 
-    fseek(fp, 0, SEEK_END);
-    size = ftell(fp);
-
-    fseek(fp, 0, SEEK_SET);
-    ret = fread(guest_to_host(ENTRY_START), size, 1, fp);
-    assert(ret == 1);
+    if (file_size >= SELFMAG && memcmp(buf, ELFMAG, SELFMAG) == 0) {
+      size = load_elf(buf, file_size);
+      load_image_symbols(buf, file_size, img_file);
+    }
+    else {
+      size = file_size;
+      Assert(size <= pmem_size - ENTRY_START, "The image is larger than the physical memory");
+      memcpy(guest_to_host(ENTRY_START), buf, size);
+    }
 
-    fclose(fp);
+    if (buf != NULL) { munmap(buf, file_size); }
   }
   return size;
 }
 
 static inline void restart() {
   /* Set the initial instruction pointer. */
-  cpu.eip = ENTRY_START;
+  cpu.eip = img_entry;
+
+  /* Bit 1 of EFLAGS is always set. */
+  cpu.eflags.val = 0x2;
+
+  /* the code segment of AM */
+  cpu.cs = 0x8;
 }
 
 static inline void parse_args(int argc, char *argv[]) {
+  const struct option table[] = {
+    {"batch"    , no_argument      , NULL, 'b'},
+    {"log"      , required_argument, NULL, 'l'},
+    {"diff"     , required_argument, NULL, 'd'},
+    {"diff-batch", required_argument, NULL, 'k'},
+    {"diff-shm" , required_argument, NULL, 'D'},
+    {"diff-mem" , required_argument, NULL, 'M'},
+    {"profile"  , required_argument, NULL, 'p'},
+    {"elf"      , required_argument, NULL, 'e'},
+    {"ftrace"   , required_argument, NULL, 'f'},
+    {"sample"   , required_argument, NULL, 's'},
+    {"sample-period", required_argument, NULL, 'P'},
+    {"cache"    , required_argument, NULL, 'c'},
+    {"bpred"    , required_argument, NULL, 'B'},
+    {"load"     , required_argument, NULL, 'L'},
+    {"save"     , required_argument, NULL, 'S'},
+    {"fork-server", no_argument    , NULL, 'F'},
+    {"record"   , required_argument, NULL, 'R'},
+    {"replay"   , required_argument, NULL, 'r'},
+    {"checkpoint", required_argument, NULL, 't'},
+    {"sampling" , required_argument, NULL, 'm'},
+    {"bbv"      , required_argument, NULL, 'v'},
+    {"ncpu"     , required_argument, NULL, 'n'},
+    {"pmem"     , required_argument, NULL, 'z'},
+    {"semihost" , required_argument, NULL, 'H'},
+    {"help"     , no_argument      , NULL, 'h'},
+    {0          , 0                , NULL,  0 },
+  };
   int o;
-  while ( (o = getopt(argc, argv, "-bl:d:")) != -1) {
+  while ( (o = getopt_long(argc, argv, "-bhl:d:k:D:M:p:e:f:s:P:c:B:L:S:FR:r:t:m:v:n:z:H:", table, NULL)) != -1) {
     switch (o) {
       case 'b': is_batch_mode = true; break;
       case 'l': log_file = optarg; break;
       case 'd': diff_so_file = optarg; break;
+      case 'k': diff_batch = strtoull(optarg, NULL, 0); break;
+      case 'D': diff_lead = atoi(optarg); break;
+      case 'M': diff_mem = strtoull(optarg, NULL, 0); break;
+      case 'p': profile_file = optarg; break;
+      case 'e':
+                Assert(nr_elf_file < MAX_ELF_FILE, "too many ELF files");
+                elf_file[nr_elf_file ++] = optarg;
+                break;
+      case 'f': ftrace_file = optarg; break;
+      case 's': sample_file = optarg; break;
+      case 'P': sample_period = strtoull(optarg, NULL, 0); break;
+      case 'c': cache_config(optarg); break;
+      case 'B': bpred = optarg; break;
+      case 'L': load_file = optarg; break;
+      case 'S': save_spec = optarg; break;
+      case 'F': fork_server = true; break;
+      case 'R': record_file = optarg; break;
+      case 'r': replay_file = optarg; break;
+      case 't': checkpoint_spec = optarg; break;
+      case 'm': sampling_spec = optarg; break;
+      case 'v': bbv_spec = optarg; break;
+      case 'n': ncpu_spec = optarg; break;
+      case 'z': pmem_mb = strtoul(optarg, NULL, 0); break;
+      case 'H': semihost_dir = optarg; break;
       case 1:
                 if (img_file != NULL) Log("too much argument '%s', ignored", optarg);
                 else img_file = optarg;
                 break;
       default:
-                panic("Usage: %s [-b] [-l log_file] [img_file]", argv[0]);
+                printf("Usage: %s [OPTION...] [img_file]\n\n", argv[0]);
+                printf("\t-b,--batch              run with batch mode\n");
+                printf("\t-l,--log=FILE           output log to FILE\n");
+                printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
+                printf("\t-k,--diff-batch=K       compare with the reference every K instructions (default 1),\n");
+                printf("\t                        not faster with QEMU, which still steps every instruction\n");
+                printf("\t-D,--diff-shm=LEAD      run the reference in another process through shared memory,\n");
+                printf("\t                        trailing NEMU by at most LEAD instructions (0 for lock-step)\n");
+                printf("\t-M,--diff-mem=N         compare the memory written by NEMU every N instructions\n");
+                printf("\t-p,--profile=FILE       write the profile of the guest program to FILE\n");
+                printf("\t-e,--elf=FILE[@BIAS]    load symbols from ELF FILE, adding BIAS to their addresses\n");
+                printf("\t-f,--ftrace=FILE        write the folded call stacks of the function trace to FILE\n");
+                printf("\t-s,--sample=FILE        sample the guest stacks and write them folded to FILE\n");
+                printf("\t-P,--sample-period=N    take a sample every N instructions (default %d)\n", SAMPLE_PERIOD);
+                printf("\t-c,--cache=NAME:SIZE:WAYS:LINE[:POLICY]\n");
+                printf("\t                        configure cache NAME (l1i, l1d, l2), POLICY is lru, plru or random\n");
+                printf("\t-B,--bpred=PREDICTOR    model branch PREDICTOR (bimodal, gshare or tage)\n");
+                printf("\t-L,--load=FILE          load the snapshot FILE instead of the image\n");
+                printf("\t-S,--save=FILE[@N]      in batch mode, save the snapshot to FILE after N instructions,\n");
+                printf("\t                        or when the program stops\n");
+                printf("\t-F,--fork-server        in batch mode, run each command from stdin in a forked child\n");
+                printf("\t-R,--record=FILE        record the inputs of devices to FILE\n");
+                printf("\t-r,--replay=FILE        replay the inputs of devices from FILE, without SDL\n");
+                printf("\t-t,--checkpoint=N[:MB]  take a checkpoint every N instructions for reverse execution,\n");
+                printf("\t                        using at most MB megabytes (default %d)\n", CHECKPOINT_BUDGET_MB);
+                printf("\t-m,--sampling=FF:WARM:MEASURE\n");
+                printf("\t                        run the models only in a warm-up and a measure window\n");
+                printf("\t                        after every FF instructions, and extrapolate the counters\n");
+                printf("\t-v,--bbv=FILE[:N[:K]]   write basic block vectors of every N instructions to FILE\n");
+                printf("\t                        (default %d), and choose at most K simpoints (default %d)\n",
+                    BBV_INTERVAL, BBV_MAX_K);
+                printf("\t-n,--ncpu=N[:QUANTUM]   run N CPUs in round-robin, QUANTUM instructions at a time\n");
+                printf("\t                        (default %d)\n", VCPU_QUANTUM);
+                printf("\t-z,--pmem=MB            use MB megabytes of physical memory (default %d)\n",
+                    PMEM_DEFAULT_SIZE >> 20);
+                printf("\t-H,--semihost=DIR       let the guest access the files in DIR by semihosting\n");
+                printf("\n");
+                exit(0);
     }
   }
 }
@@ -114,14 +299,26 @@ int init_monitor(int argc, char *argv[]) {
   /* Open the log file. */
   init_log();
 
+  /* Load the symbols for the monitor. */
+  int i;
+  for (i = 0; i < nr_elf_file; i ++) {
+    load_symbols(elf_file[i]);
+  }
+
   /* Test the implementation of the `CPU_state' structure. */
   reg_test();
 
+  /* Allocate the physical memory. */
+  Assert(pmem_mb > 0 && pmem_mb <= (PMEM_MAX_SIZE >> 20), "the physical memory should be 1 to %u MB",
+      PMEM_MAX_SIZE >> 20);
+  init_pmem(pmem_mb << 20);
+
   /* Load the image to memory. */
   long img_size = load_img();
 
   /* Initialize this virtual computer system. */
   restart();
+  init_vcpu(ncpu_spec);
 
   /* Compile the regular expressions. */
   init_regex();
@@ -130,9 +327,33 @@ int init_monitor(int argc, char *argv[]) {
   init_wp_pool();
 
   /* Initialize devices. */
+  init_replay(record_file, replay_file);
   init_device();
+  init_semihost(semihost_dir);
+
+  /* Load the snapshot. */
+  init_snapshot(load_file, save_spec, fork_server);
+  if (load_file != NULL) { img_size = pmem_size - ENTRY_START; }
+
+  /* Take the first checkpoint for reverse execution. */
+  init_reverse(checkpoint_spec);
+
+  init_difftest(diff_so_file, img_size, diff_batch, diff_lead, diff_mem);
+
+  /* Initialize the profiler. */
+  init_profile(profile_file);
+  init_ftrace(ftrace_file);
+  init_sample(sample_file, sample_period);
+
+  /* Initialize the cache simulator. */
+  init_cache();
+
+  /* Initialize the branch predictor. */
+  init_bpred(bpred);
 
-  init_difftest(diff_so_file, img_size);
+  /* Initialize sampled simulation and the collector of basic block vectors. */
+  init_fastfwd(sampling_spec);
+  init_bbv(bbv_spec);
 
   /* Display welcome message. */
   welcome();
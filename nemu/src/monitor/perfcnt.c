@@ -0,0 +1,13 @@
+#include "monitor/perfcnt.h"
+
+uint64_t perfcnt[NR_PERFCNT];
+
+uint64_t get_nr_guest_instr();
+
+uint64_t perfcnt_read(int idx) {
+  switch (idx) {
+    case PERFCNT_INSTR: return get_nr_guest_instr();
+    case PERFCNT_CYCLE: return get_nr_guest_instr() + perfcnt[PERFCNT_CYCLE];
+    default: return (idx > 0 && idx < NR_PERFCNT ? perfcnt[idx] : 0);
+  }
+}
@@ -0,0 +1,270 @@
+#include "nemu.h"
+#include "monitor/profile.h"
+#include "util/htable.h"
+
+#include <stdlib.h>
+
+#ifdef SIMPOINT
+
+/* Basic block vectors for SimPoint. The execution is cut into intervals
+ * of `interval' instructions, and the number of instructions executed in
+ * every block is counted for each interval. A block is the same as the
+ * one of the profiler: a straight-line run entered by a taken control
+ * transfer. The vectors are written to the file in the format of the
+ * SimPoint tool:
+ *
+ *   T:<block>:<instructions> :<block>:<instructions> ...
+ *
+ * Each vector is also reduced by a random projection to BBV_DIM
+ * dimensions, as SimPoint does. When the program ends, the projected
+ * vectors are clustered by k-means, and the interval closest to the
+ * centroid of each cluster is chosen to represent it, weighted by the
+ * size of the cluster. The choices are written to FILE.simpoints and
+ * FILE.weights, also in the format of SimPoint.
+ */
+
+#define BBV_DIM 15
+#define KMEANS_ITER 100
+
+bool is_bbv = false;
+
+static FILE *bbv_fp = NULL;
+static char *bbv_file = NULL;
+static uint64_t interval = BBV_INTERVAL;
+static int max_k = BBV_MAX_K;
+
+static HTable block_index;
+static uint32_t nr_block = 0, max_block = 0;
+static uint64_t *block_cnt = NULL;          // instructions in the current interval
+static double (*block_proj)[BBV_DIM] = NULL;
+static uint32_t *touched = NULL, nr_touched = 0;
+
+static vaddr_t cur_block;
+static uint64_t cur_block_instr = 0, interval_instr = 0;
+
+static double (*vecs)[BBV_DIM] = NULL;
+static uint32_t nr_vec = 0, max_vec = 0;
+
+/* a fixed seed, so the same run always gives the same choices */
+static uint64_t rand_state = 0x9e3779b97f4a7c15ull;
+
+static inline uint64_t bbv_rand() {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 7;
+  rand_state ^= rand_state << 17;
+  return rand_state;
+}
+
+static uint32_t block_id(vaddr_t block) {
+  uint32_t *idx = htable_get(&block_index, block);
+  if (*idx == HTABLE_EMPTY) {
+    if (nr_block == max_block) {
+      max_block = (max_block == 0 ? 4096 : max_block * 2);
+      block_cnt = realloc(block_cnt, sizeof(block_cnt[0]) * max_block);
+      block_proj = realloc(block_proj, sizeof(block_proj[0]) * max_block);
+      touched = realloc(touched, sizeof(touched[0]) * max_block);
+      assert(block_cnt != NULL && block_proj != NULL && touched != NULL);
+    }
+    block_cnt[nr_block] = 0;
+    int d;
+    for (d = 0; d < BBV_DIM; d ++) {
+      block_proj[nr_block][d] = (double)(bbv_rand() >> 11) / (1ull << 53) * 2 - 1;
+    }
+    *idx = nr_block ++;
+  }
+  return *idx;
+}
+
+static inline void block_flush() {
+  if (cur_block_instr == 0) return;
+  uint32_t id = block_id(cur_block);
+  if (block_cnt[id] == 0) { touched[nr_touched ++] = id; }
+  block_cnt[id] += cur_block_instr;
+  cur_block_instr = 0;
+}
+
+static void interval_end() {
+  block_flush();
+
+  if (nr_vec == max_vec) {
+    max_vec = (max_vec == 0 ? 1024 : max_vec * 2);
+    vecs = realloc(vecs, sizeof(vecs[0]) * max_vec);
+    assert(vecs != NULL);
+  }
+  double *v = vecs[nr_vec ++];
+  memset(v, 0, sizeof(vecs[0]));
+
+  fprintf(bbv_fp, "T");
+  uint32_t i;
+  for (i = 0; i < nr_touched; i ++) {
+    uint32_t id = touched[i];
+    fprintf(bbv_fp, ":%u:%lu ", id + 1, block_cnt[id]);
+    int d;
+    for (d = 0; d < BBV_DIM; d ++) {
+      v[d] += block_proj[id][d] * block_cnt[id] / interval;
+    }
+    block_cnt[id] = 0;
+  }
+  fprintf(bbv_fp, "\n");
+  nr_touched = 0;
+  interval_instr = 0;
+}
+
+void bbv_step(vaddr_t eip, vaddr_t seq_eip, vaddr_t next_eip) {
+  cur_block_instr ++;
+  if (next_eip != seq_eip) {
+    block_flush();
+    cur_block = next_eip;
+  }
+  if (++ interval_instr == interval) { interval_end(); }
+}
+
+void init_bbv(char *spec) {
+  if (spec == NULL) return;
+
+  bbv_file = strtok(spec, ":");
+  char *p = strtok(NULL, ":");
+  if (p != NULL) {
+    interval = strtoull(p, NULL, 0);
+    p = strtok(NULL, ":");
+    if (p != NULL) { max_k = atoi(p); }
+  }
+  Assert(interval > 0 && max_k > 0, "the interval and the number of clusters should be positive");
+
+  bbv_fp = fopen(bbv_file, "w");
+  Assert(bbv_fp, "Can not open '%s'", bbv_file);
+  htable_init(&block_index, 4096);
+  cur_block = cpu.eip;
+  is_bbv = true;
+
+  Log("Basic block vectors: \33[1;32m%s\33[0m, one vector every %lu instructions, at most %d simpoints",
+      "ON", interval, max_k);
+}
+
+/* ------------------------------ k-means ------------------------------- */
+
+static inline double dist2(const double *a, const double *b) {
+  double sum = 0;
+  int d;
+  for (d = 0; d < BBV_DIM; d ++) { sum += (a[d] - b[d]) * (a[d] - b[d]); }
+  return sum;
+}
+
+/* cluster the vectors into at most `k' clusters, return the number of
+ * clusters, and the cluster of every vector in `assign' */
+static int kmeans(int k, uint32_t *assign, double (*center)[BBV_DIM]) {
+  uint32_t i;
+  int c;
+  double *d2 = malloc(sizeof(double) * nr_vec);
+  assert(d2 != NULL);
+
+  /* k-means++ seeding */
+  memcpy(center[0], vecs[bbv_rand() % nr_vec], sizeof(center[0]));
+  for (i = 0; i < nr_vec; i ++) { d2[i] = dist2(vecs[i], center[0]); }
+  int nr_center = 1;
+  while (nr_center < k) {
+    double sum = 0;
+    for (i = 0; i < nr_vec; i ++) { sum += d2[i]; }
+    if (sum == 0) break;   // fewer distinct vectors than `k'
+    double r = (double)(bbv_rand() >> 11) / (1ull << 53) * sum;
+    for (i = 0; i < nr_vec - 1 && r >= d2[i]; i ++) { r -= d2[i]; }
+    memcpy(center[nr_center], vecs[i], sizeof(center[0]));
+    for (i = 0; i < nr_vec; i ++) {
+      double d = dist2(vecs[i], center[nr_center]);
+      if (d < d2[i]) d2[i] = d;
+    }
+    nr_center ++;
+  }
+  free(d2);
+
+  uint32_t *size = malloc(sizeof(uint32_t) * nr_center);
+  assert(size != NULL);
+  int iter;
+  for (iter = 0; iter < KMEANS_ITER; iter ++) {
+    bool changed = false;
+    for (i = 0; i < nr_vec; i ++) {
+      int best = 0;
+      for (c = 1; c < nr_center; c ++) {
+        if (dist2(vecs[i], center[c]) < dist2(vecs[i], center[best])) best = c;
+      }
+      if (iter == 0 || assign[i] != best) { assign[i] = best; changed = true; }
+    }
+    if (!changed) break;
+
+    memset(center, 0, sizeof(center[0]) * nr_center);
+    memset(size, 0, sizeof(uint32_t) * nr_center);
+    for (i = 0; i < nr_vec; i ++) {
+      int d;
+      for (d = 0; d < BBV_DIM; d ++) { center[assign[i]][d] += vecs[i][d]; }
+      size[assign[i]] ++;
+    }
+    for (c = 0; c < nr_center; c ++) {
+      int d;
+      /* an empty cluster keeps its center at the origin, and stays empty
+       * unless some vector is the closest to it */
+      for (d = 0; d < BBV_DIM && size[c] > 0; d ++) { center[c][d] /= size[c]; }
+    }
+  }
+  free(size);
+  return nr_center;
+}
+
+void bbv_report() {
+  if (!is_bbv) return;
+
+  /* the last interval is not complete, and is not a candidate */
+  fclose(bbv_fp);
+  printflog("==================== simpoint ====================\n");
+  Log("%u basic block vectors of %lu instructions are written to %s", nr_vec, interval, bbv_file);
+  if (nr_vec == 0) {
+    printflog("No complete interval, use a shorter one\n");
+    return;
+  }
+
+  int k = (max_k < nr_vec ? max_k : nr_vec);
+  uint32_t *assign = malloc(sizeof(uint32_t) * nr_vec);
+  double (*center)[BBV_DIM] = malloc(sizeof(center[0]) * k);
+  assert(assign != NULL && center != NULL);
+  k = kmeans(k, assign, center);
+
+  char name[256];
+  snprintf(name, sizeof(name), "%s.simpoints", bbv_file);
+  FILE *sp = fopen(name, "w");
+  snprintf(name, sizeof(name), "%s.weights", bbv_file);
+  FILE *wt = fopen(name, "w");
+  Assert(sp && wt, "Can not open the output files of simpoints");
+
+  printflog("  %-7s %10s %20s %8s\n", "cluster", "interval", "start instruction", "weight");
+  int c, nr_point = 0;
+  for (c = 0; c < k; c ++) {
+    uint32_t i, size = 0, best = 0;
+    double best_d = -1;
+    for (i = 0; i < nr_vec; i ++) {
+      if (assign[i] != c) continue;
+      size ++;
+      double d = dist2(vecs[i], center[c]);
+      if (best_d < 0 || d < best_d) { best_d = d; best = i; }
+    }
+    if (size == 0) continue;
+    double weight = (double)size / nr_vec;
+    fprintf(sp, "%u %d\n", best, nr_point);
+    fprintf(wt, "%f %d\n", weight, nr_point);
+    printflog("  %-7d %10u %20lu %8.4f\n", nr_point, best, best * interval, weight);
+    nr_point ++;
+  }
+  fclose(sp);
+  fclose(wt);
+
+  free(assign);
+  free(center);
+}
+
+#else
+
+void init_bbv(char *spec) {
+  if (spec != NULL) {
+    Log("Basic block vectors are not enabled, define SIMPOINT in include/common.h to enable them");
+  }
+}
+
+#endif
@@ -0,0 +1,143 @@
+#include "nemu.h"
+#include "monitor/perfcnt.h"
+#include "monitor/profile.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+/* Sampled simulation. The timing models (cache, branch predictor) and the
+ * profiler only run while `is_detailed' is set. With `--sampling', the
+ * execution is cut into periods of
+ *
+ *   | fast-forward | warm-up | measure |
+ *
+ * The models are turned off while fast-forwarding, so they cost nothing
+ * but a branch. They are turned on during the warm-up window to fill the
+ * caches and the predictor tables, and the performance counters are only
+ * accounted during the measure window. Every measure window is a sample,
+ * and the totals of the whole run are extrapolated from the mean rate of
+ * the samples, with a 95% confidence interval.
+ */
+
+bool is_detailed = true;
+
+#ifdef SIMPOINT
+
+/* never reach zero if sampling is disabled */
+uint64_t ff_countdown = -1ull;
+
+enum { PHASE_FF, PHASE_WARM, PHASE_MEASURE, NR_PHASE };
+
+static uint64_t phase_len[NR_PHASE];
+static int phase = PHASE_FF;
+static bool is_sampling = false;
+
+/* the counters which are extrapolated */
+static const struct {
+  int idx;
+  const char *name;
+} counters[] = {
+  { PERFCNT_CYCLE, "cycle" },
+  { PERFCNT_TLB_ACCESS, "tlb access" },
+  { PERFCNT_TLB_MISS, "tlb miss" },
+  { PERFCNT_ICACHE_ACCESS, "l1i access" },
+  { PERFCNT_ICACHE_MISS, "l1i miss" },
+  { PERFCNT_DCACHE_ACCESS, "l1d access" },
+  { PERFCNT_DCACHE_MISS, "l1d miss" },
+  { PERFCNT_L2_ACCESS, "l2 access" },
+  { PERFCNT_L2_MISS, "l2 miss" },
+  { PERFCNT_BRANCH, "branch" },
+  { PERFCNT_BRANCH_MISS, "branch miss" },
+};
+#define NR_COUNTER (sizeof(counters) / sizeof(counters[0]))
+
+static uint64_t base[NR_COUNTER];
+/* the sums of the rates per instruction, and of their squares */
+static double rate_sum[NR_COUNTER], rate_sum2[NR_COUNTER];
+static uint64_t nr_sample = 0;
+
+uint64_t get_nr_guest_instr();
+
+static void enter(int p) {
+  /* skip the windows of length 0 */
+  while (phase_len[p] == 0) { p = (p + 1) % NR_PHASE; }
+  phase = p;
+  ff_countdown = phase_len[p];
+  is_detailed = (p != PHASE_FF);
+
+  if (p == PHASE_MEASURE) {
+    int i;
+    for (i = 0; i < NR_COUNTER; i ++) { base[i] = perfcnt_read(counters[i].idx); }
+  }
+}
+
+void fastfwd_switch() {
+  if (phase == PHASE_MEASURE) {
+    int i;
+    for (i = 0; i < NR_COUNTER; i ++) {
+      double rate = (double)(perfcnt_read(counters[i].idx) - base[i]) / phase_len[PHASE_MEASURE];
+      rate_sum[i] += rate;
+      rate_sum2[i] += rate * rate;
+    }
+    nr_sample ++;
+  }
+  enter((phase + 1) % NR_PHASE);
+}
+
+void init_fastfwd(char *spec) {
+  if (spec == NULL) return;
+
+  char *p = spec;
+  int i;
+  for (i = 0; i < NR_PHASE; i ++) {
+    phase_len[i] = strtoull(p, &p, 0);
+    if (i < NR_PHASE - 1) {
+      Assert(*p == ':', "sampling should be FF:WARM:MEASURE, got '%s'", spec);
+      p ++;
+    }
+  }
+  Assert(phase_len[PHASE_MEASURE] > 0, "the measure window should not be empty");
+
+  is_sampling = true;
+  enter(PHASE_FF);
+  Log("Sampled simulation: \33[1;32m%s\33[0m, fast-forward %lu, warm up %lu, measure %lu instructions",
+      "ON", phase_len[PHASE_FF], phase_len[PHASE_WARM], phase_len[PHASE_MEASURE]);
+}
+
+void fastfwd_report() {
+  if (!is_sampling) return;
+
+  uint64_t total = get_nr_guest_instr();
+  printflog("==================== sampling ====================\n");
+  printflog("%lu samples of %lu instructions, %.2f%% of %lu instructions are measured\n",
+      nr_sample, phase_len[PHASE_MEASURE],
+      (total == 0 ? 0 : 100.0 * nr_sample * phase_len[PHASE_MEASURE] / total), total);
+  if (nr_sample == 0) {
+    printflog("No complete sample, use shorter windows\n");
+    return;
+  }
+  printflog("The reports of the models above only count the warm-up and measure windows\n");
+
+  printflog("  %-12s %14s %14s %20s\n", "counter", "per 1k instr", "+-95%", "extrapolated");
+  int i;
+  for (i = 0; i < NR_COUNTER; i ++) {
+    double mean = rate_sum[i] / nr_sample;
+    if (mean == 0) continue;
+    double var = (nr_sample > 1 ?
+        (rate_sum2[i] - nr_sample * mean * mean) / (nr_sample - 1) : 0);
+    double ci = 1.96 * sqrt(var > 0 ? var : 0) / sqrt(nr_sample);
+    printflog("  %-12s %14.3f %14.3f %20.0f\n", counters[i].name,
+        mean * 1000, ci * 1000, mean * total);
+  }
+  printflog("Estimated CPI = %.3f\n", rate_sum[0] / nr_sample);
+}
+
+#else
+
+void init_fastfwd(char *spec) {
+  if (spec != NULL) {
+    Log("Sampled simulation is not enabled, define SIMPOINT in include/common.h to enable it");
+  }
+}
+
+#endif
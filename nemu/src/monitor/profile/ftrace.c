@@ -0,0 +1,248 @@
+#include "nemu.h"
+#include "cpu/decode.h"
+#include "monitor/profile.h"
+#include "monitor/symbol.h"
+#include "util/htable.h"
+
+#ifdef FTRACE
+
+#include <stdlib.h>
+
+/* Function trace. Every `call' and `ret' is recorded into a ring buffer.
+ * A shadow call stack is maintained to attribute the executed instructions
+ * to functions (inclusive and exclusive) and to call stacks. The call
+ * stacks are stored as a tree, and are written in the folded-stack format
+ * which is accepted by flamegraph.pl.
+ */
+
+#define NR_FTRACE_EVENT 4096
+#define MAX_FRAME 1024
+
+typedef struct {
+  uint64_t instr;
+  vaddr_t pc, target;
+  uint16_t depth;
+  bool is_call;
+} Event;
+
+typedef struct {
+  vaddr_t func, ret_addr;
+  uint64_t entry_instr, child_instr;
+  uint32_t node;
+} Frame;
+
+/* a node in the call-stack tree */
+typedef struct {
+  uint32_t parent;
+  vaddr_t func;
+  uint64_t self;
+} Node;
+
+typedef struct {
+  vaddr_t func;
+  uint64_t calls, incl, excl;
+} FuncStat;
+
+static Event events[NR_FTRACE_EVENT];
+static int event_idx = 0;
+static uint64_t nr_event = 0;
+
+static Frame frames[MAX_FRAME];
+static int sp = 0;
+static int nr_overflow = 0;
+
+static Node *nodes = NULL;
+static uint32_t nr_node = 0, max_node = 0;
+static uint32_t cur_node = 0;
+static HTable node_index;
+
+static FuncStat *funcs = NULL;
+static uint32_t nr_func = 0, max_func = 0;
+static HTable func_index;
+
+static uint64_t nr_instr = 0;
+static uint64_t last_event_instr = 0;
+static char *ftrace_file = NULL;
+
+static uint32_t new_node(uint32_t parent, vaddr_t func) {
+  if (nr_node == max_node) {
+    max_node = (max_node == 0 ? 4096 : max_node * 2);
+    nodes = realloc(nodes, sizeof(Node) * max_node);
+    assert(nodes != NULL);
+  }
+  nodes[nr_node] = (Node) { .parent = parent, .func = func, .self = 0 };
+  return nr_node ++;
+}
+
+static uint32_t get_child(uint32_t parent, vaddr_t func) {
+  uint32_t *idx = htable_get(&node_index, ((uint64_t)parent << 32) | func);
+  if (*idx == HTABLE_EMPTY) { *idx = new_node(parent, func); }
+  return *idx;
+}
+
+static FuncStat* get_func(vaddr_t func) {
+  uint32_t *idx = htable_get(&func_index, func);
+  if (*idx == HTABLE_EMPTY) {
+    if (nr_func == max_func) {
+      max_func = (max_func == 0 ? 1024 : max_func * 2);
+      funcs = realloc(funcs, sizeof(FuncStat) * max_func);
+      assert(funcs != NULL);
+    }
+    funcs[nr_func] = (FuncStat) { .func = func };
+    *idx = nr_func ++;
+  }
+  return &funcs[*idx];
+}
+
+void init_ftrace(char *out_file) {
+  ftrace_file = out_file;
+  htable_init(&node_index, 4096);
+  htable_init(&func_index, 1024);
+
+  /* the root of the tree stands for the code executed before any call */
+  cur_node = new_node(0, cpu.eip);
+
+  Log("Function trace: \33[1;32m%s\33[0m", "ON");
+}
+
+static inline void record_event(vaddr_t pc, vaddr_t target, bool is_call) {
+  events[event_idx] = (Event) { .instr = nr_instr, .pc = pc, .target = target,
+    .depth = sp, .is_call = is_call };
+  event_idx = (event_idx + 1) % NR_FTRACE_EVENT;
+  nr_event ++;
+
+  nodes[cur_node].self += nr_instr - last_event_instr;
+  last_event_instr = nr_instr;
+}
+
+static void push_frame(vaddr_t func, vaddr_t ret_addr) {
+  if (sp == MAX_FRAME) {
+    nr_overflow ++;
+    return;
+  }
+  cur_node = get_child(cur_node, func);
+  frames[sp ++] = (Frame) { .func = func, .ret_addr = ret_addr,
+    .entry_instr = nr_instr, .child_instr = 0, .node = cur_node };
+  get_func(func)->calls ++;
+}
+
+static void pop_frame() {
+  Frame *f = &frames[-- sp];
+  uint64_t incl = nr_instr - f->entry_instr;
+  FuncStat *s = get_func(f->func);
+  s->incl += incl;
+  s->excl += incl - f->child_instr;
+  if (sp > 0) { frames[sp - 1].child_instr += incl; }
+  cur_node = nodes[f->node].parent;
+}
+
+void ftrace_step(vaddr_t eip, vaddr_t seq_eip, vaddr_t next_eip) {
+  nr_instr ++;
+
+  uint32_t opcode = decoding.opcode;
+  if (opcode == 0xe8 || (opcode == 0xff && decoding.ext_opcode == 2)) {
+    /* call */
+    record_event(eip, next_eip, true);
+    push_frame(next_eip, seq_eip);
+  }
+  else if (opcode == 0xc3 || opcode == 0xc2) {
+    /* ret */
+    record_event(eip, next_eip, false);
+    if (nr_overflow > 0) {
+      nr_overflow --;
+      return;
+    }
+
+    /* Frames may be skipped by longjmp() or context switches,
+     * so search for the frame this `ret' returns to. */
+    int i;
+    for (i = sp - 1; i >= 0 && frames[i].ret_addr != next_eip; i --);
+    if (i < 0) return;
+    while (sp > i) { pop_frame(); }
+  }
+}
+
+void ftrace_dump(int n) {
+  char sym[SYM_STR_SIZE];
+  if (n > nr_event) n = nr_event;
+  if (n > NR_FTRACE_EVENT) n = NR_FTRACE_EVENT;
+
+  int i;
+  for (i = n; i > 0; i --) {
+    Event *e = &events[(event_idx - i + NR_FTRACE_EVENT) % NR_FTRACE_EVENT];
+    printf("%12lu 0x%08x: %*s%s %s\n", e->instr, e->pc, e->depth * 2, "",
+        (e->is_call ? "call" : "ret to"), symbol_str(e->target, sym));
+  }
+}
+
+static void write_folded(FILE *fp) {
+  char buf[SYM_STR_SIZE];
+  uint32_t *path = malloc(sizeof(uint32_t) * nr_node);
+  assert(path != NULL);
+
+  uint32_t i;
+  for (i = 0; i < nr_node; i ++) {
+    if (nodes[i].self == 0) continue;
+
+    int depth = 0;
+    uint32_t n = i;
+    while (true) {
+      path[depth ++] = n;
+      if (n == 0) break;
+      n = nodes[n].parent;
+    }
+    while (depth > 0) {
+      depth --;
+      fprintf(fp, "%s%c", symbol_name(nodes[path[depth]].func, buf), (depth == 0 ? ' ' : ';'));
+    }
+    fprintf(fp, "%lu\n", nodes[i].self);
+  }
+  free(path);
+}
+
+static int cmp_func_excl(const void *a, const void *b) {
+  const FuncStat *x = a, *y = b;
+  if (x->excl != y->excl) { return (x->excl < y->excl ? 1 : -1); }
+  return (x->func < y->func ? -1 : x->func > y->func);
+}
+
+void ftrace_report() {
+  /* account for the functions which have not returned */
+  nodes[cur_node].self += nr_instr - last_event_instr;
+  last_event_instr = nr_instr;
+  while (sp > 0) { pop_frame(); }
+
+  char buf[SYM_STR_SIZE];
+  qsort(funcs, nr_func, sizeof(FuncStat), cmp_func_excl);
+  printflog("==================== ftrace ====================\n");
+  printflog("Top %d functions by exclusive instructions (%d distinct, %lu calls/rets):\n",
+      PROFILE_TOP_N, nr_func, nr_event);
+  printflog("  %-32s %12s %14s %14s\n", "function", "calls", "exclusive", "inclusive");
+  int i;
+  for (i = 0; i < nr_func && i < PROFILE_TOP_N; i ++) {
+    printflog("  %-32s %12lu %14lu %14lu\n", symbol_name(funcs[i].func, buf),
+        funcs[i].calls, funcs[i].excl, funcs[i].incl);
+  }
+
+  if (ftrace_file != NULL) {
+    FILE *fp = fopen(ftrace_file, "w");
+    Assert(fp, "Can not open '%s'", ftrace_file);
+    write_folded(fp);
+    fclose(fp);
+    Log("Folded call stacks are written to %s", ftrace_file);
+  }
+}
+
+#else
+
+void init_ftrace(char *out_file) {
+  if (out_file != NULL) {
+    Log("Function trace is not enabled, define FTRACE in include/common.h to enable it");
+  }
+}
+
+void ftrace_dump(int n) {
+  printf("Function trace is not enabled\n");
+}
+
+#endif
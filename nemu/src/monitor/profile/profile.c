@@ -0,0 +1,329 @@
+#include "nemu.h"
+#include "cpu/decode.h"
+#include "monitor/profile.h"
+#include "monitor/symbol.h"
+#include "util/htable.h"
+
+#ifdef PROFILE
+
+#include <stdlib.h>
+
+/* Per-eip execution counters are kept in a sparse page table: one counter
+ * array is allocated for every 4KB page of guest code which is executed.
+ * Blocks and control-transfer edges are kept in open addressing hash tables.
+ * A block here is a straight-line run of instructions which is entered
+ * by a taken control transfer and left by the next one.
+ */
+
+#define CNT_PAGE_SHIFT 12
+#define CNT_PAGE_SIZE (1 << CNT_PAGE_SHIFT)
+#define NR_CNT_PAGE (1 << (32 - CNT_PAGE_SHIFT))
+
+/* backward edges spanning more than this are not considered as loops */
+#define MAX_LOOP_SIZE 0x10000
+
+static uint64_t *eip_cnt[NR_CNT_PAGE];
+static uint64_t opcode_cnt[512];
+static uint64_t nr_instr = 0;
+static char *profile_file = NULL;
+
+#ifdef DEBUG
+#define MNEMONIC_LEN 16
+static char opcode_name[512][MNEMONIC_LEN];
+#endif
+
+typedef struct {
+  uint64_t key;
+  uint64_t cnt;    // number of times the edge is taken or the block is entered
+  uint64_t instr;  // number of instructions executed in the block
+} Record;
+
+typedef struct {
+  HTable index;
+  Record *rec;
+  uint32_t nr, size;
+} RecordTable;
+
+static RecordTable edges, blocks;
+
+static vaddr_t cur_block;
+static uint64_t cur_block_instr = 0;
+
+static void record_table_init(RecordTable *t, uint32_t size) {
+  htable_init(&t->index, size);
+  t->rec = malloc(sizeof(Record) * size);
+  assert(t->rec != NULL);
+  t->nr = 0;
+  t->size = size;
+}
+
+/* find the record of `key', and create it if it does not exist */
+static Record* record_get(RecordTable *t, uint64_t key) {
+  uint32_t *idx = htable_get(&t->index, key);
+  if (*idx == HTABLE_EMPTY) {
+    if (t->nr == t->size) {
+      t->size *= 2;
+      t->rec = realloc(t->rec, sizeof(Record) * t->size);
+      assert(t->rec != NULL);
+    }
+    *idx = t->nr ++;
+    t->rec[*idx] = (Record) { .key = key };
+  }
+  return &t->rec[*idx];
+}
+
+static inline uint64_t* get_cnt_page(vaddr_t eip) {
+  uint64_t **p = &eip_cnt[eip >> CNT_PAGE_SHIFT];
+  if (*p == NULL) {
+    *p = calloc(CNT_PAGE_SIZE, sizeof(uint64_t));
+    assert(*p != NULL);
+  }
+  return *p;
+}
+
+static uint64_t eip_count(vaddr_t eip) {
+  uint64_t *p = eip_cnt[eip >> CNT_PAGE_SHIFT];
+  return (p == NULL ? 0 : p[eip & (CNT_PAGE_SIZE - 1)]);
+}
+
+/* the sum of the counters of all eips in [lo, hi] */
+static uint64_t range_count(vaddr_t lo, vaddr_t hi) {
+  uint64_t sum = 0;
+  vaddr_t eip;
+  for (eip = lo; eip <= hi && eip >= lo; eip ++) {
+    sum += eip_count(eip);
+  }
+  return sum;
+}
+
+void init_profile(char *out_file) {
+  profile_file = out_file;
+  record_table_init(&edges, 4096);
+  record_table_init(&blocks, 4096);
+  cur_block = cpu.eip;
+  record_get(&blocks, cur_block)->cnt ++;
+
+  Log("Profiler: \33[1;32m%s\33[0m", "ON");
+}
+
+static inline void block_flush() {
+  record_get(&blocks, cur_block)->instr += cur_block_instr;
+  cur_block_instr = 0;
+}
+
+static inline void block_end(vaddr_t next_block) {
+  block_flush();
+  cur_block = next_block;
+  record_get(&blocks, cur_block)->cnt ++;
+}
+
+void profile_step(vaddr_t eip, vaddr_t seq_eip, vaddr_t next_eip) {
+  get_cnt_page(eip)[eip & (CNT_PAGE_SIZE - 1)] ++;
+  opcode_cnt[decoding.opcode & 0x1ff] ++;
+  nr_instr ++;
+  cur_block_instr ++;
+
+#ifdef DEBUG
+  char *name = opcode_name[decoding.opcode & 0x1ff];
+  if (name[0] == '\0') {
+    sscanf(decoding.assembly, "%15s", name);
+  }
+#endif
+
+  if (next_eip != seq_eip) {
+    record_get(&edges, ((uint64_t)eip << 32) | next_eip)->cnt ++;
+    block_end(next_eip);
+  }
+}
+
+/* ------------------------------- report ------------------------------- */
+
+/* The profile file contains one record per line:
+ *   total  <instructions>
+ *   eip    <eip> <count>
+ *   block  <entry> <entries> <instructions>
+ *   edge   <from> <to> <count>
+ *   opcode <opcode> <count>      (0x1xx for two-byte opcodes)
+ */
+
+typedef struct {
+  vaddr_t lo, hi;
+  uint64_t cnt, instr;
+} Item;
+
+static int cmp_item_instr(const void *a, const void *b) {
+  const Item *x = a, *y = b;
+  if (x->instr != y->instr) { return (x->instr < y->instr ? 1 : -1); }
+  return (x->lo < y->lo ? -1 : x->lo > y->lo);
+}
+
+static int cmp_item_lo(const void *a, const void *b) {
+  const Item *x = a, *y = b;
+  return (x->lo < y->lo ? -1 : x->lo > y->lo);
+}
+
+/* the symbol of `addr', or an empty string if it is unknown */
+static inline const char* sym(vaddr_t addr, char *buf) {
+  if (symbol_find(addr, NULL) == NULL) return "";
+  return symbol_str(addr, buf);
+}
+
+static inline double share(uint64_t n) {
+  return (nr_instr == 0 ? 0 : 100.0 * n / nr_instr);
+}
+
+static void report_eips(FILE *fp) {
+  int nr_item = 0, i, j;
+  for (i = 0; i < NR_CNT_PAGE; i ++) {
+    if (eip_cnt[i] == NULL) continue;
+    for (j = 0; j < CNT_PAGE_SIZE; j ++) {
+      if (eip_cnt[i][j] != 0) nr_item ++;
+    }
+  }
+
+  Item *items = malloc(sizeof(Item) * (nr_item + 1));
+  assert(items != NULL);
+  int k = 0;
+  for (i = 0; i < NR_CNT_PAGE; i ++) {
+    if (eip_cnt[i] == NULL) continue;
+    for (j = 0; j < CNT_PAGE_SIZE; j ++) {
+      if (eip_cnt[i][j] != 0) {
+        vaddr_t eip = ((vaddr_t)i << CNT_PAGE_SHIFT) | j;
+        items[k] = (Item) { .lo = eip, .hi = eip, .cnt = eip_cnt[i][j], .instr = eip_cnt[i][j] };
+        if (fp) fprintf(fp, "eip 0x%08x %lu\n", eip, eip_cnt[i][j]);
+        k ++;
+      }
+    }
+  }
+
+  qsort(items, nr_item, sizeof(Item), cmp_item_instr);
+  char buf[SYM_STR_SIZE];
+  printflog("Top %d hot eips (%d distinct):\n", PROFILE_TOP_N, nr_item);
+  for (i = 0; i < nr_item && i < PROFILE_TOP_N; i ++) {
+    printflog("  0x%08x %14lu %6.2f%%  %s\n", items[i].lo, items[i].instr,
+        share(items[i].instr), sym(items[i].lo, buf));
+  }
+  free(items);
+}
+
+static void report_blocks(FILE *fp) {
+  Item *items = malloc(sizeof(Item) * (blocks.nr + 1));
+  assert(items != NULL);
+  int nr_item = 0, i;
+  for (i = 0; i < blocks.nr; i ++) {
+    Record *e = &blocks.rec[i];
+    items[nr_item ++] = (Item) { .lo = e->key, .cnt = e->cnt, .instr = e->instr };
+    if (fp) fprintf(fp, "block 0x%08x %lu %lu\n", (vaddr_t)e->key, e->cnt, e->instr);
+  }
+
+  qsort(items, nr_item, sizeof(Item), cmp_item_instr);
+  printflog("Top %d hot blocks (%d distinct):\n", PROFILE_TOP_N, nr_item);
+  char buf[SYM_STR_SIZE];
+  printflog("  %-10s %14s %14s %7s\n", "entry", "entries", "instr", "share");
+  for (i = 0; i < nr_item && i < PROFILE_TOP_N; i ++) {
+    printflog("  0x%08x %14lu %14lu %6.2f%%  %s\n", items[i].lo, items[i].cnt,
+        items[i].instr, share(items[i].instr), sym(items[i].lo, buf));
+  }
+  free(items);
+}
+
+static void report_loops(FILE *fp) {
+  Item *items = malloc(sizeof(Item) * (edges.nr + 1));
+  assert(items != NULL);
+  int nr_item = 0, i;
+  for (i = 0; i < edges.nr; i ++) {
+    Record *e = &edges.rec[i];
+    vaddr_t from = e->key >> 32, to = (uint32_t)e->key;
+    if (fp) fprintf(fp, "edge 0x%08x 0x%08x %lu\n", from, to, e->cnt);
+
+    /* a taken backward edge closes a loop whose body is [to, from] */
+    if (to <= from && from - to < MAX_LOOP_SIZE) {
+      items[nr_item ++] = (Item) { .lo = to, .hi = from, .cnt = e->cnt,
+        .instr = range_count(to, from) };
+    }
+  }
+
+  qsort(items, nr_item, sizeof(Item), cmp_item_instr);
+  int nr_top = (nr_item < PROFILE_TOP_N ? nr_item : PROFILE_TOP_N);
+  printflog("Top %d loops (%d distinct):\n", PROFILE_TOP_N, nr_item);
+  char buf[SYM_STR_SIZE];
+  printflog("  %-23s %14s %14s %7s\n", "body", "iterations", "instr", "share");
+  for (i = 0; i < nr_top; i ++) {
+    printflog("  0x%08x-0x%08x %14lu %14lu %6.2f%%  %s\n", items[i].lo, items[i].hi,
+        items[i].cnt, items[i].instr, share(items[i].instr), sym(items[i].lo, buf));
+  }
+
+  /* nested loops overlap, so count the union of the loop bodies */
+  qsort(items, nr_top, sizeof(Item), cmp_item_lo);
+  uint64_t total = 0;
+  vaddr_t covered = 0;
+  bool has_covered = false;
+  for (i = 0; i < nr_top; i ++) {
+    vaddr_t lo = items[i].lo;
+    if (has_covered && lo <= covered) {
+      if (items[i].hi <= covered) continue;
+      lo = covered + 1;
+    }
+    total += range_count(lo, items[i].hi);
+    covered = items[i].hi;
+    has_covered = true;
+  }
+  printflog("Top %d loops cover %.2f%% of all instructions\n", nr_top, share(total));
+  free(items);
+}
+
+static void report_opcodes(FILE *fp) {
+  Item items[512];
+  int nr_item = 0, i;
+  for (i = 0; i < 512; i ++) {
+    if (opcode_cnt[i] == 0) continue;
+    items[nr_item ++] = (Item) { .lo = i, .instr = opcode_cnt[i] };
+    if (fp) fprintf(fp, "opcode 0x%03x %lu\n", i, opcode_cnt[i]);
+  }
+
+  qsort(items, nr_item, sizeof(Item), cmp_item_instr);
+  printflog("Instruction mix by opcode:\n");
+  for (i = 0; i < nr_item; i ++) {
+    const char *name = "";
+#ifdef DEBUG
+    name = opcode_name[items[i].lo];
+#endif
+    char op[8];
+    if (items[i].lo > 0xff) { sprintf(op, "0f %02x", items[i].lo & 0xff); }
+    else { sprintf(op, "%02x", items[i].lo); }
+    printflog("  %-5s %-10s %14lu %6.2f%%\n", op, name, items[i].instr, share(items[i].instr));
+  }
+}
+
+void profile_report() {
+  /* account for the instructions of the block being executed */
+  block_flush();
+
+  FILE *fp = NULL;
+  if (profile_file != NULL) {
+    fp = fopen(profile_file, "w");
+    Assert(fp, "Can not open '%s'", profile_file);
+    fprintf(fp, "total %lu\n", nr_instr);
+  }
+
+  printflog("==================== profile ====================\n");
+  report_eips(fp);
+  report_blocks(fp);
+  report_loops(fp);
+  report_opcodes(fp);
+
+  if (fp != NULL) {
+    fclose(fp);
+    Log("Profile is written to %s", profile_file);
+  }
+}
+
+#else
+
+void init_profile(char *out_file) {
+  if (out_file != NULL) {
+    Log("Profiler is not enabled, define PROFILE in include/common.h to enable it");
+  }
+}
+
+#endif
@@ -0,0 +1,204 @@
+#include "nemu.h"
+#include "monitor/profile.h"
+#include "monitor/symbol.h"
+#include "util/htable.h"
+
+#include <stdlib.h>
+
+#ifdef SAMPLE
+
+/* Sampling profiler. Every `sample_period' guest instructions, the eip,
+ * CR3 and the return addresses found by walking the frame pointer chain
+ * are recorded into a ring. AM and nanos-lite are built with
+ * `-fno-omit-frame-pointer', so the walk gives the whole call stack.
+ * When the ring is full, identical stacks are merged into a table.
+ * Addresses are only symbolized when the report is written, where every
+ * stack is rooted at the address space (CR3) it is sampled in.
+ */
+
+#define NR_SAMPLE 4096
+#define MAX_SAMPLE_DEPTH 64
+
+typedef struct {
+  uint32_t cr3;
+  uint32_t depth;
+  vaddr_t pc[MAX_SAMPLE_DEPTH];
+} Sample;
+
+typedef struct {
+  Sample s;
+  uint64_t cnt;
+} Stack;
+
+/* never reach zero if sampling is disabled */
+uint64_t sample_countdown = -1ull;
+
+static uint64_t sample_period = 0;
+static Sample ring[NR_SAMPLE];
+static int nr_ring = 0;
+static uint64_t nr_sample = 0;
+
+static Stack *stacks = NULL;
+static uint32_t nr_stack = 0, max_stack = 0;
+static HTable stack_index;
+
+static char *sample_file = NULL;
+
+void init_sample(char *out_file, uint64_t period) {
+  if (out_file == NULL) return;
+
+  sample_file = out_file;
+  sample_period = (period == 0 ? SAMPLE_PERIOD : period);
+  sample_countdown = sample_period;
+  htable_init(&stack_index, 4096);
+
+  Log("Sampling profiler: \33[1;32m%s\33[0m, one sample every %lu instructions",
+      "ON", sample_period);
+}
+
+/* read a word of the guest stack, which may be corrupted */
+static inline bool stack_read(vaddr_t addr, uint32_t *data) {
+  if (addr & 0x3 || addr >= pmem_size - 4) return false;
+  *data = vaddr_read(addr, 4);
+  return true;
+}
+
+static uint64_t hash_sample(const Sample *s) {
+  uint64_t h = 0xcbf29ce484222325ull ^ s->cr3;
+  int i;
+  for (i = 0; i < s->depth; i ++) {
+    h = (h ^ s->pc[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+static inline bool same_sample(const Sample *a, const Sample *b) {
+  return a->cr3 == b->cr3 && a->depth == b->depth &&
+    memcmp(a->pc, b->pc, sizeof(a->pc[0]) * a->depth) == 0;
+}
+
+static void merge_ring() {
+  int i;
+  for (i = 0; i < nr_ring; i ++) {
+    Sample *s = &ring[i];
+    /* a different stack with the same hash moves to the next key */
+    uint64_t key = hash_sample(s);
+    uint32_t *idx = htable_get(&stack_index, key);
+    while (*idx != HTABLE_EMPTY && !same_sample(&stacks[*idx].s, s)) {
+      idx = htable_get(&stack_index, ++ key);
+    }
+    if (*idx == HTABLE_EMPTY) {
+      if (nr_stack == max_stack) {
+        max_stack = (max_stack == 0 ? 4096 : max_stack * 2);
+        stacks = realloc(stacks, sizeof(Stack) * max_stack);
+        assert(stacks != NULL);
+      }
+      stacks[nr_stack].s = *s;
+      stacks[nr_stack].cnt = 0;
+      *idx = nr_stack ++;
+    }
+    stacks[*idx].cnt ++;
+  }
+  nr_ring = 0;
+}
+
+void sample_take() {
+  sample_countdown = sample_period;
+
+  Sample *s = &ring[nr_ring];
+  s->cr3 = cpu.cr3.val;
+  s->pc[0] = cpu.eip;
+  s->depth = 1;
+
+  /* walk the frame pointer chain: [ebp] is the caller's ebp,
+   * and [ebp + 4] is the return address */
+  vaddr_t fp = cpu.ebp;
+  while (s->depth < MAX_SAMPLE_DEPTH) {
+    uint32_t ret_addr, next_fp;
+    if (fp == 0 || !stack_read(fp + 4, &ret_addr) || !stack_read(fp, &next_fp)) break;
+    if (ret_addr == 0) break;
+    s->pc[s->depth ++] = ret_addr;
+    /* stacks grow downward, so the caller's frame is above */
+    if (next_fp <= fp) break;
+    fp = next_fp;
+  }
+
+  nr_sample ++;
+  if (++ nr_ring == NR_SAMPLE) { merge_ring(); }
+}
+
+typedef struct {
+  vaddr_t func;
+  uint64_t cnt;
+} FuncCnt;
+
+static int cmp_func_cnt(const void *a, const void *b) {
+  const FuncCnt *x = a, *y = b;
+  if (x->cnt != y->cnt) { return (x->cnt < y->cnt ? 1 : -1); }
+  return (x->func < y->func ? -1 : x->func > y->func);
+}
+
+/* count the samples of the functions on top of the stacks */
+static void report_top() {
+  HTable index;
+  htable_init(&index, 1024);
+  FuncCnt *funcs = malloc(sizeof(FuncCnt) * (nr_stack + 1));
+  assert(funcs != NULL);
+  uint32_t nr_func = 0, i;
+  for (i = 0; i < nr_stack; i ++) {
+    vaddr_t func = stacks[i].s.pc[0];
+    symbol_find(func, &func);
+    uint32_t *idx = htable_get(&index, func);
+    if (*idx == HTABLE_EMPTY) {
+      funcs[nr_func] = (FuncCnt) { .func = func, .cnt = 0 };
+      *idx = nr_func ++;
+    }
+    funcs[*idx].cnt += stacks[i].cnt;
+  }
+
+  qsort(funcs, nr_func, sizeof(FuncCnt), cmp_func_cnt);
+  char buf[SYM_STR_SIZE];
+  printflog("Top %d functions by samples (%lu samples, %d distinct stacks):\n",
+      PROFILE_TOP_N, nr_sample, nr_stack);
+  for (i = 0; i < nr_func && i < PROFILE_TOP_N; i ++) {
+    printflog("  %-32s %12lu %6.2f%%\n", symbol_name(funcs[i].func, buf),
+        funcs[i].cnt, 100.0 * funcs[i].cnt / nr_sample);
+  }
+
+  free(funcs);
+  htable_free(&index);
+}
+
+void sample_report() {
+  if (sample_file == NULL) return;
+  merge_ring();
+
+  printflog("==================== samples ====================\n");
+  report_top();
+
+  FILE *fp = fopen(sample_file, "w");
+  Assert(fp, "Can not open '%s'", sample_file);
+  char buf[SYM_STR_SIZE];
+  uint32_t i;
+  int j;
+  for (i = 0; i < nr_stack; i ++) {
+    Sample *s = &stacks[i].s;
+    fprintf(fp, "cr3_0x%08x", s->cr3);
+    for (j = s->depth - 1; j >= 0; j --) {
+      fprintf(fp, ";%s", symbol_name(s->pc[j], buf));
+    }
+    fprintf(fp, " %lu\n", stacks[i].cnt);
+  }
+  fclose(fp);
+  Log("Folded sampled stacks are written to %s", sample_file);
+}
+
+#else
+
+void init_sample(char *out_file, uint64_t period) {
+  if (out_file != NULL) {
+    Log("Sampling profiler is not enabled, define SAMPLE in include/common.h to enable it");
+  }
+}
+
+#endif
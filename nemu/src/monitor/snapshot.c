@@ -0,0 +1,305 @@
+#include "nemu.h"
+#include "monitor/monitor.h"
+#include "monitor/perfcnt.h"
+#include "monitor/snapshot.h"
+#include "cpu/vcpu.h"
+#include "memory/codepage.h"
+#include "monitor/reverse.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/* Snapshots of the whole machine: registers, physical memory and the
+ * state of devices. Physical memory is stored sparsely, skipping pages
+ * which are all zero, and the other pages are compressed with PackBits.
+ *
+ * Besides files, a snapshot can be kept in memory by fork(). The child
+ * continues to run, and the parent, which keeps the state at the fork
+ * with copy-on-write pages, resumes after the child exits. This is much
+ * faster than reading the file again when one warmed-up state is used
+ * by many runs.
+ */
+
+#define SNAPSHOT_MAGIC "NEMUSNAP"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_PAGE_SIZE 4096
+#define SNAPSHOT_PAGE_END 0xffffffffu
+
+uint64_t get_nr_guest_instr();
+void nr_guest_instr_set(uint64_t n);
+
+static char *save_file = NULL;
+static uint64_t save_instr = 0;
+static bool is_fork_server = false;
+static bool is_child = false;
+
+void snapshot_rw(Snapshot *s, void *buf, size_t len) {
+  if (!s->ok) return;
+  size_t ret = (s->is_save ? fwrite(buf, len, 1, s->fp) : fread(buf, len, 1, s->fp));
+  if (ret != 1) s->ok = false;
+}
+
+/* PackBits: a header n in [0, 127] is followed by n + 1 literal bytes,
+ * and a header n in [129, 255] is followed by one byte repeated 257 - n times. */
+static int packbits(const uint8_t *src, int len, uint8_t *dst) {
+  int i = 0, p = 0;
+  while (i < len) {
+    int run = 1;
+    while (i + run < len && run < 128 && src[i + run] == src[i]) run ++;
+    if (run >= 3) {
+      dst[p ++] = 257 - run;
+      dst[p ++] = src[i];
+      i += run;
+    }
+    else {
+      int start = i, nr = 0;
+      /* a run of 2 bytes is cheaper to be kept in the literals */
+      while (i < len && nr < 128 &&
+          !(i + 2 < len && src[i + 1] == src[i] && src[i + 2] == src[i])) { i ++; nr ++; }
+      dst[p ++] = nr - 1;
+      memcpy(dst + p, src + start, nr);
+      p += nr;
+    }
+  }
+  return p;
+}
+
+static bool unpackbits(const uint8_t *src, int len, uint8_t *dst, int dst_len) {
+  int i = 0, p = 0;
+  while (i < len) {
+    int n = src[i ++];
+    if (n < 128) {
+      if (i + n + 1 > len || p + n + 1 > dst_len) return false;
+      memcpy(dst + p, src + i, n + 1);
+      i += n + 1;
+      p += n + 1;
+    }
+    else if (n > 128) {
+      if (i >= len || p + 257 - n > dst_len) return false;
+      memset(dst + p, src[i ++], 257 - n);
+      p += 257 - n;
+    }
+  }
+  return p == dst_len;
+}
+
+static inline bool is_zero_page(const uint8_t *p, int len) {
+  int i;
+  for (i = 0; i < len; i ++) { if (p[i] != 0) return false; }
+  return true;
+}
+
+/* a memory block, stored as the compressed pages which are not all zero */
+void snapshot_rw_mem(Snapshot *s, void *buf, size_t len) {
+  static uint8_t zbuf[SNAPSHOT_PAGE_SIZE + SNAPSHOT_PAGE_SIZE / 128 + 16];
+  uint8_t *mem = buf;
+  uint32_t idx, clen;
+
+  if (s->is_save) {
+    for (idx = 0; idx * SNAPSHOT_PAGE_SIZE < len && s->ok; idx ++) {
+      uint8_t *page = mem + idx * SNAPSHOT_PAGE_SIZE;
+      int page_len = (len - idx * SNAPSHOT_PAGE_SIZE < SNAPSHOT_PAGE_SIZE ?
+          len - idx * SNAPSHOT_PAGE_SIZE : SNAPSHOT_PAGE_SIZE);
+      if (is_zero_page(page, page_len)) continue;
+      clen = packbits(page, page_len, zbuf);
+      snapshot_rw(s, &idx, sizeof(idx));
+      snapshot_rw(s, &clen, sizeof(clen));
+      snapshot_rw(s, zbuf, clen);
+    }
+    idx = SNAPSHOT_PAGE_END;
+    snapshot_rw(s, &idx, sizeof(idx));
+  }
+  else {
+    /* the physical memory is zeroed lazily, see pmem_zero() */
+    if (mem == guest_to_host(0) && len == pmem_size) { pmem_zero(0, len); }
+    else { memset(mem, 0, len); }
+    while (s->ok) {
+      snapshot_rw(s, &idx, sizeof(idx));
+      if (!s->ok || idx == SNAPSHOT_PAGE_END) break;
+      snapshot_rw(s, &clen, sizeof(clen));
+      if (!s->ok || (size_t)idx * SNAPSHOT_PAGE_SIZE >= len || clen > sizeof(zbuf)) {
+        s->ok = false;
+        break;
+      }
+      snapshot_rw(s, zbuf, clen);
+      int page_len = (len - idx * SNAPSHOT_PAGE_SIZE < SNAPSHOT_PAGE_SIZE ?
+          len - idx * SNAPSHOT_PAGE_SIZE : SNAPSHOT_PAGE_SIZE);
+      if (s->ok && !unpackbits(zbuf, clen, mem + idx * SNAPSHOT_PAGE_SIZE, page_len)) {
+        s->ok = false;
+      }
+    }
+  }
+}
+
+static void section(Snapshot *s, const char *tag) {
+  char buf[4];
+  memcpy(buf, tag, 4);
+  snapshot_rw(s, buf, 4);
+  if (s->ok && memcmp(buf, tag, 4) != 0) {
+    printf("snapshot: expect section '%.4s'\n", tag);
+    s->ok = false;
+  }
+}
+
+static bool snapshot_rw_all(Snapshot *s) {
+  char magic[8];
+  uint32_t version = SNAPSHOT_VERSION, size = pmem_size;
+  memcpy(magic, SNAPSHOT_MAGIC, 8);
+  snapshot_rw(s, magic, 8);
+  snapshot_rw(s, &version, sizeof(version));
+  snapshot_rw(s, &size, sizeof(size));
+  if (!s->ok || memcmp(magic, SNAPSHOT_MAGIC, 8) != 0 || version != SNAPSHOT_VERSION) {
+    printf("snapshot: not a snapshot of this version of NEMU\n");
+    return false;
+  }
+  if (size != pmem_size) {
+    printf("snapshot: the physical memory is %u MB, run with --pmem=%u\n", size >> 20, size >> 20);
+    return false;
+  }
+
+  /* CPU, including the control registers of the MMU */
+  section(s, "CPU ");
+  CPU_state r = cpu;
+  uint64_t instr = get_nr_guest_instr();
+  uint64_t counters[NR_PERFCNT];
+  memcpy(counters, perfcnt, sizeof(perfcnt));
+  snapshot_rw(s, &r, sizeof(r));
+  snapshot_rw(s, &instr, sizeof(instr));
+  snapshot_rw(s, counters, sizeof(counters));
+
+  section(s, "VCPU");
+  vcpu_snapshot(s);
+
+  section(s, "PMEM");
+  snapshot_rw_mem(s, guest_to_host(0), pmem_size);
+
+  section(s, "PIO ");
+  pio_snapshot(s);
+  section(s, "MMIO");
+  mmio_snapshot(s);
+  section(s, "KBD ");
+  i8042_snapshot(s);
+  section(s, "END ");
+
+  if (s->ok && !s->is_save) {
+    cpu = r;
+    nr_guest_instr_set(instr);
+    memcpy(perfcnt, counters, sizeof(perfcnt));
+  }
+  return s->ok;
+}
+
+bool snapshot_save(const char *file) {
+  Snapshot s = { .fp = fopen(file, "wb"), .is_save = true, .ok = true };
+  if (s.fp == NULL) {
+    printf("snapshot: can not open '%s'\n", file);
+    return false;
+  }
+  bool ok = snapshot_rw_all(&s);
+  ok &= (fclose(s.fp) == 0);
+  if (ok) {
+    Log("Save snapshot to %s after %lu instructions", file, get_nr_guest_instr());
+  }
+  return ok;
+}
+
+bool snapshot_load(const char *file) {
+  Snapshot s = { .fp = fopen(file, "rb"), .is_save = false, .ok = true };
+  if (s.fp == NULL) {
+    printf("snapshot: can not open '%s'\n", file);
+    return false;
+  }
+  bool ok = snapshot_rw_all(&s);
+  fclose(s.fp);
+  codepage_invalidate_all();
+  if (ok) {
+    Log("Load snapshot from %s, eip = 0x%08x", file, cpu.eip);
+#ifdef DIFF_TEST
+    void difftest_sync();
+    difftest_sync();
+#endif
+    reverse_reset();
+  }
+  else {
+    printf("snapshot: '%s' is broken, the state of the machine is undefined\n", file);
+  }
+  return ok;
+}
+
+/* Fork the machine. The child returns -1 and continues to run, and
+ * leaves with snapshot_child_exit(). The parent waits for the child, and
+ * returns with its exit status. It returns -2 if NEMU can not fork. */
+int snapshot_fork() {
+#ifdef DIFF_TEST
+  /* the child would share the reference with NEMU and kill it at exit */
+  printf("fork: not supported with DiffTest\n");
+  return -2;
+#else
+  /* nothing buffered before the fork is written twice */
+  fflush(NULL);
+
+  pid_t pid = fork();
+  Assert(pid != -1, "can not fork NEMU");
+  if (pid == 0) {
+    is_child = true;
+    return -1;
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  return (WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+#endif
+}
+
+bool snapshot_is_child() {
+  return is_child;
+}
+
+/* The exit handlers belong to the parent, e.g. the one closing the record
+ * of device inputs, so a child does not run them. */
+void snapshot_child_exit(int status) {
+  fflush(NULL);
+  _exit(status);
+}
+
+void init_snapshot(char *load_file, char *save_spec, bool fork_server) {
+  if (load_file != NULL) {
+    Assert(snapshot_load(load_file), "Can not load snapshot '%s'", load_file);
+  }
+
+  if (save_spec != NULL) {
+    save_file = save_spec;
+    char *at = strrchr(save_spec, '@');
+    if (at != NULL) {
+      *at = '\0';
+      save_instr = strtoull(at + 1, NULL, 0);
+    }
+  }
+
+#ifdef DIFF_TEST
+  Assert(!fork_server, "The fork server is not supported with DiffTest");
+#endif
+  is_fork_server = fork_server;
+}
+
+/* In batch mode, run the instructions to warm up before saving the
+ * snapshot given by --save=FILE@N. */
+void snapshot_batch_start() {
+  if (save_file == NULL || save_instr == 0) return;
+  void cpu_exec(uint64_t);
+  cpu_exec(save_instr);
+  if (nemu_state == NEMU_STOP) {
+    Assert(snapshot_save(save_file), "Can not save snapshot '%s'", save_file);
+  }
+}
+
+/* save the snapshot given by --save=FILE when the program stops */
+void snapshot_batch_end() {
+  if (save_file == NULL || save_instr != 0) return;
+  Assert(snapshot_save(save_file), "Can not save snapshot '%s'", save_file);
+}
+
+bool snapshot_is_fork_server() {
+  return is_fork_server;
+}
@@ -0,0 +1,498 @@
+#include "nemu.h"
+#include "cpu/exec.h"
+#include "cpu/intr.h"
+#include "memory/codepage.h"
+#include "device/mmio.h"
+#include "device/port-io.h"
+#include "monitor/expr.h"
+#include "monitor/watchpoint.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Microbenchmarks of the components of NEMU on synthetic inputs. It is
+ * linked with the objects of NEMU except main.o, so the components are
+ * measured exactly as they are built. Every benchmark is a loop of `n'
+ * operations. `n' is calibrated so that one run takes about RUN_NS, and
+ * the benchmark is run NR_RUN times. The median, the minimum and the
+ * spread of the time per operation are reported.
+ *
+ * Usage: nemu-bench [FILTER]
+ *   only run the benchmarks whose names contain FILTER
+ */
+
+#define NR_RUN 11
+#define RUN_NS 20000000ull
+
+#define CODE_BASE 0x100000
+#define DATA_BASE 0x200000
+#define MMIO_BASE 0xa0000000
+#define PIO_BASE 0x200
+
+void init_regex();
+void init_wp_pool();
+
+/* keep the results alive, so the loops are not optimized out */
+static volatile uint32_t sink;
+/* make the compiler forget what it knows about `x' */
+#define opaque(x) asm volatile("" : "+r"(x))
+
+static FILE *report;
+static char *filter = "";
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void run(const char *name, void (*func)(uint64_t, void *), void *arg) {
+  if (strstr(name, filter) == NULL) return;
+
+  /* calibrate */
+  uint64_t n = 1, t = 0;
+  while (1) {
+    uint64_t start = now_ns();
+    func(n, arg);
+    t = now_ns() - start;
+    if (t >= RUN_NS / 10 || n >= 1000000000000ull) break;
+    n *= 10;
+  }
+  n = n * RUN_NS / (t + 1) + 1;
+
+  double ns[NR_RUN];
+  int i;
+  for (i = 0; i < NR_RUN; i ++) {
+    uint64_t start = now_ns();
+    func(n, arg);
+    ns[i] = (double)(now_ns() - start) / n;
+  }
+  qsort(ns, NR_RUN, sizeof(ns[0]), cmp_double);
+
+  /* the spread is the interquartile range relative to the median */
+  double median = ns[NR_RUN / 2];
+  double iqr = ns[NR_RUN * 3 / 4] - ns[NR_RUN / 4];
+  fprintf(report, "  %-36s %10.2f %10.2f %7.1f%% %12lu\n", name, median, ns[0],
+      100 * iqr / median, n);
+}
+
+/* ------------------------------- decode ------------------------------- */
+
+typedef struct {
+  const char *name;
+  uint8_t len;
+  uint8_t bytes[15];
+} Instr;
+
+/* Representative encodings. Those whose opcodes are not decoded yet
+ * are skipped. */
+static const Instr instrs[] = {
+  { "decode mov r32, imm32",         5, { 0xb8, 0x34, 0x12, 0x00, 0x00 } },
+  { "decode mov r/m32, r32",         2, { 0x89, 0x01 } },
+  { "decode mov r32, disp8(r32)",    3, { 0x8b, 0x41, 0x04 } },
+  { "decode movw disp8(r32), imm16", 6, { 0x66, 0xc7, 0x41, 0x04, 0x01, 0x00 } },
+  { "decode movl disp32(sib), imm32", 11, { 0xc7, 0x84, 0x99, 0x00, 0xe0, 0xff, 0xff, 0x01, 0x00, 0x00, 0x00 } },
+  { "decode mov eax, moffs32",       5, { 0xa1, 0x00, 0x00, 0x20, 0x00 } },
+  { "decode shl r/m32, imm8",        3, { 0xc1, 0xe0, 0x02 } },
+  { "decode add r/m32, imm8",        3, { 0x83, 0xc0, 0x01 } },
+  { "decode push r32",               1, { 0x50 } },
+  { "decode je rel8",                2, { 0x74, 0x00 } },
+  { "decode movzbl r/m8, r32",       3, { 0x0f, 0xb6, 0xc1 } },
+};
+
+/* fetch the opcode, handle the prefixes, and call the decode helper */
+static inline void decode_one(vaddr_t eip) {
+#ifdef DEBUG
+  decoding.p = decoding.asm_buf;
+#endif
+  decoding.is_operand_size_16 = false;
+  uint32_t opcode = instr_fetch(&eip, 1);
+  if (opcode == 0x66) {
+    decoding.is_operand_size_16 = true;
+    opcode = instr_fetch(&eip, 1);
+  }
+  if (opcode == 0x0f) { opcode = instr_fetch(&eip, 1) | 0x100; }
+  decoding.opcode = opcode;
+
+  int width = opcode_table[opcode].width;
+  if (width == 0) { width = decoding.is_operand_size_16 ? 2 : 4; }
+  decoding.src.width = decoding.dest.width = decoding.src2.width = width;
+  opcode_table[opcode].decode(&eip);
+}
+
+static void bench_decode(uint64_t n, void *arg) {
+  vaddr_t eip = *(vaddr_t *)arg;
+  for (; n > 0; n --) { decode_one(eip); }
+  sink = decoding.src.val;
+}
+
+static bool is_decodable(const Instr *in) {
+  int i = 0;
+  uint32_t opcode = in->bytes[i ++];
+  if (opcode == 0x66) opcode = in->bytes[i ++];
+  if (opcode == 0x0f) opcode = in->bytes[i ++] | 0x100;
+  /* decode_SI2E is not implemented yet */
+  return opcode_table[opcode].decode != NULL && opcode != 0x83;
+}
+
+static void bench_decodes() {
+  static vaddr_t eips[sizeof(instrs) / sizeof(instrs[0])];
+  int i;
+  vaddr_t eip = CODE_BASE;
+  for (i = 0; i < sizeof(instrs) / sizeof(instrs[0]); i ++) {
+    const Instr *in = &instrs[i];
+    if (strstr(in->name, filter) == NULL) continue;
+    if (!is_decodable(in)) {
+      fprintf(report, "  %-36s %10s\n", in->name, "skipped");
+      continue;
+    }
+    memcpy(guest_to_host(eip), in->bytes, in->len);
+    eips[i] = eip;
+    run(in->name, bench_decode, &eips[i]);
+    eip += 16;
+  }
+}
+
+/* --------------------------------- rtl -------------------------------- */
+
+/* the operands are advanced every iteration, so the loops depend on the
+ * results and can not be folded. `b' stays in [1, 31], a valid divisor
+ * and shift amount. */
+#define make_bench_rtl(name) \
+  static void concat(bench_rtl_, name) (uint64_t n, void *arg) { \
+    rtlreg_t a = 0x12345678, b = 7; \
+    for (; n > 0; n --) { \
+      concat(interpret_rtl_, name) (&a, &a, &b); \
+      opaque(a); \
+      b = ((b + a) & 0x1f) | 1; \
+    } \
+    sink = a; \
+  }
+
+make_bench_rtl(add)
+make_bench_rtl(sub)
+make_bench_rtl(and)
+make_bench_rtl(or)
+make_bench_rtl(xor)
+make_bench_rtl(shl)
+make_bench_rtl(shr)
+make_bench_rtl(sar)
+make_bench_rtl(mul_lo)
+make_bench_rtl(mul_hi)
+make_bench_rtl(imul_lo)
+make_bench_rtl(imul_hi)
+make_bench_rtl(div_q)
+make_bench_rtl(div_r)
+make_bench_rtl(idiv_q)
+make_bench_rtl(idiv_r)
+
+static void bench_rtl_li(uint64_t n, void *arg) {
+  rtlreg_t a = 0;
+  for (; n > 0; n --) { rtl_li(&a, a + 1); opaque(a); }
+  sink = a;
+}
+
+static void bench_rtl_mv(uint64_t n, void *arg) {
+  rtlreg_t a = 0, b = 0;
+  for (; n > 0; n --) { rtl_mv(&a, &b); opaque(a); b += a + 1; }
+  sink = a;
+}
+
+static void bench_rtl_div64_q(uint64_t n, void *arg) {
+  rtlreg_t a = 0, hi = 1, lo = 0x12345678, d = 0x10000;
+  opaque(d);
+  for (; n > 0; n --) { rtl_div64_q(&a, &hi, &lo, &d); opaque(a); lo += a; }
+  sink = a;
+}
+
+static void bench_rtl_setrelop(uint64_t n, void *arg) {
+  rtlreg_t a = 0, b = 0x12345678, c = 0;
+  for (; n > 0; n --) { rtl_setrelop(RELOP_LTU, &a, &b, &c); opaque(a); c += a + 3; }
+  sink = a;
+}
+
+static void bench_rtl_lm(uint64_t n, void *arg) {
+  int len = *(int *)arg;
+  rtlreg_t a = 0, addr = DATA_BASE;
+  for (; n > 0; n --) { rtl_lm(&a, &addr, len); addr = DATA_BASE + ((addr + a + 4) & 0xffc); }
+  sink = a;
+}
+
+static void bench_rtl_sm(uint64_t n, void *arg) {
+  int len = *(int *)arg;
+  rtlreg_t addr = DATA_BASE;
+  for (; n > 0; n --) { rtl_sm(&addr, &addr, len); addr = DATA_BASE + ((addr + 4) & 0xffc); }
+}
+
+static void bench_rtl_lr(uint64_t n, void *arg) {
+  int width = *(int *)arg;
+  rtlreg_t a = 0;
+  for (; n > 0; n --) { rtl_lr(&a, R_ECX, width); cpu.ecx += a; }
+  sink = a;
+}
+
+static void bench_rtl_sr(uint64_t n, void *arg) {
+  int width = *(int *)arg;
+  rtlreg_t a = 0;
+  for (; n > 0; n --) { rtl_sr(R_ECX, &a, width); opaque(a); a += 3; }
+  sink = cpu.ecx;
+}
+
+static void bench_rtls() {
+  static struct {
+    const char *name;
+    void (*func)(uint64_t, void *);
+  } rtls[] = {
+    { "rtl_li", bench_rtl_li }, { "rtl_mv", bench_rtl_mv },
+    { "rtl_add", bench_rtl_add }, { "rtl_sub", bench_rtl_sub },
+    { "rtl_and", bench_rtl_and }, { "rtl_or", bench_rtl_or },
+    { "rtl_xor", bench_rtl_xor }, { "rtl_shl", bench_rtl_shl },
+    { "rtl_shr", bench_rtl_shr }, { "rtl_sar", bench_rtl_sar },
+    { "rtl_mul_lo", bench_rtl_mul_lo }, { "rtl_mul_hi", bench_rtl_mul_hi },
+    { "rtl_imul_lo", bench_rtl_imul_lo }, { "rtl_imul_hi", bench_rtl_imul_hi },
+    { "rtl_div_q", bench_rtl_div_q }, { "rtl_div_r", bench_rtl_div_r },
+    { "rtl_idiv_q", bench_rtl_idiv_q }, { "rtl_idiv_r", bench_rtl_idiv_r },
+    { "rtl_div64_q", bench_rtl_div64_q }, { "rtl_setrelop", bench_rtl_setrelop },
+  };
+  int i;
+  for (i = 0; i < sizeof(rtls) / sizeof(rtls[0]); i ++) {
+    run(rtls[i].name, rtls[i].func, NULL);
+  }
+
+  static int widths[] = { 1, 2, 4 };
+  char name[64];
+  for (i = 0; i < 3; i ++) {
+    sprintf(name, "rtl_lm %d", widths[i]);
+    run(name, bench_rtl_lm, &widths[i]);
+    sprintf(name, "rtl_sm %d", widths[i]);
+    run(name, bench_rtl_sm, &widths[i]);
+    sprintf(name, "rtl_lr %d", widths[i]);
+    run(name, bench_rtl_lr, &widths[i]);
+    sprintf(name, "rtl_sr %d", widths[i]);
+    run(name, bench_rtl_sr, &widths[i]);
+  }
+}
+
+/* ------------------------------- memory ------------------------------- */
+
+static void bench_paddr_read(uint64_t n, void *arg) {
+  int len = *(int *)arg;
+  paddr_t addr = DATA_BASE;
+  uint32_t sum = 0;
+  for (; n > 0; n --) { sum += paddr_read(addr, len); addr = DATA_BASE + ((addr + sum) & 0xfffc); }
+  sink = sum;
+}
+
+static void bench_paddr_write(uint64_t n, void *arg) {
+  int len = *(int *)arg;
+  paddr_t addr = DATA_BASE;
+  for (; n > 0; n --) { paddr_write(addr, addr, len); addr = DATA_BASE + ((addr * 5 + 4) & 0xfffc); }
+}
+
+static void bench_mmio_read(uint64_t n, void *arg) {
+  uint32_t sum = 0;
+  for (; n > 0; n --) {
+    paddr_t addr = MMIO_BASE + (sum & 0xc);
+    sum += mmio_read(addr, 4, is_mmio(addr));
+  }
+  sink = sum;
+}
+
+static void bench_mmio_write(uint64_t n, void *arg) {
+  uint32_t i = 0;
+  for (; n > 0; n --, i ++) {
+    paddr_t addr = MMIO_BASE + (i & 0xc);
+    mmio_write(addr, 4, i, is_mmio(addr));
+  }
+}
+
+static void bench_pio_read(uint64_t n, void *arg) {
+  uint32_t pio_read_l(ioaddr_t);
+  uint32_t sum = 0;
+  for (; n > 0; n --) { sum += pio_read_l(PIO_BASE + (sum & 0xc)); }
+  sink = sum;
+}
+
+static void bench_pio_write(uint64_t n, void *arg) {
+  void pio_write_l(ioaddr_t, uint32_t);
+  uint32_t i = 0;
+  for (; n > 0; n --, i ++) { pio_write_l(PIO_BASE + (i & 0xc), i); }
+}
+
+static void bench_io_callback(ioaddr_t addr, int len, bool is_write) { sink += addr; }
+static void bench_mmio_callback(paddr_t addr, int len, bool is_write) { sink += addr; }
+
+/* a store to a page with cached contents, which is marked again every
+ * time, as the next execution of the code would do */
+static void bench_codepage_write(uint64_t n, void *arg) {
+  for (; n > 0; n --) {
+    codepage_mark(DATA_BASE);
+    paddr_write(DATA_BASE, n, 4);
+  }
+}
+
+static void bench_memories() {
+  static int widths[] = { 1, 2, 4 };
+  char name[64];
+  int i;
+  for (i = 0; i < 3; i ++) {
+    sprintf(name, "paddr_read %d", widths[i]);
+    run(name, bench_paddr_read, &widths[i]);
+    sprintf(name, "paddr_write %d", widths[i]);
+    run(name, bench_paddr_write, &widths[i]);
+  }
+
+  run("paddr_write 4 to a code page", bench_codepage_write, NULL);
+
+  add_mmio_map(MMIO_BASE, 16, bench_mmio_callback);
+  add_pio_map(PIO_BASE, 16, bench_io_callback);
+  run("mmio_read 4 (is_mmio + dispatch)", bench_mmio_read, NULL);
+  run("mmio_write 4 (is_mmio + dispatch)", bench_mmio_write, NULL);
+  run("pio_read_l (dispatch)", bench_pio_read, NULL);
+  run("pio_write_l (dispatch)", bench_pio_write, NULL);
+}
+
+/* ------------------------------- string ------------------------------- */
+
+#define STRING_CODE (CODE_BASE + 0x1000)
+#define STRING_NR 4096
+
+/* one chunk of a rep string instruction, through the executor; the
+ * memory is all zero, so cmps and scas do not stop early */
+static const Instr strings[] = {
+  { "rep movsb x4096",   2, { 0xf3, 0xa4 } },
+  { "rep movsl x4096",   2, { 0xf3, 0xa5 } },
+  { "rep stosb x4096",   2, { 0xf3, 0xaa } },
+  { "rep stosl x4096",   2, { 0xf3, 0xab } },
+  { "repe cmpsb x4096",  2, { 0xf3, 0xa6 } },
+  { "repne scasb x4096", 2, { 0xf2, 0xae } },
+};
+
+static void bench_string(uint64_t n, void *arg) {
+  void exec_real(vaddr_t *);
+  for (; n > 0; n --) {
+    vaddr_t eip = STRING_CODE;
+#ifdef DEBUG
+    decoding.p = decoding.asm_buf;
+#endif
+    cpu.esi = DATA_BASE + 0x10000;
+    cpu.edi = DATA_BASE + 0x20000;
+    cpu.ecx = STRING_NR;
+    cpu.eax = 1;
+    exec_real(&eip);
+  }
+  sink = cpu.ecx;
+}
+
+static void bench_strings() {
+  int i;
+  for (i = 0; i < sizeof(strings) / sizeof(strings[0]); i ++) {
+    memcpy(guest_to_host(STRING_CODE), strings[i].bytes, strings[i].len);
+    run(strings[i].name, bench_string, NULL);
+  }
+}
+
+/* ----------------------------- interrupts ----------------------------- */
+
+#define IDT_BASE (DATA_BASE + 0x30000)
+#define INTR_STACK (DATA_BASE + 0x40000)
+
+/* an `int $0x80' with its `iret', without the instructions */
+static void bench_intr(uint64_t n, void *arg) {
+  for (; n > 0; n --) {
+    raise_intr(0x80, CODE_BASE);
+    return_intr();
+  }
+  sink = cpu.eip;
+}
+
+static void bench_intrs() {
+  /* a trap gate to CODE_BASE */
+  paddr_write(IDT_BASE + 0x80 * 8, (0x8 << 16) | (CODE_BASE & 0xffff), 4);
+  paddr_write(IDT_BASE + 0x80 * 8 + 4, (CODE_BASE & 0xffff0000) | 0x8f00, 4);
+  cpu.idtr.base = IDT_BASE;
+  cpu.idtr.limit = 256 * 8 - 1;
+  cpu.esp = INTR_STACK;
+
+  run("int and iret", bench_intr, NULL);
+}
+
+/* ---------------------------- expr and wp ----------------------------- */
+
+static const char *exprs[] = {
+  "1 + 2 * 3",
+  "$eax + 0x100",
+  "(1 + 2) * (3 - 4) / 5 == -1",
+  "*0x200000 == 0x1234 && $ecx != 0",
+};
+
+static void bench_expr(uint64_t n, void *arg) {
+  char buf[128];
+  uint32_t sum = 0;
+  for (; n > 0; n --) {
+    /* expr() may modify its argument */
+    strcpy(buf, arg);
+    bool success = true;
+    sum += expr(buf, &success);
+  }
+  sink = sum;
+}
+
+static void bench_check_wp(uint64_t n, void *arg) {
+  for (; n > 0; n --) { sink += check_wp(); }
+}
+
+static void bench_exprs() {
+  char name[64];
+  int i;
+  for (i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i ++) {
+    snprintf(name, sizeof(name), "expr \"%s\"", exprs[i]);
+    run(name, bench_expr, (void *)exprs[i]);
+  }
+
+  static const int nr_wps[] = { 1, 4, 16 };
+  int nr = 0;
+  for (i = 0; i < sizeof(nr_wps) / sizeof(nr_wps[0]); i ++) {
+    for (; nr < nr_wps[i]; nr ++) {
+      char e[32];
+      sprintf(e, "*0x%x + $eax", DATA_BASE + nr * 4);
+      setup_wp(new_wp(), e);
+    }
+    sprintf(name, "check_wp with %d watch points", nr);
+    run(name, bench_check_wp, NULL);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1) { filter = argv[1]; }
+
+  /* the components may print logs, only the report goes to stdout */
+  report = fdopen(dup(STDOUT_FILENO), "w");
+  assert(report != NULL);
+  setvbuf(report, NULL, _IOLBF, 0);
+  assert(freopen("/dev/null", "w", stdout) != NULL);
+
+  init_pmem(PMEM_DEFAULT_SIZE);
+  init_regex();
+  init_wp_pool();
+  cpu.eax = 0x1234;
+  cpu.ecx = DATA_BASE;
+  paddr_write(DATA_BASE, 0x1234, 4);
+
+  fprintf(report, "  %-36s %10s %10s %8s %12s\n", "benchmark", "median ns", "min ns", "spread", "ops per run");
+  bench_decodes();
+  bench_rtls();
+  bench_memories();
+  bench_strings();
+  bench_intrs();
+  bench_exprs();
+
+  fclose(report);
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include "nemu.h"
+#include "memory/codepage.h"
+
+#include <unistd.h>
+
+/* Checks of the code-page tracker. It is linked with the objects of NEMU
+ * except main.o, like nemu-bench. Every kind of write to the physical
+ * memory is done to a marked page, which should clear the mark, bump the
+ * generation of the page and call the callbacks with it. A write to an
+ * unmarked page should do none of them. smctest in AM only sees the
+ * stores of the guest, and it passes without a tracker as long as NEMU
+ * decodes every instruction again.
+ *
+ * Usage: nemu-codepage-test
+ *   exits with 1 if any check fails
+ */
+
+#ifdef DIFF_TEST
+#error "the writes of devices are sent to the reference, build it without DIFF_TEST"
+#endif
+
+#define TEST_BASE 0x300000
+
+void difftest_memcpy_from_dut(paddr_t dest, void *src, size_t n);
+
+/* the pages passed to the callback */
+#define MAX_CALL 8
+static paddr_t calls[MAX_CALL];
+static int nr_call = 0;
+
+static int nr_fail = 0;
+
+static void on_invalidate(paddr_t page) {
+  if (nr_call < MAX_CALL) { calls[nr_call] = page; }
+  nr_call ++;
+}
+
+static bool is_called(paddr_t page) {
+  int i;
+  for (i = 0; i < nr_call && i < MAX_CALL; i ++) {
+    if (calls[i] == page) { return true; }
+  }
+  return false;
+}
+
+static void check(const char *name, bool ok) {
+  printf("  %-48s %s\n", name, (ok ? "ok" : "FAILED"));
+  if (!ok) { nr_fail ++; }
+}
+
+/* `write' writes [addr, addr + len), and every page of it is marked or not */
+static void check_write(const char *name, void (*write)(paddr_t, uint32_t),
+    paddr_t addr, uint32_t len, bool marked) {
+  paddr_t page = addr & ~(PAGE_SIZE - 1);
+  paddr_t last = (addr + len - 1) & ~(PAGE_SIZE - 1);
+  uint32_t nr_page = (last - page) / PAGE_SIZE + 1;
+  uint32_t gen[nr_page];
+  uint32_t i;
+  for (i = 0; i < nr_page; i ++) {
+    if (marked) { codepage_mark(page + i * PAGE_SIZE); }
+    gen[i] = codepage_gen(page + i * PAGE_SIZE);
+  }
+
+  nr_call = 0;
+  write(addr, len);
+
+  bool ok = (nr_call == (marked ? nr_page : 0));
+  for (i = 0; i < nr_page; i ++) {
+    paddr_t p = page + i * PAGE_SIZE;
+    ok = ok && !code_page[p / PAGE_SIZE];
+    ok = ok && is_called(p) == marked;
+    ok = ok && codepage_gen(p) == gen[i] + marked;
+  }
+  check(name, ok);
+}
+
+static void write_paddr(paddr_t addr, uint32_t len) {
+  uint32_t i;
+  for (i = 0; i < len; i += 4) { paddr_write(addr + i, 0x12345678, (len - i < 4 ? len - i : 4)); }
+}
+
+static void write_host_range(paddr_t addr, uint32_t len) {
+  void *host = vaddr_host_range(addr, len, true);
+  assert(host != NULL);
+  memset(host, 0x5a, len);
+}
+
+static uint8_t buf[2 * PAGE_SIZE];
+
+static void write_dma(paddr_t addr, uint32_t len) {
+  dma_write(addr, buf, len);
+}
+
+static void write_dma_begin(paddr_t addr, uint32_t len) {
+  memset(dma_write_begin(addr, len), 0xa5, len);
+  dma_write_end(addr, len);
+}
+
+static void write_pmem_zero(paddr_t addr, uint32_t len) {
+  pmem_zero(addr, len);
+}
+
+static void write_difftest(paddr_t addr, uint32_t len) {
+  difftest_memcpy_from_dut(addr, buf, len);
+}
+
+int main(int argc, char *argv[]) {
+  /* the components may print logs, only the results go to stdout */
+  int out = dup(STDOUT_FILENO);
+  assert(out >= 0);
+  assert(freopen("/dev/null", "w", stdout) != NULL);
+
+  init_pmem(PMEM_DEFAULT_SIZE);
+  codepage_add_callback(on_invalidate);
+  memset(buf, 0xcc, sizeof(buf));
+
+  assert(dup2(out, STDOUT_FILENO) >= 0);
+  close(out);
+
+  paddr_t p = TEST_BASE;
+  check_write("paddr_write()", write_paddr, p, 4, true);
+  check_write("vaddr_host_range()", write_host_range, p + 0x10, 16, true);
+  check_write("dma_write()", write_dma, p + 0x20, 64, true);
+  check_write("dma_write_begin() and dma_write_end()", write_dma_begin, p + 0x80, 64, true);
+  check_write("pmem_zero() of a whole page", write_pmem_zero, p, PAGE_SIZE, true);
+  check_write("pmem_zero() of a part of a page", write_pmem_zero, p + 0x100, 0x100, true);
+  check_write("difftest_memcpy_from_dut() of the reference", write_difftest, p + 0x200, 32, true);
+
+  p += 2 * PAGE_SIZE;
+  check_write("paddr_write() across two pages", write_paddr, p - 2, 4, true);
+  check_write("vaddr_host_range() across two pages", write_host_range, p - 8, 16, true);
+  check_write("dma_write() across two pages", write_dma, p - 64, 128, true);
+  check_write("pmem_zero() across two pages", write_pmem_zero, p - 0x100, 0x200, true);
+  check_write("difftest_memcpy_from_dut() across two pages", write_difftest, p - 16, 32, true);
+
+  p += 2 * PAGE_SIZE;
+  check_write("paddr_write() to an unmarked page", write_paddr, p, 4, false);
+  check_write("dma_write() to an unmarked page", write_dma, p, 64, false);
+  check_write("pmem_zero() to an unmarked page", write_pmem_zero, p, PAGE_SIZE, false);
+
+  /* a marked page is not touched by a write to its neighbour */
+  codepage_mark(TEST_BASE);
+  check_write("paddr_write() next to a marked page", write_paddr, TEST_BASE + PAGE_SIZE, 4, false);
+  check("the marked page is kept", code_page[TEST_BASE / PAGE_SIZE]);
+
+  printf("%s\n", (nr_fail == 0 ? "PASS" : "FAIL"));
+  return (nr_fail == 0 ? 0 : 1);
+}
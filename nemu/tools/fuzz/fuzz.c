@@ -0,0 +1,694 @@
+#include "nemu.h"
+#include "cpu/exec.h"
+#include "monitor/monitor.h"
+#include "monitor/profile.h"
+#include "../../src/monitor/diff-test/diff-test.h"
+
+#include <dlfcn.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Random instruction fuzzer against a reference. It is linked with the
+ * objects of NEMU except main.o, like nemu-bench, and loads the reference
+ * into the same process, with the interface of DiffTest.
+ *
+ * Every case is one instruction from the opcode table, with random
+ * prefixes, ModR/M, immediates, registers, flags and memory. The memory
+ * operands always fall in a window of WINDOW bytes at DATA_BASE, so the
+ * registers used as addresses are derived from the chosen ModR/M. The
+ * instruction is executed by NEMU and by the reference from the same
+ * state, and the registers, EFLAGS and the window are compared. A case
+ * which differs is minimized: the bytes after the instruction, the
+ * immediates, the registers which are not addresses, the flags and the
+ * words of the window are cleared one by one while it still differs.
+ *
+ * Every case is generated from its own seed, so it can be replayed
+ * alone with -r. The cases are run by several worker processes, as NEMU
+ * keeps its state in globals. A worker which crashes, such as at a
+ * TODO(), is reported with the seed of its current case.
+ *
+ * Usage: nemu-fuzz -d REF_SO [-j JOBS] [-n CASES] [-s SEED] [-r CASE] [-o OPCODES] [-m MASK]
+ */
+
+#ifdef DIFF_TEST
+#error "the fuzzer drives the reference by itself, build it without DIFF_TEST"
+#endif
+
+#define CODE_BASE 0x100000
+#define DATA_BASE 0x200000
+#define WINDOW 1024
+#define MAX_INSTR_LEN 15
+
+/* CF, ZF, SF, IF, DF and OF, which are modeled by NEMU */
+#define EFLAGS_MASK 0xec1
+/* the flags which are set randomly, IF is always 0 */
+#define EFLAGS_RAND 0xcc1
+
+#define PROGRESS_SEC 5
+
+void exec_wrapper(bool);
+
+make_EHelper(inv);
+make_EHelper(nemu_trap);
+make_EHelper(hlt);
+make_EHelper(lidt);
+make_EHelper(int);
+make_EHelper(iret);
+make_EHelper(operand_size);
+make_EHelper(lock);
+make_EHelper(rep);
+make_EHelper(repne);
+make_EHelper(movs);
+make_EHelper(stos);
+make_EHelper(lods);
+make_EHelper(cmps);
+make_EHelper(scas);
+
+static FILE *report;
+
+/* ----------------------------- candidates ----------------------------- */
+
+enum { FMT_NONE, FMT_MODRM, FMT_MOFFS };
+
+typedef struct {
+  uint16_t opcode;
+  int8_t ext;           // the reg field of ModR/M for a group, or -1
+  uint8_t format;
+  bool is_string, is_lea;
+  uint8_t ptr_regs;     // registers used as pointers implicitly
+} Candidate;
+
+static Candidate cands[512 * 8];
+static int nr_cand = 0;
+
+static const DHelper modrm_helpers[] = {
+  decode_G2E, decode_mov_G2E, decode_E2G, decode_mov_E2G, decode_lea_M2G,
+  decode_I_E2G, decode_I2E, decode_mov_I2E, decode_SI2E,
+  decode_SI_E2G, decode_E, decode_setcc_E, decode_gp2_1_E, decode_gp2_cl2E,
+  decode_gp2_Ib2E, decode_Ib_G2E, decode_cl_G2E,
+};
+
+static const DHelper plain_helpers[] = {
+  NULL, decode_I2a, decode_I2r, decode_mov_I2r, decode_I, decode_r,
+  decode_test_I, decode_J, decode_push_SI,
+};
+
+/* the system instructions, the prefixes and the undefined opcodes */
+static const EHelper skipped[] = {
+  exec_inv, exec_nemu_trap, exec_hlt, exec_lidt, exec_int, exec_iret,
+  exec_operand_size, exec_lock, exec_rep, exec_repne,
+};
+
+static const EHelper strings[] = {
+  exec_movs, exec_stos, exec_lods, exec_cmps, exec_scas,
+};
+
+#define contains(array, x) ({ \
+  int i_, found_ = false; \
+  for (i_ = 0; i_ < sizeof(array) / sizeof(array[0]); i_ ++) { \
+    if (array[i_] == (x)) { found_ = true; break; } \
+  } \
+  found_; \
+})
+
+/* the operands after the opcode, or -1 for the decode helpers which are
+ * not fuzzed, such as those of I/O */
+static int format_of(DHelper decode) {
+  if (contains(modrm_helpers, decode)) return FMT_MODRM;
+  if (contains(plain_helpers, decode)) return FMT_NONE;
+  if (decode == decode_O2a || decode == decode_a2O) return FMT_MOFFS;
+  return -1;
+}
+
+static void add_cand(uint32_t opcode, int ext, int format, EHelper execute, DHelper decode) {
+  Candidate *c = &cands[nr_cand ++];
+  c->opcode = opcode;
+  c->ext = ext;
+  c->format = format;
+  c->is_string = contains(strings, execute);
+  c->is_lea = (decode == decode_lea_M2G);
+  c->ptr_regs = 1 << R_ESP;
+  if (c->is_string) { c->ptr_regs |= (1 << R_ESI) | (1 << R_EDI); }
+  if (opcode == 0xc8 || opcode == 0xc9) { c->ptr_regs |= 1 << R_EBP; }  // enter, leave
+  if (opcode == 0xd7) { c->ptr_regs |= 1 << R_EBX; }  // xlat
+}
+
+static bool is_selected(uint32_t opcode, char *list) {
+  if (list == NULL) return true;
+  char buf[256];
+  snprintf(buf, sizeof(buf), "%s", list);
+  char *p;
+  for (p = strtok(buf, ","); p != NULL; p = strtok(NULL, ",")) {
+    uint32_t op = strtoul(p, NULL, 16);
+    if (op == opcode || (op >= 0x0f00 && op - 0x0f00 + 0x100 == opcode)) return true;
+  }
+  return false;
+}
+
+/* the implemented opcodes, and the implemented members of the groups */
+static void init_cands(char *list) {
+  uint32_t opcode;
+  for (opcode = 0; opcode < 512; opcode ++) {
+    if (opcode == 0x0f) continue;   // escape of the two-byte opcodes
+    if (!is_selected(opcode, list)) continue;
+    opcode_entry *e = &opcode_table[opcode];
+    if (contains(skipped, e->execute)) continue;
+    int format = format_of(e->decode);
+    if (format < 0) continue;
+    if (format != FMT_MODRM) {
+      add_cand(opcode, -1, format, e->execute, e->decode);
+      continue;
+    }
+
+    int ext;
+    for (ext = 0; ext < 8; ext ++) {
+      opcode_entry *sub = get_opcode_entry(opcode, ext);
+      if (sub == e) {
+        add_cand(opcode, -1, format, e->execute, e->decode);
+        break;
+      }
+      if (contains(skipped, sub->execute) || format_of(sub->decode) != FMT_NONE) continue;
+      add_cand(opcode, ext, format, sub->execute, e->decode);
+    }
+  }
+}
+
+/* ------------------------------ generate ------------------------------ */
+
+typedef struct {
+  uint64_t seed;
+  uint8_t code[MAX_INSTR_LEN + 1];
+  uint8_t fixed;        // bytes which decide the addresses of the operands
+  uint8_t addr_regs;    // registers used as addresses
+  uint32_t gpr[8];
+  uint32_t eflags;
+  uint8_t data[WINDOW];
+} Case;
+
+/* the same layout as the registers of DiffTest */
+typedef struct {
+  uint32_t gpr[8];
+  uint32_t eip, eflags;
+  uint8_t data[WINDOW];
+} State;
+
+static uint64_t rand_state;
+
+static inline uint64_t rand64() {
+  rand_state ^= rand_state << 13;
+  rand_state ^= rand_state >> 7;
+  rand_state ^= rand_state << 17;
+  return rand_state;
+}
+
+static inline uint32_t rand_below(uint32_t n) {
+  return ((rand64() >> 32) * n) >> 32;
+}
+
+static inline uint64_t mix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ull;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+  return x ^ (x >> 31);
+}
+
+/* the values at the edges of the widths are the most interesting */
+static uint32_t rand_value() {
+  static const uint32_t special[] = {
+    0, 1, 2, 0x7f, 0x80, 0xff, 0x100, 0x7fff, 0x8000, 0xffff, 0x10000,
+    0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff,
+  };
+  switch (rand_below(4)) {
+    case 0: return special[rand_below(sizeof(special) / sizeof(special[0]))];
+    case 1: return rand_below(64);    // counts of shifts and rotates
+    case 2: return -rand_below(64);
+    default: return rand64();
+  }
+}
+
+/* an address in the window, with room for the operands around it */
+static inline vaddr_t rand_addr() {
+  return DATA_BASE + WINDOW / 4 + rand_below(WINDOW / 2);
+}
+
+static uint8_t *gen_modrm(Case *c, uint8_t *p, const Candidate *cand) {
+  int reg = (cand->ext >= 0 ? cand->ext : rand_below(8));
+  int mod = rand_below(4);
+  if (cand->is_lea && mod == 3) { mod = rand_below(3); }  // lea has no register form
+  int rm = rand_below(8);
+  *p ++ = (mod << 6) | (reg << 3) | rm;
+  if (mod == 3) return p;
+
+  int base = rm, index = -1, scale = 0;
+  if (rm == R_ESP) {
+    base = rand_below(8);
+    index = rand_below(8);
+    scale = rand_below(4);
+    /* R_ESP means no index, and an index the same as the base can not
+     * be solved for an address in the window */
+    if (index == base) { index = R_ESP; }
+    *p ++ = (scale << 6) | (index << 3) | base;
+    if (index == R_ESP) { index = -1; }
+  }
+  if (mod == 0 && base == R_EBP) { base = -1; }   // disp32 without a base
+
+  vaddr_t addr = rand_addr();
+  uint32_t index_val = 0;
+  if (index >= 0) {
+    index_val = rand_below(16);
+    c->gpr[index] = index_val;
+    c->addr_regs |= 1 << index;
+  }
+
+  int32_t disp = 0;
+  if (base >= 0) {
+    if (mod == 1) { disp = (int8_t)rand64(); }
+    else if (mod == 2) { disp = (int32_t)rand_below(256) - 128; }
+    c->gpr[base] = addr - disp - (index_val << scale);
+    c->addr_regs |= 1 << base;
+  }
+  else { disp = addr - (index_val << scale); }
+
+  int disp_size = (mod == 1 ? 1 : (mod == 2 || base < 0 ? 4 : 0));
+  memcpy(p, &disp, disp_size);
+  return p + disp_size;
+}
+
+static void gen_case(Case *c, uint64_t seed) {
+  memset(c, 0, sizeof(*c));
+  c->seed = seed;
+  rand_state = mix64(seed) | 1;
+
+  const Candidate *cand = &cands[rand_below(nr_cand)];
+  int i;
+  for (i = 0; i < 8; i ++) { c->gpr[i] = rand_value(); }
+  c->eflags = 0x2 | (rand64() & EFLAGS_RAND);
+  for (i = 0; i < WINDOW; i += 8) {
+    uint64_t v = rand64();
+    memcpy(c->data + i, &v, 8);
+  }
+  for (i = 0; i < WINDOW / 32; i ++) {
+    uint32_t v = rand_value();
+    memcpy(c->data + rand_below(WINDOW / 4) * 4, &v, 4);
+  }
+
+  uint8_t *p = c->code;
+  if (rand_below(4) == 0) { *p ++ = 0x66; }
+  if (cand->is_string && rand_below(2)) {
+    *p ++ = (rand_below(2) ? 0xf3 : 0xf2);
+    c->gpr[R_ECX] = rand_below(8);
+  }
+  if (cand->opcode >= 0x100) { *p ++ = 0x0f; }
+  *p ++ = cand->opcode & 0xff;
+
+  for (i = 0; i < 8; i ++) {
+    if (cand->ptr_regs & (1 << i)) { c->gpr[i] = DATA_BASE + WINDOW / 2 - 64 + rand_below(128); }
+  }
+  c->addr_regs = cand->ptr_regs;
+
+  if (cand->format == FMT_MODRM) { p = gen_modrm(c, p, cand); }
+  else if (cand->format == FMT_MOFFS) {
+    vaddr_t addr = rand_addr();
+    memcpy(p, &addr, 4);
+    p += 4;
+  }
+  c->fixed = p - c->code;
+
+  /* the immediate, and the bytes after the instruction */
+  for (; p < c->code + MAX_INSTR_LEN; p ++) { *p = rand_value(); }
+}
+
+/* -------------------------------- run --------------------------------- */
+
+static struct {
+  void (*memcpy_from_dut)(paddr_t dest, void *src, size_t n);
+  void (*memcpy_to_dut)(paddr_t src, void *dest, size_t n);
+  void (*getregs)(void *c);
+  void (*setregs)(const void *c);
+  void (*exec)(uint64_t n);
+  void (*init)(void);
+} ref;
+
+static uint32_t eflags_mask = EFLAGS_MASK;
+static int instr_len = 0;   // of the last case run by NEMU
+
+/* called before the workers are forked, which then call ref.init() */
+static void load_ref(char *ref_so_file) {
+  void *handle = dlopen(ref_so_file, RTLD_LAZY | RTLD_DEEPBIND);
+  Assert(handle, "Can not load the reference %s: %s", ref_so_file, dlerror());
+
+  ref.memcpy_from_dut = dlsym(handle, "difftest_memcpy_from_dut");
+  ref.memcpy_to_dut = dlsym(handle, "difftest_memcpy_to_dut");
+  ref.exec = dlsym(handle, "difftest_exec");
+  ref.init = dlsym(handle, "difftest_init");
+  assert(ref.memcpy_from_dut && ref.memcpy_to_dut && ref.exec && ref.init);
+
+  ref.getregs = dlsym(handle, "difftest_getregs_eflags");
+  ref.setregs = dlsym(handle, "difftest_setregs_eflags");
+  if (ref.getregs == NULL || ref.setregs == NULL) {
+    /* EFLAGS is not compared */
+    ref.getregs = dlsym(handle, "difftest_getregs");
+    ref.setregs = dlsym(handle, "difftest_setregs");
+    assert(ref.getregs && ref.setregs);
+    eflags_mask = 0;
+    fprintf(report, "EFLAGS is not compared, as %s does not have difftest_getregs_eflags()\n", ref_so_file);
+  }
+}
+
+enum { CASE_PASS, CASE_FAIL, CASE_SKIP };
+
+static int run_case(const Case *c, State *dut, State *ref_s) {
+  int i;
+
+  /* NEMU */
+  dma_write(CODE_BASE, c->code, sizeof(c->code));
+  dma_write(DATA_BASE, c->data, WINDOW);
+  for (i = 0; i < 8; i ++) { reg_l(i) = c->gpr[i]; }
+  cpu.eip = CODE_BASE;
+  cpu.eflags.val = c->eflags;
+  nemu_state = NEMU_RUNNING;
+  exec_wrapper(false);
+  instr_len = decoding.seq_eip - CODE_BASE;
+  /* an instruction which stops NEMU, such as one not implemented */
+  if (nemu_state != NEMU_RUNNING) return CASE_SKIP;
+
+  for (i = 0; i < 8; i ++) { dut->gpr[i] = reg_l(i); }
+  dut->eip = cpu.eip;
+  dut->eflags = cpu.eflags.val;
+  memcpy(dut->data, guest_to_host(DATA_BASE), WINDOW);
+
+  /* the reference */
+  State r;
+  memcpy(r.gpr, c->gpr, sizeof(r.gpr));
+  r.eip = CODE_BASE;
+  r.eflags = c->eflags;
+  ref.memcpy_from_dut(CODE_BASE, (void *)c->code, sizeof(c->code));
+  ref.memcpy_from_dut(DATA_BASE, (void *)c->data, WINDOW);
+  ref.setregs(&r);
+  ref.exec(1);
+  ref_s->eflags = 0;
+  ref.getregs(ref_s);
+  ref.memcpy_to_dut(DATA_BASE, ref_s->data, WINDOW);
+
+  bool same = (dut->eip == ref_s->eip && ((dut->eflags ^ ref_s->eflags) & eflags_mask) == 0);
+  for (i = 0; i < 8; i ++) {
+    if (dut->gpr[i] != ref_s->gpr[i]) same = false;
+  }
+  if (same && memcmp(dut->data, ref_s->data, WINDOW) != 0) same = false;
+  return (same ? CASE_PASS : CASE_FAIL);
+}
+
+static bool still_fails(const Case *c) {
+  static State dut, ref_s;
+  return run_case(c, &dut, &ref_s) == CASE_FAIL;
+}
+
+/* try `t' instead of `c' */
+#define try_case(c, t) do { if (still_fails(&t)) { c = t; } else { t = c; } } while (0)
+
+static void minimize(Case *c) {
+  Case t = *c;
+  int i, b;
+
+  still_fails(c);   // for the length of the instruction
+  memset(t.code + instr_len, 0, sizeof(t.code) - instr_len);
+  try_case(*c, t);
+
+  for (i = c->fixed; i < instr_len; i ++) {
+    if (t.code[i] == 0) continue;
+    t.code[i] = 0;
+    try_case(*c, t);
+  }
+
+  for (i = 0; i < 8; i ++) {
+    if (c->addr_regs & (1 << i) || t.gpr[i] == 0) continue;
+    t.gpr[i] = 0;
+    try_case(*c, t);
+    for (b = 31; b >= 0; b --) {
+      if (!(t.gpr[i] & (1u << b))) continue;
+      t.gpr[i] &= ~(1u << b);
+      try_case(*c, t);
+    }
+  }
+
+  for (b = 0; b < 32; b ++) {
+    if (!(EFLAGS_RAND & t.eflags & (1u << b))) continue;
+    t.eflags &= ~(1u << b);
+    try_case(*c, t);
+  }
+
+  for (i = 0; i < WINDOW; i += 4) {
+    if (*(uint32_t *)(t.data + i) == 0) continue;
+    memset(t.data + i, 0, 4);
+    try_case(*c, t);
+  }
+}
+
+#define MAX_REPORT_WORDS 16
+#define MAX_REPORT_BYTES 8
+
+static void report_case(FILE *fp, const Case *c) {
+  State dut, ref_s;
+  run_case(c, &dut, &ref_s);
+  int i, n;
+
+  fprintf(fp, "  code:");
+  for (i = 0; i < instr_len; i ++) { fprintf(fp, " %02x", c->code[i]); }
+#ifdef DEBUG
+  fprintf(fp, "    %s", decoding.assembly);
+#endif
+  fprintf(fp, "\n");
+  for (i = 0; i < 8; i ++) {
+    fprintf(fp, "  %s = 0x%08x%s", regsl[i], c->gpr[i], (i % 4 == 3 ? "\n" : ""));
+  }
+  fprintf(fp, "  eflags = 0x%08x\n", c->eflags);
+  for (i = n = 0; i < WINDOW && n < MAX_REPORT_WORDS; i += 4) {
+    uint32_t v;
+    memcpy(&v, c->data + i, 4);
+    if (v == 0) continue;
+    fprintf(fp, "  [0x%08x] = 0x%08x\n", DATA_BASE + i, v);
+    n ++;
+  }
+  if (n == MAX_REPORT_WORDS) { fprintf(fp, "  ... other words of the memory are not 0\n"); }
+
+  fprintf(fp, "  after the instruction:\n");
+  for (i = 0; i < 8; i ++) {
+    if (dut.gpr[i] != ref_s.gpr[i]) {
+      fprintf(fp, "    %s is different: ref = 0x%08x, nemu = 0x%08x\n", regsl[i], ref_s.gpr[i], dut.gpr[i]);
+    }
+  }
+  if (dut.eip != ref_s.eip) {
+    fprintf(fp, "    eip is different: ref = 0x%08x, nemu = 0x%08x\n", ref_s.eip, dut.eip);
+  }
+  if ((dut.eflags ^ ref_s.eflags) & eflags_mask) {
+    fprintf(fp, "    eflags is different: ref = 0x%08x, nemu = 0x%08x\n",
+        ref_s.eflags & eflags_mask, dut.eflags & eflags_mask);
+  }
+  for (i = n = 0; i < WINDOW && n < MAX_REPORT_BYTES; i ++) {
+    if (dut.data[i] == ref_s.data[i]) continue;
+    fprintf(fp, "    byte at 0x%08x is different: ref = 0x%02x, nemu = 0x%02x\n",
+        DATA_BASE + i, ref_s.data[i], dut.data[i]);
+    n ++;
+  }
+}
+
+/* ------------------------------ workers ------------------------------- */
+
+/* shared with the main process, one cache line for each worker */
+typedef struct {
+  volatile uint64_t nr_case, nr_skip;
+  volatile uint64_t seed;   // of the current case
+  uint64_t pad[5];
+} Slot;
+
+static Slot *slots;
+
+static void init_worker() {
+  /* the components may print logs, only the report goes to stdout */
+  assert(freopen("/dev/null", "w", stdout) != NULL);
+  init_pmem(PMEM_DEFAULT_SIZE);
+  /* the cache and the branch predictor are not initialized, and they do
+   * not change the results */
+  is_detailed = false;
+  ref.init();
+}
+
+static void fail(const Case *c, const char *who) {
+  Case m = *c;
+  minimize(&m);
+
+  char *buf;
+  size_t size;
+  FILE *fp = open_memstream(&buf, &size);
+  assert(fp != NULL);
+  fprintf(fp, "%s: different result in case %#lx, replay with -r %#lx\n", who, c->seed, c->seed);
+  report_case(fp, &m);
+  fclose(fp);
+  fputs(buf, report);
+  fflush(report);
+  free(buf);
+}
+
+static int worker(int id, uint64_t seed, uint64_t n) {
+  Slot *slot = &slots[id];
+  State dut, ref_s;
+  Case c;
+  uint64_t i, nr_skip = 0;
+  char who[32];
+  snprintf(who, sizeof(who), "worker %d", id);
+
+  for (i = 0; n == 0 || i < n; i ++) {
+    uint64_t case_seed = mix64(seed + ((uint64_t)id << 40) + i);
+    slot->seed = case_seed;
+    gen_case(&c, case_seed);
+    int ret = run_case(&c, &dut, &ref_s);
+    if (ret == CASE_SKIP) { nr_skip ++; }
+    else if (ret == CASE_FAIL) {
+      fail(&c, who);
+      slot->nr_case = i + 1;
+      return 1;
+    }
+    if ((i & 0x3ff) == 0) {
+      slot->nr_case = i;
+      slot->nr_skip = nr_skip;
+    }
+  }
+  slot->nr_case = i;
+  slot->nr_skip = nr_skip;
+  return 0;
+}
+
+static void replay(uint64_t case_seed) {
+  Case c;
+  State dut, ref_s;
+  gen_case(&c, case_seed);
+  switch (run_case(&c, &dut, &ref_s)) {
+    case CASE_PASS: fprintf(report, "case %#lx: the same result\n", case_seed); break;
+    case CASE_SKIP: fprintf(report, "case %#lx: NEMU stops at the instruction\n", case_seed); break;
+    default: fail(&c, "replay"); break;
+  }
+}
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t total(int nr_worker, uint64_t *nr_skip) {
+  uint64_t sum = 0;
+  int i;
+  *nr_skip = 0;
+  for (i = 0; i < nr_worker; i ++) {
+    sum += slots[i].nr_case;
+    *nr_skip += slots[i].nr_skip;
+  }
+  return sum;
+}
+
+int main(int argc, char *argv[]) {
+  char *ref_so_file = NULL, *list = NULL;
+  int nr_worker = sysconf(_SC_NPROCESSORS_ONLN);
+  uint64_t n = 1000000, seed = now_ns(), replay_seed = 0;
+  bool is_replay = false;
+  int o;
+  while ((o = getopt(argc, argv, "d:j:n:s:r:o:m:")) != -1) {
+    switch (o) {
+      case 'd': ref_so_file = optarg; break;
+      case 'j': nr_worker = atoi(optarg); break;
+      case 'n': n = strtoull(optarg, NULL, 0); break;
+      case 's': seed = strtoull(optarg, NULL, 0); break;
+      case 'r': replay_seed = strtoull(optarg, NULL, 0); is_replay = true; break;
+      case 'o': list = optarg; break;
+      case 'm': eflags_mask = strtoul(optarg, NULL, 0); break;
+      default:
+        printf("Usage: %s -d REF_SO [OPTION...]\n", argv[0]);
+        printf("\t-d REF_SO     the reference, with the interface of DiffTest\n");
+        printf("\t-j JOBS       number of worker processes (default: number of cores)\n");
+        printf("\t-n CASES      cases for each worker, 0 for no limit (default 1000000)\n");
+        printf("\t-s SEED       seed of the cases (default: the time)\n");
+        printf("\t-r CASE       replay and minimize one case\n");
+        printf("\t-o OPCODES    only fuzz these opcodes in hex, such as 88,8b,0fb6\n");
+        printf("\t-m MASK       bits of EFLAGS to compare (default %#x)\n", EFLAGS_MASK);
+        return 1;
+    }
+  }
+  Assert(ref_so_file != NULL, "the reference is not given by -d");
+  Assert(nr_worker > 0, "at least one worker is needed");
+
+  report = fdopen(dup(STDOUT_FILENO), "w");
+  assert(report != NULL);
+  setvbuf(report, NULL, _IOLBF, 0);
+
+  init_cands(list);
+  Assert(nr_cand > 0, "no implemented instruction to fuzz");
+  load_ref(ref_so_file);
+
+  if (is_replay) {
+    init_worker();
+    replay(replay_seed);
+    return 0;
+  }
+
+  fprintf(report, "fuzzing %d opcodes with %d workers, seed %#lx\n", nr_cand, nr_worker, seed);
+
+  slots = mmap(NULL, sizeof(Slot) * nr_worker, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  assert(slots != MAP_FAILED);
+  pid_t *pids = malloc(sizeof(pid_t) * nr_worker);
+  assert(pids != NULL);
+
+  uint64_t start = now_ns();
+  int i;
+  for (i = 0; i < nr_worker; i ++) {
+    pids[i] = fork();
+    assert(pids[i] >= 0);
+    if (pids[i] == 0) {
+      init_worker();
+      exit(worker(i, seed, n));
+    }
+  }
+
+  int nr_running = nr_worker, ret = 0;
+  uint64_t last = start, nr_skip;
+  while (nr_running > 0) {
+    int status;
+    pid_t pid = waitpid(-1, &status, WNOHANG);
+    if (pid == 0) {
+      usleep(100000);
+      if (now_ns() - last >= PROGRESS_SEC * 1000000000ull) {
+        last = now_ns();
+        uint64_t sum = total(nr_worker, &nr_skip);
+        fprintf(report, "  %lu cases, %.2f M/s\n", sum, sum * 1e3 / (last - start));
+      }
+      continue;
+    }
+    assert(pid > 0);
+    nr_running --;
+    for (i = 0; i < nr_worker && pids[i] != pid; i ++);
+    pids[i] = 0;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) continue;
+
+    if (WIFSIGNALED(status) && WTERMSIG(status) != SIGTERM) {
+      fprintf(report, "worker %d crashed in case %#lx, replay with -r %#lx\n",
+          i, slots[i].seed, slots[i].seed);
+    }
+    if (ret == 0) {
+      /* stop the others at the first failure */
+      int j;
+      for (j = 0; j < nr_worker; j ++) {
+        if (pids[j] > 0) kill(pids[j], SIGTERM);
+      }
+    }
+    ret = 1;
+  }
+
+  uint64_t sum = total(nr_worker, &nr_skip);
+  double sec = (now_ns() - start) / 1e9;
+  fprintf(report, "%lu cases (%lu stopped NEMU) in %.2f s, %.2f M/s\n", sum, nr_skip, sec, sum / sec / 1e6);
+  return ret;
+}
@@ -4,9 +4,11 @@
 
 typedef uint32_t paddr_t;
 #define DIFFTEST_REG_SIZE (sizeof(uint32_t) * 9) // GPRs + EIP
+#define DIFFTEST_REG_EFLAGS_SIZE (DIFFTEST_REG_SIZE + sizeof(uint32_t)) // and EFLAGS
 
 bool gdb_connect_qemu(void);
 bool gdb_memcpy_to_qemu(uint32_t, void *, int);
+bool gdb_memcpy_from_qemu(uint32_t, void *, int);
 bool gdb_getregs(union gdb_regs *);
 bool gdb_setregs(union gdb_regs *);
 bool gdb_si(void);
@@ -17,6 +19,11 @@ void difftest_memcpy_from_dut(paddr_t dest, void *src, size_t n) {
   assert(ok == 1);
 }
 
+void difftest_memcpy_to_dut(paddr_t src, void *dest, size_t n) {
+  bool ok = gdb_memcpy_from_qemu(src, dest, n);
+  assert(ok == 1);
+}
+
 void difftest_getregs(void *r) {
   union gdb_regs qemu_r;
   gdb_getregs(&qemu_r);
@@ -30,6 +37,20 @@ void difftest_setregs(const void *r) {
   gdb_setregs(&qemu_r);
 }
 
+/* optional, with EFLAGS, used by the fuzzer of NEMU */
+void difftest_getregs_eflags(void *r) {
+  union gdb_regs qemu_r;
+  gdb_getregs(&qemu_r);
+  memcpy(r, &qemu_r, DIFFTEST_REG_EFLAGS_SIZE);
+}
+
+void difftest_setregs_eflags(const void *r) {
+  union gdb_regs qemu_r;
+  gdb_getregs(&qemu_r);
+  memcpy(&qemu_r, r, DIFFTEST_REG_EFLAGS_SIZE);
+  gdb_setregs(&qemu_r);
+}
+
 void difftest_exec(uint64_t n) {
   while (n --) gdb_si();
 }
@@ -44,6 +44,37 @@ bool gdb_memcpy_to_qemu(uint32_t dest, void *src, int len) {
   return ok;
 }
 
+static bool gdb_memcpy_from_qemu_small(uint32_t src, void *dest, int len) {
+  char buf[64];
+  sprintf(buf, "m0x%x,%x", src, len);
+  gdb_send(conn, (const uint8_t *)buf, strlen(buf));
+
+  size_t size;
+  uint8_t *reply = gdb_recv(conn, &size);
+  bool ok = (size == len * 2);
+  int i;
+  for (i = 0; ok && i < len; i ++) {
+    ((uint8_t *)dest)[i] = gdb_decode_hex(reply[i * 2], reply[i * 2 + 1]);
+  }
+  free(reply);
+
+  return ok;
+}
+
+bool gdb_memcpy_from_qemu(uint32_t src, void *dest, int len) {
+  /* the reply is hex encoded, keep it within the packet size of QEMU */
+  const int mtu = 1024;
+  bool ok = true;
+  while (len > mtu) {
+    ok &= gdb_memcpy_from_qemu_small(src, dest, mtu);
+    src += mtu;
+    dest += mtu;
+    len -= mtu;
+  }
+  ok &= gdb_memcpy_from_qemu_small(src, dest, len);
+  return ok;
+}
+
 bool gdb_getregs(union gdb_regs *r) {
   gdb_send(conn, (const uint8_t *)"g", 1);
   size_t size;
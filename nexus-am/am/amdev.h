@@ -15,6 +15,7 @@ extern "C" {
 #define _DEV_TIMER   0x0000ac03 // AM Virtual Timer
 #define _DEV_VIDEO   0x0000ac04 // AM Virtual Video Controller
 #define _DEV_SERIAL  0x0000ac05 // AM Virtual Serial
+#define _DEV_SEMIHOST 0x0000ac06 // AM Virtual Semihosting Channel
 #define _DEV_PCICONF 0x00000080 // PCI Configuration Space
 #define _DEV_ATA0    0x00000dd0 // Primary ATA
 #define _DEV_ATA1    0x00000dd1 // Secondary ATA
@@ -22,6 +23,22 @@ extern "C" {
 // ================= Device Register Specifications ==================
 
 // --------- _DEV_PERFCNT AM Performance Counter (0000ac01) ----------
+#define _DEVREG_PERFCNT_INSTR         1  // retired instructions
+#define _DEVREG_PERFCNT_CYCLE         2  // virtual cycles
+#define _DEVREG_PERFCNT_TLB_ACCESS    3
+#define _DEVREG_PERFCNT_TLB_MISS      4
+#define _DEVREG_PERFCNT_ICACHE_ACCESS 5
+#define _DEVREG_PERFCNT_ICACHE_MISS   6
+#define _DEVREG_PERFCNT_DCACHE_ACCESS 7
+#define _DEVREG_PERFCNT_DCACHE_MISS   8
+#define _DEVREG_PERFCNT_L2_ACCESS     9
+#define _DEVREG_PERFCNT_L2_MISS       10
+#define _DEVREG_PERFCNT_BRANCH        11
+#define _DEVREG_PERFCNT_BRANCH_MISS   12
+  typedef struct {
+    uint32_t hi; // high 32bit of the counter
+    uint32_t lo; //  low 32bit of the counter
+  } _PerfCntReg;
 
 // ------------- _DEV_INPUT: AM Input Devices (0000ac02) -------------
 #define _DEVREG_INPUT_KBD     1
@@ -83,6 +100,33 @@ extern "C" {
 #define _DEVREG_SERIAL_STAT 2
 #define _DEVREG_SERIAL_CTRL 3
 
+// ------- _DEV_SEMIHOST: AM Semihosting Channel (0000ac06) ----------
+// write a command to the device, and it is done when the write returns
+#define _DEVREG_SEMIHOST_CMD  1
+  enum {
+    _SEMIHOST_OPEN = 1, // open @buf[0..@len) with @flags, @ret = fd
+    _SEMIHOST_READ,     // read at most @len bytes to @buf, @ret = bytes
+    _SEMIHOST_WRITE,    // write @len bytes from @buf, @ret = bytes
+    _SEMIHOST_LSEEK,    // seek to @offset from @whence, @ret = new offset
+    _SEMIHOST_CLOSE,    // close @fd
+  };
+  #define _SEMIHOST_O_RDONLY 0x000
+  #define _SEMIHOST_O_WRONLY 0x001
+  #define _SEMIHOST_O_RDWR   0x002
+  #define _SEMIHOST_O_CREAT  0x100
+  #define _SEMIHOST_O_TRUNC  0x200
+  #define _SEMIHOST_O_APPEND 0x400
+  typedef struct {
+    uint32_t cmd;    // _SEMIHOST_XXX
+    uint32_t fd;
+    void *buf;       // the path or the data, physical address
+    uint32_t len;
+    uint32_t flags;  // _SEMIHOST_O_XXX
+    int32_t offset;
+    uint32_t whence; // 0: set, 1: current, 2: end
+    int32_t ret;     // negative errno on failure
+  } _SemihostReg;
+
 
 // -------- _DEV_PCICONF: PCI Configuration Space (00000080) ---------
 #define _DEVREG_PCICONF(bus, slot, func, offset) \
@@ -0,0 +1,13 @@
+#include <am.h>
+#include <x86.h>
+#include <amdev.h>
+
+#define PERFCNT_PORT 0x50
+
+size_t perfcnt_read(uintptr_t reg, void *buf, size_t size) {
+  _PerfCntReg *cnt = (_PerfCntReg *)buf;
+  outl(PERFCNT_PORT, reg);
+  cnt->lo = inl(PERFCNT_PORT + 4);
+  cnt->hi = inl(PERFCNT_PORT + 8);
+  return sizeof(_PerfCntReg);
+}
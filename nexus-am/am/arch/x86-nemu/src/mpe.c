@@ -0,0 +1,42 @@
+#include <am.h>
+#include <x86.h>
+
+#define MP_PORT 0x70
+#define MAX_CPU 8
+#define STACK_SIZE (16 * 1024)
+
+static void (*mp_entry)() = NULL;
+static uint8_t ap_stack[MAX_CPU][STACK_SIZE];
+
+static void ap_start() {
+  mp_entry();
+  _halt(1);
+}
+
+int _mpe_init(void (*entry)()) {
+  mp_entry = entry;
+  int i, ncpu = _ncpu();
+  for (i = 1; i < ncpu; i ++) {
+    // startup IPI: the eip and the esp, then the id of the CPU
+    outl(MP_PORT + 8, (uintptr_t)ap_start);
+    outl(MP_PORT + 12, (uintptr_t)(ap_stack[i] + STACK_SIZE));
+    outl(MP_PORT + 16, i);
+  }
+  entry();
+  _halt(1);
+  return 0;
+}
+
+int _ncpu() {
+  return inl(MP_PORT);
+}
+
+int _cpu() {
+  return inl(MP_PORT + 4);
+}
+
+intptr_t _atomic_xchg(volatile intptr_t *addr, intptr_t newval) {
+  intptr_t result;
+  asm volatile ("lock xchgl %0, %1" : "+m"(*addr), "=a"(result) : "1"(newval) : "cc");
+  return result;
+}
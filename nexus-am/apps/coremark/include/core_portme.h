@@ -7,6 +7,7 @@
 #define CORE_PORTME_H
 
 #include <klib.h>
+#include <amdev.h>
 
 #define ITERATIONS 1000
 #define MEM_METHOD MEM_STATIC
@@ -68,6 +68,7 @@ typedef ee_u32 secs_ret;
 void start_time(void);
 void stop_time(void);
 CORE_TICKS get_time(void);
+uint64_t get_instr(void);
 secs_ret time_in_secs(CORE_TICKS ticks);
 
 /* Misc useful functions */
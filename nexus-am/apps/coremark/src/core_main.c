@@ -316,6 +316,8 @@ MAIN_RETURN_TYPE main(int argc, char *argv[]) {
 	for (i=0 ; i<default_num_contexts; i++) 
 		ee_printf("[%d]crcfinal      : 0x%04x\n",i,results[i].crc);
   ee_printf("Finised in %d ms.\n", (int)total_time);
+  if (get_instr() != 0)
+    ee_printf("Instructions     : %d K\n", (int)(get_instr() / 1000));
 	if (total_errors==0) {
     ee_printf("==================================================\n");
 	  ee_printf("CoreMark PASS       %d Marks\n", 4468608 / time_in_secs(total_time) * ITERATIONS / 1000);
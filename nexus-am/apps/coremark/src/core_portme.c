@@ -38,6 +38,7 @@
 
 /** Define Host specific (POSIX), or target specific global time variables. */
 unsigned long start_time_val, stop_time_val;
+uint64_t start_instr_val, stop_instr_val;
 
 /* Function : start_time
 	This function will be called right before starting the timed portion of the benchmark.
@@ -47,6 +48,7 @@ unsigned long start_time_val, stop_time_val;
 */
 void start_time(void) {
   start_time_val = uptime();
+  start_instr_val = perfcnt(_DEVREG_PERFCNT_INSTR);
 }
 /* Function : stop_time
 	This function will be called right after ending the timed portion of the benchmark.
@@ -55,6 +57,7 @@ void start_time(void) {
 	or other system parameters - e.g. reading the current value of cpu cycles counter.
 */
 void stop_time(void) {
+  stop_instr_val = perfcnt(_DEVREG_PERFCNT_INSTR);
   stop_time_val = uptime();
 }
 /* Function : get_time
@@ -70,6 +73,14 @@ CORE_TICKS get_time(void) {
   return stop_time_val - start_time_val;
 }
 
+/* Function : get_instr
+	Return the number of instructions executed in the timed portion,
+	or 0 if the platform has no performance counter.
+*/
+uint64_t get_instr(void) {
+  return stop_instr_val - start_instr_val;
+}
+
 /* Function : time_in_secs
 	Convert the value returned by get_time to seconds.
 
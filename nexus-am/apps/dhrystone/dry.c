@@ -351,10 +351,11 @@
 /* variables for time measurement: */
 
 #include <am.h>
+#include <amdev.h>
 #include <klib.h>
 
-#define Start_Timer() Begin_Time = uptime()
-#define Stop_Timer()  End_Time   = uptime()
+#define Start_Timer() (Begin_Time = uptime(), Begin_Instr = perfcnt(_DEVREG_PERFCNT_INSTR))
+#define Stop_Timer()  (End_Instr = perfcnt(_DEVREG_PERFCNT_INSTR), End_Time = uptime())
 
 #define NUMBER_OF_RUNS		500000 /* Default number of runs */
 #define PASS2
@@ -445,6 +446,8 @@ Boolean		Done;
 long            Begin_Time,
                 End_Time,
                 User_Time;
+uint64_t        Begin_Instr,
+                End_Instr;
 float           Microseconds,
                 Dhrystones_Per_Second;
 
@@ -939,6 +942,9 @@ int main ()
   }
 
   printf ("Finished in %d ms\n", (int)User_Time);
+  if (End_Instr != Begin_Instr) {
+    printf ("Instructions: %d K\n", (int)((End_Instr - Begin_Instr) / 1000));
+  }
   printk("==================================================\n");
   printk("Dhrystone %s         %d Marks\n", pass ? "PASS" : "FAIL",
       1030270 / (int)User_Time * NUMBER_OF_RUNS/ 500000);
@@ -3,6 +3,7 @@
 
 #include <am.h>
 #include <klib.h>
+#include <amdev.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -92,6 +93,7 @@ extern Setting *setting;
 typedef struct Result {
   int pass;
   unsigned long tsc, msec;
+  uint64_t instr;
 } Result;
 
 void prepare(Result *res);
@@ -26,9 +26,11 @@ Benchmark benchmarks[] = {
 // Running a benchmark
 static void bench_prepare(Result *res) {
   res->msec = uptime();
+  res->instr = perfcnt(_DEVREG_PERFCNT_INSTR);
 }
 
 static void bench_done(Result *res) {
+  res->instr = perfcnt(_DEVREG_PERFCNT_INSTR) - res->instr;
   res->msec = uptime() - res->msec;
 }
 
@@ -70,6 +72,7 @@ int main() {
       printk("Ignored %s\n", msg);
     } else {
       unsigned long msec = ULONG_MAX;
+      uint64_t instr = 0;
       int succ = 1;
       for (int i = 0; i < REPEAT; i ++) {
         Result res;
@@ -77,6 +80,7 @@ int main() {
         printk(res.pass ? "*" : "X");
         succ &= res.pass;
         if (res.msec < msec) msec = res.msec;
+        instr = res.instr;  // the same in every run
       }
 
       if (succ) printk(" Passed.");
@@ -90,6 +94,9 @@ int main() {
       if (SETTING != 0) {
         printk("  min time: %d ms [%d]\n", (unsigned int)msec, (unsigned int)cur);
       }
+      if (instr != 0) {
+        printk("  instructions: %d K\n", (unsigned int)(instr / 1000));
+      }
 
       bench_score += cur;
     }
@@ -15,6 +15,15 @@ extern "C" {
 // am devices
 
 uint32_t uptime();
+uint64_t perfcnt(int reg);
+int semihost_open(const char *path, int flags);
+int semihost_read(int fd, void *buf, size_t len);
+int semihost_write(int fd, const void *buf, size_t len);
+int semihost_lseek(int fd, int offset, int whence);
+int semihost_close(int fd);
+// semihost_*() return a negative errno of the host on failure, or
+// -SEMIHOST_ENODEV if there is no semihosting channel on this platform
+#define SEMIHOST_ENODEV 19
 void get_timeofday(void *rtc);
 int read_key();
 void draw_rect(uint32_t *pixels, int x, int y, int w, int h);
@@ -1,18 +1,18 @@
 #include <klib.h>
 #include <amdev.h>
 
-static _Device *getdev(_Device **ptr, uint32_t id) {
-  if (*ptr) return *ptr;
+// the device of `id', or NULL if there is none on this platform
+static _Device *find_device(uint32_t id) {
   for (int n = 1; ; n ++) {
     _Device *cur = _device(n);
-    if (cur->id == id) {
-      *ptr = cur;
-      return cur;
-    }
-    if (!cur) break;
+    if (!cur || cur->id == id) return cur;
   }
-  assert(0);
-  return NULL;
+}
+
+static _Device *getdev(_Device **ptr, uint32_t id) {
+  if (!*ptr) *ptr = find_device(id);
+  assert(*ptr);
+  return *ptr;
 }
 
 static _Device *input_dev;
@@ -26,6 +26,51 @@ uint32_t uptime() {
   return uptime.lo;
 }
 
+// return 0 if there is no performance counter on this platform
+uint64_t perfcnt(int reg) {
+  static _Device *perfcnt_dev = NULL;
+  if (perfcnt_dev == NULL) perfcnt_dev = find_device(_DEV_PERFCNT);
+  if (perfcnt_dev == NULL) return 0;
+  _PerfCntReg cnt;
+  perfcnt_dev->read(reg, &cnt, sizeof(cnt));
+  return ((uint64_t)cnt.hi << 32) | cnt.lo;
+}
+
+// files on the host by semihosting, return a negative errno on failure,
+// or -SEMIHOST_ENODEV if there is no semihosting channel on this platform
+static int semihost(_SemihostReg *cmd) {
+  static _Device *semihost_dev = NULL;
+  if (semihost_dev == NULL) semihost_dev = find_device(_DEV_SEMIHOST);
+  if (semihost_dev == NULL) return -SEMIHOST_ENODEV;
+  semihost_dev->write(_DEVREG_SEMIHOST_CMD, cmd, sizeof(*cmd));
+  return cmd->ret;
+}
+
+int semihost_open(const char *path, int flags) {
+  _SemihostReg cmd = { .cmd = _SEMIHOST_OPEN, .buf = (void *)path, .len = strlen(path), .flags = flags };
+  return semihost(&cmd);
+}
+
+int semihost_read(int fd, void *buf, size_t len) {
+  _SemihostReg cmd = { .cmd = _SEMIHOST_READ, .fd = fd, .buf = buf, .len = len };
+  return semihost(&cmd);
+}
+
+int semihost_write(int fd, const void *buf, size_t len) {
+  _SemihostReg cmd = { .cmd = _SEMIHOST_WRITE, .fd = fd, .buf = (void *)buf, .len = len };
+  return semihost(&cmd);
+}
+
+int semihost_lseek(int fd, int offset, int whence) {
+  _SemihostReg cmd = { .cmd = _SEMIHOST_LSEEK, .fd = fd, .offset = offset, .whence = whence };
+  return semihost(&cmd);
+}
+
+int semihost_close(int fd) {
+  _SemihostReg cmd = { .cmd = _SEMIHOST_CLOSE, .fd = fd };
+  return semihost(&cmd);
+}
+
 void get_timeofday(void *rtc) {
   _Device *dev = getdev(&timer_dev, _DEV_TIMER);
   dev->read(_DEVREG_TIMER_DATE, rtc, sizeof(_RTCReg));
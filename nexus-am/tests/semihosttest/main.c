@@ -0,0 +1,58 @@
+#include <am.h>
+#include <amdev.h>
+#include <klib.h>
+
+/* Semihosting: a file in the directory given by --semihost=DIR of NEMU
+ * is created, written, read back at an offset and closed. The paths which
+ * leave the directory must be rejected. Run the image on NEMU with the
+ * option, such as `nemu -b --semihost=/tmp build/semihosttest-x86-nemu'.
+ */
+
+#define FILE_NAME "semihosttest.txt"
+
+static const char msg[] = "hello, semihosting";
+
+static void check(int ok, const char *name, int ret) {
+  printf("%s: %s (ret = %d)\n", name, (ok ? "OK" : "FAILED"), ret);
+  assert(ok);
+}
+
+int main() {
+  _ioe_init();
+
+  int len = strlen(msg);
+  int fd = semihost_open(FILE_NAME, _SEMIHOST_O_RDWR | _SEMIHOST_O_CREAT | _SEMIHOST_O_TRUNC);
+  if (fd == -SEMIHOST_ENODEV) { printf("no semihosting channel on this platform\n"); }
+  check(fd >= 0, "open", fd);
+
+  int ret = semihost_write(fd, msg, len);
+  check(ret == len, "write", ret);
+
+  ret = semihost_lseek(fd, 7, 0);
+  check(ret == 7, "lseek from the start", ret);
+
+  char buf[32];
+  memset(buf, 0, sizeof(buf));
+  ret = semihost_read(fd, buf, sizeof(buf));
+  check(ret == len - 7 && strcmp(buf, msg + 7) == 0, "read back", ret);
+
+  ret = semihost_lseek(fd, 0, 2);
+  check(ret == len, "lseek to the end", ret);
+
+  ret = semihost_close(fd);
+  check(ret == 0, "close", ret);
+  ret = semihost_close(fd);
+  check(ret < 0, "close again", ret);
+
+  /* the paths can not leave the directory */
+  static const char *bad[] = { "../" FILE_NAME, "a/../../" FILE_NAME, "..", "/etc/passwd" };
+  int i;
+  for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i ++) {
+    fd = semihost_open(bad[i], _SEMIHOST_O_RDONLY);
+    printf("\"%s\" ", bad[i]);
+    check(fd < 0 && fd != -SEMIHOST_ENODEV, "rejected", fd);
+  }
+
+  printf("semihosttest: OK\n");
+  return 0;
+}
@@ -0,0 +1,54 @@
+#include <am.h>
+#include <klib.h>
+
+/* Self-modifying code: a function is rewritten in place and called again,
+ * so an emulator which caches decoded code must see the new instructions.
+ * The code is written byte by byte, by memcpy(), and across the boundary
+ * of two pages. */
+
+#ifdef __ISA_X86__
+
+#define NR_ROUND 1000
+#define PAGE_SIZE 4096
+
+static uint8_t code[2 * PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+typedef int (*Func)();
+
+/* mov $val, %eax; ret */
+static Func gen(uint8_t *p, int val, int by_byte) {
+  uint8_t buf[6] = { 0xb8, val & 0xff, (val >> 8) & 0xff, (val >> 16) & 0xff, (val >> 24) & 0xff, 0xc3 };
+  if (by_byte) {
+    volatile uint8_t *q = p;
+    int i;
+    for (i = 0; i < sizeof(buf); i ++) { q[i] = buf[i]; }
+  }
+  else { memcpy(p, buf, sizeof(buf)); }
+  return (Func)p;
+}
+
+static void test(uint8_t *p, const char *name) {
+  int i;
+  for (i = 0; i < NR_ROUND; i ++) {
+    Func f = gen(p, i * 3 + 1, i & 1);
+    int ret = f();
+    if (ret != i * 3 + 1) {
+      printf("%s: round %d returns %d, expect %d\n", name, i, ret, i * 3 + 1);
+      assert(0);
+    }
+  }
+  printf("%s: OK\n", name);
+}
+
+#endif
+
+int main() {
+#ifdef __ISA_X86__
+  test(code, "start of a page");
+  test(code + 0x100, "middle of a page");
+  test(code + PAGE_SIZE - 3, "across two pages");
+#else
+  printf("smctest only runs on x86\n");
+#endif
+  return 0;
+}